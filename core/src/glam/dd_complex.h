@@ -0,0 +1,565 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_DD_COMPLEX_H
+#define GLAMCORE_DD_COMPLEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <string>
+
+/**
+ * A double-double: the unevaluated sum hi + lo of two doubles, with |lo| at most half an ulp of hi. That is about 32
+ * significant digits, which is enough for most zooms, at a small multiple of the cost of a double instead of the
+ * thousandfold cost of mp_float. The exponent range is still a double's.
+ *
+ * Arithmetic is built from the error-free transformations of Knuth and Dekker, so it relies on IEEE round-to-nearest
+ * and an exact std::fma, and must not be compiled with -ffast-math.
+ */
+struct dd_real {
+    double hi = 0;
+    double lo = 0;
+
+    constexpr dd_real() = default;
+
+    constexpr dd_real(double _hi): hi(_hi) { } // NOLINT(google-explicit-constructor)
+
+    constexpr dd_real(double _hi, double _lo): hi(_hi), lo(_lo) { }
+
+    explicit operator double() const {
+        return hi + lo;
+    }
+
+    /**
+     * Parses a decimal number like 1.25e-3 to within an ulp or so of a double-double.
+     * @return the number, or nan if `s` isn't one
+     */
+    static dd_real parse(const std::string &s);
+};
+
+namespace dd_detail {
+    // s + e == a + b exactly
+    inline dd_real two_sum(double a, double b) {
+        double s = a + b;
+        double v = s - a;
+        return { s, (a - (s - v)) + (b - v) };
+    }
+
+    // the same, if |a| >= |b|
+    inline dd_real quick_two_sum(double a, double b) {
+        double s = a + b;
+        return { s, b - (s - a) };
+    }
+
+    // p + e == a * b exactly
+    inline dd_real two_prod(double a, double b) {
+        double p = a * b;
+        return { p, std::fma(a, b, -p) };
+    }
+}
+
+inline dd_real operator-(const dd_real &a) {
+    return { -a.hi, -a.lo };
+}
+
+inline dd_real operator+(const dd_real &a, const dd_real &b) {
+    auto s = dd_detail::two_sum(a.hi, b.hi);
+    if (!std::isfinite(s.hi)) {
+        return s.hi;
+    }
+    auto t = dd_detail::two_sum(a.lo, b.lo);
+    s = dd_detail::quick_two_sum(s.hi, s.lo + t.hi);
+    return dd_detail::quick_two_sum(s.hi, s.lo + t.lo);
+}
+
+inline dd_real operator-(const dd_real &a, const dd_real &b) {
+    return a + -b;
+}
+
+inline dd_real operator*(const dd_real &a, const dd_real &b) {
+    auto p = dd_detail::two_prod(a.hi, b.hi);
+    if (!std::isfinite(p.hi)) {
+        return p.hi;
+    }
+    return dd_detail::quick_two_sum(p.hi, p.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+inline dd_real operator*(const dd_real &a, double b) {
+    auto p = dd_detail::two_prod(a.hi, b);
+    if (!std::isfinite(p.hi)) {
+        return p.hi;
+    }
+    return dd_detail::quick_two_sum(p.hi, p.lo + a.lo * b);
+}
+
+inline dd_real operator/(const dd_real &a, double b) {
+    double q1 = a.hi / b;
+    if (!std::isfinite(q1) || !std::isfinite(b)) {
+        return q1;
+    }
+    auto p = dd_detail::two_prod(q1, b);
+    auto s = dd_detail::two_sum(a.hi, -p.hi);
+    double q2 = (s.hi + (s.lo - p.lo + a.lo)) / b;
+    return dd_detail::quick_two_sum(q1, q2);
+}
+
+inline dd_real operator/(const dd_real &a, const dd_real &b) {
+    // long division, one double-sized digit at a time
+    double q1 = a.hi / b.hi;
+    if (!std::isfinite(q1) || !std::isfinite(b.hi)) {
+        return q1;
+    }
+    auto r = a - b * q1;
+    double q2 = r.hi / b.hi;
+    r = r - b * q2;
+    double q3 = r.hi / b.hi;
+    return dd_detail::quick_two_sum(q1, q2) + q3;
+}
+
+inline dd_real &operator+=(dd_real &a, const dd_real &b) {
+    return a = a + b;
+}
+
+inline dd_real &operator-=(dd_real &a, const dd_real &b) {
+    return a = a - b;
+}
+
+inline dd_real &operator*=(dd_real &a, const dd_real &b) {
+    return a = a * b;
+}
+
+inline dd_real &operator/=(dd_real &a, const dd_real &b) {
+    return a = a / b;
+}
+
+inline bool operator==(const dd_real &a, const dd_real &b) {
+    return a.hi == b.hi && a.lo == b.lo;
+}
+
+inline bool operator!=(const dd_real &a, const dd_real &b) {
+    return !(a == b);
+}
+
+inline bool operator<(const dd_real &a, const dd_real &b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+inline bool operator>(const dd_real &a, const dd_real &b) {
+    return b < a;
+}
+
+inline bool operator<=(const dd_real &a, const dd_real &b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo <= b.lo);
+}
+
+inline bool operator>=(const dd_real &a, const dd_real &b) {
+    return b <= a;
+}
+
+/**
+ * A complex number with double-double parts. Converts to std::complex<double> explicitly, by rounding each part.
+ */
+struct dd_complex {
+    dd_real re;
+    dd_real im;
+
+    constexpr dd_complex() = default;
+
+    constexpr dd_complex(dd_real _re, dd_real _im = 0.): re(_re), im(_im) { } // NOLINT(google-explicit-constructor)
+
+    constexpr dd_complex(double _re, double _im = 0.): re(_re), im(_im) { } // NOLINT(google-explicit-constructor)
+
+    constexpr dd_complex(std::complex<double> z): re(z.real()), im(z.imag()) { } // NOLINT(google-explicit-constructor)
+
+    explicit operator std::complex<double>() const {
+        return { static_cast<double>(re), static_cast<double>(im) };
+    }
+
+    dd_real real() const {
+        return re;
+    }
+
+    dd_real imag() const {
+        return im;
+    }
+};
+
+inline dd_complex operator-(const dd_complex &a) {
+    return { -a.re, -a.im };
+}
+
+inline dd_complex operator+(const dd_complex &a, const dd_complex &b) {
+    return { a.re + b.re, a.im + b.im };
+}
+
+inline dd_complex operator-(const dd_complex &a, const dd_complex &b) {
+    return { a.re - b.re, a.im - b.im };
+}
+
+inline dd_complex operator*(const dd_complex &a, const dd_complex &b) {
+    return { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+}
+
+inline dd_complex operator/(const dd_complex &a, const dd_complex &b) {
+    // scale b by a power of two near its magnitude, which is exact, so its squared norm can't overflow
+    int e;
+    std::frexp(std::max(std::abs(b.re.hi), std::abs(b.im.hi)), &e);
+    const dd_real re(std::ldexp(b.re.hi, -e), std::ldexp(b.re.lo, -e));
+    const dd_real im(std::ldexp(b.im.hi, -e), std::ldexp(b.im.lo, -e));
+    const dd_real norm = re * re + im * im;
+    const dd_real x = (a.re * re + a.im * im) / norm;
+    const dd_real y = (a.im * re - a.re * im) / norm;
+    return { dd_real(std::ldexp(x.hi, -e), std::ldexp(x.lo, -e)), dd_real(std::ldexp(y.hi, -e), std::ldexp(y.lo, -e)) };
+}
+
+inline dd_complex &operator+=(dd_complex &a, const dd_complex &b) {
+    return a = a + b;
+}
+
+inline dd_complex &operator-=(dd_complex &a, const dd_complex &b) {
+    return a = a - b;
+}
+
+inline dd_complex &operator*=(dd_complex &a, const dd_complex &b) {
+    return a = a * b;
+}
+
+inline dd_complex &operator/=(dd_complex &a, const dd_complex &b) {
+    return a = a / b;
+}
+
+inline bool operator==(const dd_complex &a, const dd_complex &b) {
+    return a.re == b.re && a.im == b.im;
+}
+
+inline bool operator!=(const dd_complex &a, const dd_complex &b) {
+    return !(a == b);
+}
+
+/**
+ * The elementary functions in double-double precision. They take the same operands as the bytecode VM's opcodes, and
+ * are accurate to a few ulps of a double-double for arguments of moderate size; like libm's, the trigonometric
+ * functions lose accuracy for arguments so large that their period is below the precision.
+ */
+namespace dd_math {
+    constexpr dd_real pi(3.141592653589793116e+00, 1.224646799147353207e-16);
+    constexpr dd_real half_pi(1.570796326794896558e+00, 6.123233995736766036e-17);
+    constexpr dd_real e(2.718281828459045091e+00, 1.445646891729250158e-16);
+    constexpr dd_real ln2(6.931471805599452862e-01, 2.319046813846299558e-17);
+
+    // below this, a Taylor term no longer changes a double-double
+    constexpr double negligible = 1e-33;
+
+    inline dd_real ldexp(const dd_real &a, int n) {
+        return { std::ldexp(a.hi, n), std::ldexp(a.lo, n) };
+    }
+
+    inline dd_real abs(const dd_real &a) {
+        return a.hi < 0 ? -a : a;
+    }
+
+    inline dd_real sqrt(const dd_real &a) {
+        if (!(a.hi > 0)) {
+            return a.hi == 0 ? 0. : std::numeric_limits<double>::quiet_NaN();
+        } else if (!std::isfinite(a.hi)) {
+            return a.hi;
+        }
+        // one Newton step from the double result doubles its precision
+        double x = 1 / std::sqrt(a.hi);
+        double ax = a.hi * x;
+        return dd_detail::two_sum(ax, (a - dd_detail::two_prod(ax, ax)).hi * (x * 0.5));
+    }
+
+    inline dd_real powi(const dd_real &a, unsigned n) {
+        dd_real power = 1.;
+        dd_real square = a;
+        for (; n != 0; n >>= 1) {
+            if (n & 1) {
+                power *= square;
+            }
+            square *= square;
+        }
+        return power;
+    }
+
+    inline dd_real exp(const dd_real &a) {
+        if (a.hi > 709.79) {
+            return std::numeric_limits<double>::infinity();
+        } else if (a.hi < -745.2) {
+            return 0.;
+        } else if (std::isnan(a.hi)) {
+            return a.hi;
+        }
+        // exp(a) = 2^m exp(r)^512 with |r| <= ln 2 / 1024, and exp(r) - 1 is summed as a Taylor series, then squared by
+        // way of (1 + s)^2 - 1 = s (2 + s), which keeps its small low bits
+        const double m = std::nearbyint(a.hi / ln2.hi);
+        const dd_real r = ldexp(a - ln2 * m, -9);
+        dd_real s = r;
+        dd_real term = r;
+        for (int n = 2; n < 12 && std::abs(term.hi) > negligible * std::abs(s.hi); n++) {
+            term = term * r / n;
+            s += term;
+        }
+        for (int i = 0; i < 9; i++) {
+            s = s * (s + 2.);
+        }
+        return ldexp(s + 1., static_cast<int>(m));
+    }
+
+    inline dd_real log(const dd_real &a) {
+        if (!(a.hi > 0)) {
+            return a.hi == 0 ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+        } else if (!std::isfinite(a.hi)) {
+            return a.hi;
+        }
+        // one Newton step for exp(x) = a, from the double result
+        const dd_real x = std::log(a.hi);
+        return x + a * exp(-x) - 1.;
+    }
+
+    inline void sinh_cosh(const dd_real &a, dd_real &sinh, dd_real &cosh) {
+        if (std::abs(a.hi) > 0.05) {
+            const dd_real ea = exp(a);
+            const dd_real inverse = 1. / ea;
+            sinh = ldexp(ea - inverse, -1);
+            cosh = ldexp(ea + inverse, -1);
+            return;
+        }
+        // the difference above would cancel, so sinh is summed directly
+        const dd_real square = a * a;
+        dd_real term = a;
+        sinh = a;
+        for (int n = 3; n < 24 && std::abs(term.hi) > negligible * std::abs(sinh.hi); n += 2) {
+            term = term * square / static_cast<double>((n - 1) * n);
+            sinh += term;
+        }
+        cosh = sqrt(sinh * sinh + 1.);
+    }
+
+    inline void sin_cos(const dd_real &a, dd_real &sin, dd_real &cos) {
+        if (!std::isfinite(a.hi)) {
+            sin = cos = std::numeric_limits<double>::quiet_NaN();
+            return;
+        }
+        // reduce to |r| <= pi/4, in quadrant k mod 4
+        const double k = std::nearbyint(a.hi / half_pi.hi);
+        const dd_real r = a - half_pi * k;
+        const dd_real square = r * r;
+        dd_real term = r;
+        dd_real s = r;
+        for (int n = 3; n < 32 && std::abs(term.hi) > negligible * std::abs(s.hi); n += 2) {
+            term = -term * square / static_cast<double>((n - 1) * n);
+            s += term;
+        }
+        // cos(r) >= 1/sqrt(2), so this doesn't cancel
+        const dd_real c = sqrt(1. - s * s);
+        switch ((static_cast<int>(std::fmod(k, 4.)) + 4) % 4) {
+            case 0:
+                sin = s;
+                cos = c;
+                break;
+            case 1:
+                sin = c;
+                cos = -s;
+                break;
+            case 2:
+                sin = -s;
+                cos = -c;
+                break;
+            default:
+                sin = -c;
+                cos = s;
+        }
+    }
+
+    inline dd_real atan2(const dd_real &y, const dd_real &x) {
+        const double guess = std::atan2(y.hi, x.hi);
+        if (!std::isfinite(x.hi) || !std::isfinite(y.hi) || (x.hi == 0 && y.hi == 0)) {
+            return guess;
+        }
+        // one Newton step on the point of the unit circle at angle z, from the double result
+        int e;
+        std::frexp(std::max(std::abs(x.hi), std::abs(y.hi)), &e);
+        const dd_real xs = ldexp(x, -e);
+        const dd_real ys = ldexp(y, -e);
+        const dd_real r = sqrt(xs * xs + ys * ys);
+        dd_real z = guess;
+        dd_real sin, cos;
+        sin_cos(z, sin, cos);
+        if (std::abs(xs.hi) > std::abs(ys.hi)) {
+            z += (ys / r - sin) / cos;
+        } else {
+            z -= (xs / r - cos) / sin;
+        }
+        return z;
+    }
+
+    inline dd_real abs(const dd_complex &z) {
+        if (!std::isfinite(z.re.hi) || !std::isfinite(z.im.hi)) {
+            return std::hypot(z.re.hi, z.im.hi);
+        }
+        int e;
+        std::frexp(std::max(std::abs(z.re.hi), std::abs(z.im.hi)), &e);
+        const dd_real x = ldexp(z.re, -e);
+        const dd_real y = ldexp(z.im, -e);
+        return ldexp(sqrt(x * x + y * y), e);
+    }
+
+    inline dd_complex exp(const dd_complex &z) {
+        const dd_real magnitude = exp(z.re);
+        if (z.im.hi == 0) {
+            return magnitude;
+        }
+        dd_real sin, cos;
+        sin_cos(z.im, sin, cos);
+        return { magnitude * cos, magnitude * sin };
+    }
+
+    inline dd_complex log(const dd_complex &z) {
+        return { log(abs(z)), atan2(z.im, z.re) };
+    }
+
+    inline dd_complex sin(const dd_complex &z) {
+        dd_real sin, cos, sinh, cosh;
+        sin_cos(z.re, sin, cos);
+        sinh_cosh(z.im, sinh, cosh);
+        return { sin * cosh, cos * sinh };
+    }
+
+    inline dd_complex cos(const dd_complex &z) {
+        dd_real sin, cos, sinh, cosh;
+        sin_cos(z.re, sin, cos);
+        sinh_cosh(z.im, sinh, cosh);
+        return { cos * cosh, -(sin * sinh) };
+    }
+
+    inline dd_complex tan(const dd_complex &z) {
+        // tan(x + iy) = (sin 2x + i sinh 2y) / (cos 2x + cosh 2y), which doesn't overflow as early as sin / cos
+        dd_real sin, cos, sinh, cosh;
+        sin_cos(ldexp(z.re, 1), sin, cos);
+        sinh_cosh(ldexp(z.im, 1), sinh, cosh);
+        const dd_real denominator = cos + cosh;
+        if (std::abs(z.im.hi) > 40) {
+            // sinh 2y / cosh 2y is +-1 to well within an ulp, but both can overflow
+            return { sin / denominator, std::copysign(1., z.im.hi) };
+        }
+        return { sin / denominator, sinh / denominator };
+    }
+
+    inline dd_complex sinh(const dd_complex &z) {
+        dd_real sin, cos, sinh, cosh;
+        sin_cos(z.im, sin, cos);
+        sinh_cosh(z.re, sinh, cosh);
+        return { sinh * cos, cosh * sin };
+    }
+
+    inline dd_complex cosh(const dd_complex &z) {
+        dd_real sin, cos, sinh, cosh;
+        sin_cos(z.im, sin, cos);
+        sinh_cosh(z.re, sinh, cosh);
+        return { cosh * cos, sinh * sin };
+    }
+
+    inline dd_complex tanh(const dd_complex &z) {
+        // tanh(z) = -i tan(iz)
+        const dd_complex t = tan(dd_complex(-z.im, z.re));
+        return { t.im, -t.re };
+    }
+
+    /**
+     * a^b = e^(b log a), with 0^b = 0 for every b (0^0 included), like inline_math::cpow.
+     */
+    inline dd_complex pow(const dd_complex &a, const dd_complex &b) {
+        if (a == dd_complex()) {
+            return 0.;
+        } else if (b == dd_complex()) {
+            return 1.;
+        }
+        return exp(b * log(a));
+    }
+
+    /**
+     * Left-to-right binary exponentiation, like the VM does in double precision.
+     * @param n at least 1
+     */
+    inline dd_complex powi(const dd_complex &a, unsigned n) {
+        int bit = 0;
+        while ((n >> (bit + 1)) != 0) {
+            bit++;
+        }
+        dd_complex power = a;
+        while (bit-- > 0) {
+            power = power * power;
+            if ((n >> bit) & 1) {
+                power = power * a;
+            }
+        }
+        return power;
+    }
+}
+
+inline dd_real dd_real::parse(const std::string &s) {
+    const auto nan = std::numeric_limits<double>::quiet_NaN();
+    size_t i = 0;
+    bool negative = false;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+')) {
+        negative = s[i++] == '-';
+    }
+    // accumulate the digits as an integer, which is exact up to 2^106, and remember where the point was
+    dd_real mantissa = 0.;
+    int exponent = 0;
+    bool digits = false;
+    bool point = false;
+    for (; i < s.size(); i++) {
+        if (s[i] >= '0' && s[i] <= '9') {
+            mantissa = mantissa * 10. + static_cast<double>(s[i] - '0');
+            exponent -= point;
+            digits = true;
+        } else if (s[i] == '.' && !point) {
+            point = true;
+        } else {
+            break;
+        }
+    }
+    if (!digits) {
+        return nan;
+    }
+    if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        i++;
+        bool negative_exponent = false;
+        if (i < s.size() && (s[i] == '-' || s[i] == '+')) {
+            negative_exponent = s[i++] == '-';
+        }
+        if (i == s.size()) {
+            return nan;
+        }
+        int written = 0;
+        for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; i++) {
+            written = std::min(written * 10 + (s[i] - '0'), 100000); // anything past that is 0 or inf anyway
+        }
+        exponent += negative_exponent ? -written : written;
+    }
+    if (i != s.size()) {
+        return nan;
+    }
+    const dd_real scale = dd_math::powi(dd_real(10.), std::abs(exponent));
+    const dd_real result = exponent < 0 ? mantissa / scale : mantissa * scale;
+    return negative ? -result : result;
+}
+
+#endif //GLAMCORE_DD_COMPLEX_H
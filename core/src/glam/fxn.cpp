@@ -16,41 +16,349 @@
 
 #include "fxn.h"
 #include "jit/globals.h"
+#include "jit/compile_cache.h"
 #include <emscripten.h>
 #include <binaryen-c.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
 
-template <typename T> void compiled_fxn<T>::install(module_ptr mod, size_t mod_len) {
-    // @formatter:off
-    auto handle_ptr = EM_ASM_INT({
-         const binary = new Uint8Array(wasmMemory.buffer, $0, $1);
-         const module = new WebAssembly.Module(binary);
-         const instance = new WebAssembly.Instance(module, { env: {
-             memory: wasmMemory,
-             table: wasmTable,
-             _arena: $2,
-             _operator_nop1: ((a, b) => 0),
-             _operator_nop2: ((a, b, c) => 0),
-             _operator_nop4: ((a, b, c, d, e) => 0)
-         }});
-         const jitFunction = instance.exports[UTF8ToString($3)];
-         return addFunction(jitFunction, UTF8ToString($4))
-    }, mod, mod_len, this->arena, this->name.c_str(), functor_type<T>::emscripten_type);
-    // @formatter:on
+// the part of an asynchronous install that JS can hand back without knowing the fxn's type
+struct install_job_base {
+    void (*run)(void *job, bool instantiated);
+};
 
+namespace {
+    template <typename T> struct tier_up_job {
+        compiled_fxn<T> fxn;
+        std::vector<char> binary;
+        uint32_t features;
+        uint32_t optimize_level;
+        uint32_t cache_id;
+    };
+
+    // keyed by table slot. release() removes the entry, which is how a job finds out it was cancelled.
+    std::map<uintptr_t, void *> pending_tier_ups;
+
+    template <typename T> struct install_job: install_job_base {
+        compiled_fxn<T> fxn;
+        std::vector<char> binary;
+        uint32_t module_id;
+        uint32_t features;
+        uint32_t optimize_level;
+        uint32_t cache_id;
+        typename compiled_fxn<T>::install_callback done;
+    };
+
+    // the latest asynchronous install of each fxn name. an install that finishes after a later one was started is dropped.
+    std::map<std::string, const install_job_base *> pending_installs;
+
+    // the table slots a fxn name was last installed into, the arena of the instance installed there, and the signature
+    // of its entry point. recompiling a fxn with the same signature reuses its slots, so whatever calls it through the
+    // table picks up the new code, and only that instance gives them back to the table when it's released.
+    struct installed_slots {
+        uintptr_t slots[4];
+        const void *owner;
+        bool multi_value;
+        bool mp;
+    };
+    std::map<std::string, installed_slots> installed;
+
+    // slots that were left to their instance when its fxn was recompiled with another signature, by the instance's arena.
+    // they still hold its code, for the fxns compiled against them, until it's released.
+    std::map<const void *, installed_slots> retired;
+
+    const uint32_t throughput_samples = 4096;
+
+    double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+// instantiates the jit module Module.jitModules[id] against the core module, and keeps the instance under `key` until its
+// exports are put in the table. a module that is still being compiled in the background is compiled again from `binary`,
+// since this can't wait for it.
+// @formatter:off
+EM_JS(void, jit_instantiate, (uint32_t id, void *arena, const char *binary, size_t len, const void *key), {
+    let module = Module.jitModules.get(id);
+    if (module instanceof Promise) {
+        module = new WebAssembly.Module(new Uint8Array(wasmMemory.buffer, binary, len));
+        Module.jitModules.set(id, module);
+    }
+    Module.jitInstances = Module.jitInstances || new Map();
+    Module.jitInstances.set(key, new WebAssembly.Instance(module, { env: {
+        memory: wasmMemory,
+        table: wasmTable,
+        _arena: arena,
+        _operator_nop1: ((a, b) => 0),
+        _operator_nop2: ((a, b, c) => 0),
+        _operator_nop4: ((a, b, c, d, e) => 0)
+    }}));
+});
+
+// the same without blocking, waiting for the module if it's still being compiled. calls glam_jit_instantiated when done.
+EM_JS(void, jit_instantiate_async, (uint32_t id, void *arena, const void *key), {
+    Promise.resolve(Module.jitModules.get(id)).then(module => WebAssembly.instantiate(module, { env: {
+        memory: wasmMemory,
+        table: wasmTable,
+        _arena: arena,
+        _operator_nop1: ((a, b) => 0),
+        _operator_nop2: ((a, b, c) => 0),
+        _operator_nop4: ((a, b, c, d, e) => 0)
+    }})).then(instance => {
+        Module.jitInstances = Module.jitInstances || new Map();
+        Module.jitInstances.set(key, instance);
+        _glam_jit_instantiated(key, 1);
+    }, error => {
+        console.error(error);
+        _glam_jit_instantiated(key, 0);
+    });
+});
+
+// puts the exports of the instance under `key` in the table. slots holds the table slots of the entry point, _batch,
+// _store and _dual: zero slots are filled in with newly added functions, and the rest are replaced in place. a slot the
+// module has no export for is given back, so it can't keep a previous instance (and its arena) reachable.
+EM_JS(void, jit_set_exports, (const void *key, const char *type, const char *store_type, uintptr_t *slots), {
+    const instance = Module.jitInstances.get(key);
+    Module.jitInstances.delete(key);
+    // a multi-value signature can't be written as a string, but addFunction only uses it to wrap JS functions
+    const exports = [instance.exports._entry, instance.exports._batch, instance.exports._store, instance.exports._dual];
+    const types = [UTF8ToString(type), "viii", UTF8ToString(store_type), "viii"];
+    for (let i = 0; i < exports.length; i++) {
+        const slot = HEAPU32[(slots >> 2) + i];
+        if (!exports[i]) {
+            if (slot) {
+                removeFunction(slot);
+                HEAPU32[(slots >> 2) + i] = 0;
+            }
+        } else if (slot) {
+            wasmTable.set(slot, exports[i]);
+        } else {
+            HEAPU32[(slots >> 2) + i] = addFunction(exports[i], types[i]);
+        }
+    }
+});
+
+EM_JS(void, jit_drop_instance, (const void *key), {
+    Module.jitInstances.delete(key);
+});
+
+// whether the instance under `key` is multi-value, which is when it has a _store export (see finish_install)
+EM_JS(int, jit_has_store, (const void *key), {
+    return Module.jitInstances.get(key).exports._store ? 1 : 0;
+});
+
+// gives table slots back, so addFunction can hand them out again
+EM_JS(void, jit_release_slots, (const uintptr_t *slots), {
+    for (let i = 0; i < 4; i++) {
+        const slot = HEAPU32[(slots >> 2) + i];
+        if (slot) {
+            removeFunction(slot);
+        }
+    }
+});
+// @formatter:on
+
+extern "C" EMSCRIPTEN_KEEPALIVE void glam_jit_instantiated(install_job_base *job, int instantiated) {
+    job->run(job, instantiated != 0);
+}
+
+template <typename T> void compiled_fxn<T>::claim_slots(uintptr_t *slots, bool multi_value) {
+    std::fill(slots, slots + 4, 0);
+    auto previous = installed.find(this->fxn_name);
+    if (previous == installed.end()) {
+        return;
+    }
+    if (previous->second.multi_value == multi_value && previous->second.mp == std::is_same<T, mp_complex>()) {
+        // swap the new code into the old slots. the previous instance's tier-up would overwrite it, so it's cancelled.
+        std::copy(previous->second.slots, previous->second.slots + 4, slots);
+        pending_tier_ups.erase(slots[0]);
+        return;
+    }
+    // callers were compiled for the old signature, so they keep the old instance until they're compiled again
+    GLAM_TRACE(this->name << " changed signature, so it gets new slots");
+    retired[previous->second.owner] = previous->second;
+    installed.erase(previous);
+    for (const auto &dependent : globals::dependents(this->fxn_name)) {
+        globals::outdated.insert(dependent);
+    }
+}
+
+template <typename T> void compiled_fxn<T>::install(uint32_t module_id, module_ptr mod, size_t mod_len) {
+    pending_installs.erase(this->fxn_name); // an older asynchronous install mustn't overwrite this one when it's done
+    uintptr_t slots[4];
+    jit_instantiate(module_id, this->arena, static_cast<char *>(mod), mod_len, slots);
+    claim_slots(slots, jit_has_store(slots));
+    jit_set_exports(slots, functor_type<T>::emscripten_type, functor_type<T>::emscripten_store_type, slots);
+    finish_install(slots, mod, mod_len);
+}
+
+template <typename T> void compiled_fxn<T>::install_async(uint32_t module_id, module_ptr mod, size_t mod_len, uint32_t features,
+                                                          uint32_t optimize_level, uint32_t cache_id, install_callback done) {
+    auto job = new install_job<T> { { &compiled_fxn<T>::run_install }, *this,
+            std::vector<char>(static_cast<char *>(mod), static_cast<char *>(mod) + mod_len), module_id, features, optimize_level,
+            cache_id, std::move(done) };
+    pending_installs[this->fxn_name] = job;
+    jit_instantiate_async(module_id, this->arena, static_cast<install_job_base *>(job));
+}
+
+template <typename T> void compiled_fxn<T>::run_install(void *arg, bool instantiated) {
+    auto job = static_cast<install_job<T> *>(static_cast<install_job_base *>(arg));
+    auto &fxn = job->fxn;
+    auto latest = pending_installs.find(fxn.fxn_name);
+    const bool current = latest != pending_installs.end() && latest->second == job;
+    if (current) {
+        pending_installs.erase(latest);
+    }
+    if (instantiated && current) {
+        uintptr_t slots[4];
+        fxn.claim_slots(slots, jit_has_store(arg));
+        jit_set_exports(arg, functor_type<T>::emscripten_type, functor_type<T>::emscripten_store_type, slots);
+        fxn.finish_install(slots, job->binary.data(), job->binary.size());
+        if (job->optimize_level) {
+            fxn.schedule_tier_up(job->binary.data(), job->binary.size(), job->features, job->optimize_level, job->cache_id);
+        }
+    } else {
+        if (instantiated) {
+            jit_drop_instance(arg);
+        }
+        GLAM_TRACE("install of " << fxn.name << (instantiated ? " was superseded" : " failed"));
+    }
+    if (!job->cache_id) {
+        compile_cache::forget(job->module_id);
+    }
+    job->done(fxn);
+    delete job;
+}
+
+template <typename T> void compiled_fxn<T>::finish_install(const uintptr_t *slots, module_ptr mod, size_t mod_len) {
+    uintptr_t handle_ptr = slots[0], batch_ptr = slots[1], store_ptr = slots[2], dual_ptr = slots[3];
     this->handle = reinterpret_cast<functor *>(handle_ptr);
+    this->batch_handle = reinterpret_cast<batch_functor *>(batch_ptr);
+    this->store_handle = reinterpret_cast<store_functor *>(store_ptr);
+    this->dual_handle = reinterpret_cast<batch_functor *>(dual_ptr);
     GLAM_TRACE("installed " << this->name << " at " << this->handle << " = " << handle_ptr);
     globals::fxn_table[this->fxn_name] = handle_ptr;
-    auto readModule = BinaryenModuleRead(static_cast<char *>(mod), mod_len);
-    auto text = BinaryenModuleAllocateAndWriteText(readModule);
-    this->disassembly = text;
-    free(text);
-    BinaryenModuleDispose(readModule);
-    GLAM_TRACE("disassembled module");
+    auto &record = installed[this->fxn_name];
+    std::copy(slots, slots + 4, record.slots);
+    record.owner = this->arena;
+    record.multi_value = store_ptr != 0;
+    record.mp = std::is_same<T, mp_complex>();
+    globals::outdated.erase(this->fxn_name);
+    if (store_ptr) {
+        globals::multi_value_fxns.insert(this->fxn_name);
+    } else {
+        globals::multi_value_fxns.erase(this->fxn_name);
+    }
+    if constexpr (std::is_same<T, mp_complex>()) {
+        globals::mp_fxns.insert(this->fxn_name);
+    } else {
+        globals::mp_fxns.erase(this->fxn_name);
+    }
+#ifndef GLAM_NO_DISASSEMBLY
+    auto binary = std::make_shared<const std::vector<char>>(static_cast<char *>(mod), static_cast<char *>(mod) + mod_len);
+    this->disassembler = [binary, name = this->name]() {
+        auto readModule = BinaryenModuleRead(const_cast<char *>(binary->data()), binary->size());
+        auto text = BinaryenModuleAllocateAndWriteText(readModule);
+        std::string disassembly = text;
+        free(text);
+        BinaryenModuleDispose(readModule);
+        GLAM_TRACE("disassembled " << name);
+        return disassembly;
+    };
+#endif
+}
+
+template <typename T> void compiled_fxn<T>::schedule_tier_up(module_ptr mod, size_t mod_len, uint32_t features, uint32_t optimize_level,
+                                                             uint32_t cache_id) {
+    auto job = new tier_up_job<T> { *this, std::vector<char>(static_cast<char *>(mod), static_cast<char *>(mod) + mod_len), features,
+            optimize_level, cache_id };
+    pending_tier_ups[reinterpret_cast<uintptr_t>(this->handle)] = job;
+    emscripten_async_call(&compiled_fxn<T>::run_tier_up, job, 0);
+}
+
+template <typename T> void compiled_fxn<T>::run_tier_up(void *arg) {
+    auto job = static_cast<tier_up_job<T> *>(arg);
+    auto &fxn = job->fxn;
+    auto pending = pending_tier_ups.find(reinterpret_cast<uintptr_t>(fxn.handle));
+    if (pending == pending_tier_ups.end() || pending->second != job) {
+        GLAM_TRACE("tier-up of " << fxn.name << " cancelled");
+        delete job;
+        return;
+    }
+    pending_tier_ups.erase(pending);
+
+    tier_stats &stats = globals::tiers[fxn.fxn_name];
+    std::vector<T> in, out;
+    auto measure = [&]() {
+        // the first run warms up the engine's own tiers
+        fxn.batch_handle(in.data(), out.data(), throughput_samples);
+        auto bench = std::chrono::steady_clock::now();
+        fxn.batch_handle(in.data(), out.data(), throughput_samples);
+        fxn.arena->reset();
+        return throughput_samples / (elapsed_ms(bench) / 1000.);
+    };
+    if constexpr (std::is_same<T, std::complex<double>>()) {
+        // the baseline has to be measured before it's swapped out, so this can't be left until the stats are asked for
+        if (globals::measure_tiers && fxn.batch_handle) {
+            in.resize(throughput_samples);
+            out.resize(throughput_samples);
+            for (uint32_t i = 0; i < throughput_samples; i++) {
+                in[i] = std::polar(4. * i / throughput_samples, static_cast<double>(i));
+            }
+            stats.baseline_evals_per_sec = measure();
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t module_id = job->cache_id;
+    auto entry = compile_cache::find(job->cache_id);
+    if (!entry || !entry->optimized) {
+        // the baseline was written from stack IR, so read it back to get binaryen IR the optimizer can work on. -O1
+        // and up coalesce locals (which removes most of the dups and temporaries) and precompute, and -O2 and up also
+        // inline the kernel into _batch and _store.
+        auto module = BinaryenModuleReadWithFeatures(job->binary.data(), job->binary.size(), BinaryenFeatureAll());
+        BinaryenModuleSetFeatures(module, job->features);
+        BinaryenSetOptimizeLevel(static_cast<int>(job->optimize_level));
+        BinaryenSetShrinkLevel(0);
+        BinaryenModuleOptimize(module);
+        auto result = BinaryenModuleAllocateAndWrite(module, nullptr);
+        BinaryenModuleDispose(module);
+        if (entry) {
+            compile_cache::update(job->cache_id, static_cast<char *>(result.binary), result.binaryBytes);
+        } else {
+            module_id = compile_cache::compile_uncached(static_cast<char *>(result.binary), result.binaryBytes);
+        }
+        free(result.binary);
+    } // otherwise another fxn with the same definition got there first, so its module can be reused as is
+
+    // same slots, so nothing that points at this fxn has to change
+    uintptr_t slots[4] = { reinterpret_cast<uintptr_t>(fxn.handle), reinterpret_cast<uintptr_t>(fxn.batch_handle),
+            reinterpret_cast<uintptr_t>(fxn.store_handle), reinterpret_cast<uintptr_t>(fxn.dual_handle) };
+    auto tiered = compile_cache::find(module_id);
+    jit_instantiate(module_id, fxn.arena, tiered ? tiered->binary.data() : nullptr, tiered ? tiered->binary.size() : 0, slots);
+    jit_set_exports(slots, functor_type<T>::emscripten_type, functor_type<T>::emscripten_store_type, slots);
+    stats.optimized_compile_ms = elapsed_ms(start);
+    if (module_id != job->cache_id) {
+        compile_cache::forget(module_id);
+    }
+
+    if (!in.empty()) {
+        stats.optimized_evals_per_sec = measure();
+    }
+    GLAM_TRACE("tiered up " << fxn.name << " in " << stats.optimized_compile_ms << "ms, " << stats.baseline_evals_per_sec
+                            << " -> " << stats.optimized_evals_per_sec << " evals/s");
+    delete job;
 }
 
 template <typename T> T compiled_fxn<T>::operator()(T z) {
     T result;
     if constexpr (std::is_same<T, std::complex<double>>()) { // todo this is kind of ugly
+        if (this->store_handle) {
+            // the result goes straight into `result`, no arena involved
+            this->store_handle(z.real(), z.imag(), &result);
+            return result;
+        }
         result = *this->handle(z.real(), z.imag());
     } else {
         result = *this->handle(&z);
@@ -59,22 +367,67 @@ template <typename T> T compiled_fxn<T>::operator()(T z) {
     return result;
 }
 
+template <typename T> void compiled_fxn<T>::eval_batch(const T *in, T *out, uint32_t count) {
+    if (this->batch_handle) {
+        // the kernel copies each result out of the arena before the next evaluation, and the arena wraps around
+        // on its own, so there is nothing to reset in between
+        this->batch_handle(in, out, count);
+        this->arena->reset();
+    } else {
+        std::transform(in, in + count, out, [this](const T &z) { return (*this)(z); });
+    }
+}
+
 template <typename T> bool compiled_fxn<T>::ready() {
     return this->handle != nullptr;
 }
 
 template <typename T> void compiled_fxn<T>::release() {
     GLAM_TRACE("releasing compiled fxn " << this->name);
+    auto record = installed.find(this->fxn_name);
+    if (record != installed.end() && record->second.owner == this->arena) {
+        // otherwise the fxn was recompiled since, and the slots belong to the new instance
+        pending_tier_ups.erase(reinterpret_cast<uintptr_t>(this->handle));
+        jit_release_slots(record->second.slots);
+        installed.erase(record);
+        globals::fxn_table.erase(this->fxn_name);
+        globals::multi_value_fxns.erase(this->fxn_name);
+        globals::mp_fxns.erase(this->fxn_name);
+        globals::outdated.erase(this->fxn_name);
+        globals::forget(this->fxn_name);
+    } else {
+        auto old = retired.find(this->arena);
+        if (old != retired.end()) {
+            pending_tier_ups.erase(reinterpret_cast<uintptr_t>(this->handle));
+            jit_release_slots(old->second.slots);
+            retired.erase(old);
+        }
+    }
     this->arena->release();
     delete this->arena;
 }
 
-template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::install(module_ptr mod, size_t mod_len);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::install(uint32_t module_id, module_ptr mod, size_t mod_len);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::install_async(uint32_t module_id, module_ptr mod, size_t mod_len,
+                                                                           uint32_t features, uint32_t optimize_level,
+                                                                           uint32_t cache_id, install_callback done);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::schedule_tier_up(module_ptr mod, size_t mod_len, uint32_t features,
+                                                                              uint32_t optimize_level, uint32_t cache_id);
 template EMSCRIPTEN_KEEPALIVE bool compiled_fxn<mp_complex>::ready();
 template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::release();
 template EMSCRIPTEN_KEEPALIVE mp_complex compiled_fxn<mp_complex>::operator()(mp_complex);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<mp_complex>::eval_batch(const mp_complex *in, mp_complex *out, uint32_t count);
 
-template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::install(module_ptr mod, size_t mod_len);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::install(uint32_t module_id, module_ptr mod, size_t mod_len);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::install_async(uint32_t module_id, module_ptr mod,
+                                                                                     size_t mod_len, uint32_t features,
+                                                                                     uint32_t optimize_level, uint32_t cache_id,
+                                                                                     install_callback done);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::schedule_tier_up(module_ptr mod, size_t mod_len,
+                                                                                        uint32_t features, uint32_t optimize_level,
+                                                                                        uint32_t cache_id);
 template EMSCRIPTEN_KEEPALIVE bool compiled_fxn<std::complex<double>>::ready();
 template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::release();
 template EMSCRIPTEN_KEEPALIVE std::complex<double> compiled_fxn<std::complex<double>>::operator()(std::complex<double>);
+template EMSCRIPTEN_KEEPALIVE void compiled_fxn<std::complex<double>>::eval_batch(const std::complex<double> *in,
+                                                                                   std::complex<double> *out, uint32_t count);
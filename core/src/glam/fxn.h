@@ -17,24 +17,46 @@
 #ifndef GLAMCORE_FXN_H
 #define GLAMCORE_FXN_H
 
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include "mem/fixed_arena.h"
 #include "types.h"
 #include "utilities.h"
+#include "vm/complex_ball.h"
+
+struct vm_program;
 
 template <typename T> struct functor_type {
     using type = T(T);
+    using batch_type = void(const T *, T *, uint32_t);
+    using store_type = void(T, T *);
     constexpr static const char *emscripten_type = "ii";
+    constexpr static const char *emscripten_store_type = "vii";
 };
 template <> struct functor_type<std::complex<double>> {
     using type = std::complex<double> *(double, double);
+    using batch_type = void(const std::complex<double> *, std::complex<double> *, uint32_t);
+    using store_type = void(double, double, std::complex<double> *);
     constexpr static const char *emscripten_type = "idd";
+    constexpr static const char *emscripten_store_type = "vddi";
+};
+
+template <> struct functor_type<dd_complex> {
+    using type = dd_complex *(dd_complex *);
+    using batch_type = void(const dd_complex *, dd_complex *, uint32_t);
+    using store_type = void(dd_complex *, dd_complex *);
+    constexpr static const char *emscripten_type = "ii";
+    constexpr static const char *emscripten_store_type = "vii";
 };
 
 template <> struct functor_type<mp_complex> {
     using type = mp_complex *(mp_complex *);
+    using batch_type = void(const mp_complex *, mp_complex *, uint32_t);
+    using store_type = void(mp_complex *, mp_complex *);
     constexpr static const char *emscripten_type = "ii";
+    constexpr static const char *emscripten_store_type = "vii";
 };
 
 /**
@@ -45,13 +67,21 @@ template <> struct functor_type<mp_complex> {
 template <typename T, typename FxnType> class fxn {
 protected:
     using functor = typename functor_type<T>::type;
+    using batch_functor = typename functor_type<T>::batch_type;
+    using store_functor = typename functor_type<T>::store_type;
 
     functor *handle;
+    batch_functor *batch_handle = nullptr;
+    store_functor *store_handle = nullptr; // set if the fxn returns multiple values, in which case handle can't be called
+    batch_functor *dual_handle = nullptr; // set if the fxn was compiled with its derivative, see eval_dual
+
     fixed_arena<T> *arena;
+    std::shared_ptr<const vm_program> program; // set if the fxn runs on the bytecode VM, or can enclose()
     std::string name;
     std::string fxn_name;
     std::string parameter_name;
     std::string disassembly;
+    std::function<std::string()> disassembler; // renders `disassembly` the first time it's asked for, see get_disassembly
 public:
     fxn(const std::string &_name, const std::string &_fxn_name, const std::string _parameter_name)
             : name(_name), fxn_name(_fxn_name), parameter_name(_parameter_name) { }
@@ -60,6 +90,76 @@ public:
         return static_cast<FxnType *>(this)->operator()(z);
     }
 
+    /**
+     * Evaluates the fxn at `count` points, reading from `in` and writing to `out`.
+     */
+    inline void eval_batch(const T *in, T *out, uint32_t count) {
+        static_cast<FxnType *>(this)->eval_batch(in, out, count);
+    }
+
+    /**
+     * Evaluates the fxn and its derivative at `count` points, reading from `in` and writing f(in[i]) to out[2 * i] and
+     * f'(in[i]) to out[2 * i + 1]. Only available if has_derivative().
+     */
+    inline void eval_dual(const T *in, T *out, uint32_t count) {
+        dual_handle(in, out, count);
+        if (arena) {
+            arena->reset();
+        }
+    }
+
+    bool has_derivative() {
+        return dual_handle != nullptr;
+    }
+
+    /**
+     * @return a ball containing f(z) for every z in `region`, which can be used to skip regions where f is small, or
+     * certify that f has no zeros there (complex_ball::contains_zero). Only available if has_enclosure(); defined in
+     * vm/bytecode.h.
+     */
+    complex_ball enclose(const complex_ball &region);
+
+    /**
+     * @return an estimate of the rounding error of f(z), relative to |f(z)|, which is cheap enough to compute for every
+     * sample. Only available if has_enclosure(); defined in vm/bytecode.h.
+     */
+    double estimate_error(std::complex<double> z);
+
+    bool has_enclosure() {
+        return program != nullptr;
+    }
+
+    /**
+     * Gives the fxn a bytecode program of its definition to run enclose() with.
+     */
+    void set_program(std::shared_ptr<const vm_program> _program) {
+        program = std::move(_program);
+    }
+
+    /**
+     * Keeps the interned constants the fxn's code points to until it's released, see globals::intern_mp.
+     */
+    void hold_consts(std::vector<std::shared_ptr<const T>> consts) {
+        arena->consts = std::move(consts);
+    }
+
+    /**
+     * Makes a multiprecision fxn compute its results at `digits` of precision, see mp_precision. Its constants keep the
+     * precision it was compiled at.
+     */
+    void set_precision(uint32_t digits) {
+        if (arena) {
+            arena->set_precision(digits);
+        }
+    }
+
+    /**
+     * @return true if eval_batch runs as a single call into a compiled loop kernel
+     */
+    bool has_batch() {
+        return batch_handle != nullptr;
+    }
+
     inline bool ready() {
         return static_cast<FxnType *>(this)->ready();
     }
@@ -80,27 +180,84 @@ public:
         return parameter_name;
     }
 
+    /**
+     * Disassembling is only done on request, since it takes about as long as compiling. Builds configured without
+     * GLAM_DISASSEMBLY don't keep what it takes, and return a placeholder.
+     */
     std::string get_disassembly() {
+#ifdef GLAM_NO_DISASSEMBLY
+        return "; disassembly isn't available in this build";
+#else
+        if (disassembler) {
+            disassembly = disassembler();
+            disassembler = nullptr;
+        }
         return disassembly;
+#endif
     }
 };
 
 template <typename T> class compiled_fxn: public fxn<T, compiled_fxn<T>> {
     using module_ptr = void *;
     using functor = typename fxn<T, compiled_fxn<T>>::functor;
+    using batch_functor = typename fxn<T, compiled_fxn<T>>::batch_functor;
+    using store_functor = typename fxn<T, compiled_fxn<T>>::store_functor;
+
+    // takes over the table slots of the instance currently installed under this fxn's name, if there is one and its
+    // entry point has the same signature
+    void claim_slots(uintptr_t *slots, bool multi_value);
+
+    // publishes the slots the module's exports were written to
+    void finish_install(const uintptr_t *slots, module_ptr mod, size_t mod_len);
 public:
+    using install_callback = std::function<void(compiled_fxn<T>)>;
+
     compiled_fxn(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name, module_ptr _mod,
                  size_t _mod_len, uint32_t _arena_size): fxn<T, compiled_fxn<T>>(_name, _fxn_name, _parameter_name) {
         this->arena = new fixed_arena<T>(_arena_size);
     }
 
-    void install(module_ptr mod, size_t mod_len);
+    /**
+     * Instantiates a module that was compiled by compile_cache and adds its exports to the table.
+     * @param mod binary of the module, which is kept for the disassembly
+     */
+    void install(uint32_t module_id, module_ptr mod, size_t mod_len);
+
+    /**
+     * Like install, but instantiates the module with WebAssembly.instantiate, so neither that nor a module that is
+     * still being compiled (see compile_cache::insert) blocks the thread. Works the same in a worker.
+     * @param optimize_level if nonzero, schedule_tier_up is called once the fxn is installed
+     * @param cache_id compile_cache entry of the module, or 0 if it isn't cached, in which case it's forgotten afterwards
+     * @param done called with the fxn once it's ready(). if it never will be, because the module couldn't be
+     * instantiated or the fxn was installed again in the meantime, it's called anyway, and the fxn still has to be
+     * released.
+     */
+    void install_async(uint32_t module_id, module_ptr mod, size_t mod_len, uint32_t features, uint32_t optimize_level,
+                       uint32_t cache_id, install_callback done);
+
+    /**
+     * Optimizes a copy of the module this fxn was installed from once the current event loop task is done, and swaps
+     * it into the same table slots, so existing callers (including other fxns) pick it up without recompiling.
+     * @param features binaryen feature set the module was written with
+     * @param optimize_level binaryen -O level
+     * @param cache_id compile_cache entry of the module, which gets the optimized build too. 0 if it isn't cached.
+     */
+    void schedule_tier_up(module_ptr mod, size_t mod_len, uint32_t features, uint32_t optimize_level, uint32_t cache_id);
+
+private:
+    static void run_tier_up(void *job);
+
+    static void run_install(void *job, bool instantiated);
+
+public:
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "HidingNonVirtualFunction"
 
     T operator()(T z);
 
+    void eval_batch(const T *in, T *out, uint32_t count);
+
     bool ready();
 
     void release();
@@ -123,6 +280,10 @@ public:
 
     virtual T operator()(T z) = 0;
 
+    void eval_batch(const T *in, T *out, uint32_t count) {
+        std::transform(in, in + count, out, [this](const T &z) { return (*this)(z); });
+    }
+
     bool ready() {
         return true;
     }
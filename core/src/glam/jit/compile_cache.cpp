@@ -0,0 +1,137 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compile_cache.h"
+#include <algorithm>
+#include <emscripten.h>
+#include "../utilities.h"
+
+// @formatter:off
+// an asynchronous compile leaves a promise in Module.jitModules until it's done. WebAssembly.compile copies the bytes
+// before it returns, so they can be freed right away either way.
+EM_JS(void, jit_compile_module, (uint32_t id, const char *binary, size_t len, bool async), {
+    if (!Module.jitModules) {
+        Module.jitModules = new Map();
+    }
+    const bytes = new Uint8Array(wasmMemory.buffer, binary, len);
+    if (async) {
+        const pending = WebAssembly.compile(bytes).then(module => {
+            if (Module.jitModules.get(id) === pending) {
+                Module.jitModules.set(id, module);
+            }
+            return module;
+        });
+        Module.jitModules.set(id, pending);
+    } else {
+        Module.jitModules.set(id, new WebAssembly.Module(bytes));
+    }
+});
+
+EM_JS(void, jit_forget_module, (uint32_t id), {
+    Module.jitModules.delete(id);
+});
+// @formatter:on
+
+compile_cache::lru_list compile_cache::entries;
+std::unordered_map<std::string, compile_cache::lru_list::iterator> compile_cache::index;
+uint32_t compile_cache::capacity = 32;
+uint32_t compile_cache::next_id = 1;
+uint32_t compile_cache::hits = 0;
+uint32_t compile_cache::misses = 0;
+
+cache_entry *compile_cache::lookup(const std::string &key) {
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, iter->second);
+    return &iter->second->second;
+}
+
+cache_entry *compile_cache::insert(const std::string &key, const char *binary, size_t len, uint32_t arena_size, uint32_t features,
+                                   bool async) {
+    if (capacity == 0) {
+        return nullptr;
+    }
+    auto existing = index.find(key);
+    if (existing != index.end()) {
+        forget(existing->second->second.id);
+        entries.erase(existing->second);
+        index.erase(existing);
+    }
+    evict(capacity - 1);
+
+    uint32_t id = next_id++;
+    jit_compile_module(id, binary, len, async);
+    entries.emplace_front(key, cache_entry { id, std::vector<char>(binary, binary + len), arena_size, features, false, { } });
+    index[key] = entries.begin();
+    GLAM_TRACE("cached module " << id << " (" << entries.size() << "/" << capacity << ")");
+    return &entries.front().second;
+}
+
+void compile_cache::update(uint32_t id, const char *binary, size_t len) {
+    auto entry = find(id);
+    if (entry) {
+        jit_compile_module(id, binary, len, false);
+        entry->binary.assign(binary, binary + len);
+        entry->optimized = true;
+    }
+}
+
+cache_entry *compile_cache::find(uint32_t id) {
+    auto iter = std::find_if(entries.begin(), entries.end(), [id](const auto &e) { return e.second.id == id; });
+    return iter == entries.end() ? nullptr : &iter->second;
+}
+
+uint32_t compile_cache::compile_uncached(const char *binary, size_t len, bool async) {
+    uint32_t id = next_id++;
+    jit_compile_module(id, binary, len, async);
+    return id;
+}
+
+void compile_cache::forget(uint32_t id) {
+    jit_forget_module(id);
+}
+
+void compile_cache::evict(size_t target_size) {
+    while (entries.size() > target_size) {
+        GLAM_TRACE("evicting module " << entries.back().second.id);
+        forget(entries.back().second.id);
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+void compile_cache::set_capacity(uint32_t _capacity) {
+    capacity = _capacity;
+    evict(capacity);
+}
+
+void compile_cache::clear() {
+    evict(0);
+    hits = 0;
+    misses = 0;
+}
+
+uint32_t compile_cache::get_hits() {
+    return hits;
+}
+
+uint32_t compile_cache::get_misses() {
+    return misses;
+}
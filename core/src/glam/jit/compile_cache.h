@@ -0,0 +1,100 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_COMPILE_CACHE_H
+#define GLAMCORE_COMPILE_CACHE_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../types.h"
+
+/**
+ * A compiled jit module. The WebAssembly.Module itself lives on the JS side, in Module.jitModules under `id`, so a fxn
+ * can be installed from it without compiling anything.
+ */
+struct cache_entry {
+    uint32_t id;
+    std::vector<char> binary;
+    uint32_t arena_size;
+    uint32_t features;
+    bool optimized; // whether the module has already been through the optimized tier
+    std::vector<std::shared_ptr<const mp_complex>> literals; // interned constants the module points to, see globals::intern_mp
+};
+
+/**
+ * LRU cache of compiled modules, keyed by everything that determines the generated code (see
+ * math_compiler_dp::cache_key), so two fxns with the same definition share one module no matter what they are called.
+ */
+struct compile_cache {
+    /**
+     * Looks up a module, counting a hit or a miss.
+     * @return the entry, or nullptr if there is none. only valid until the next insert.
+     */
+    static cache_entry *lookup(const std::string &key);
+
+    /**
+     * Compiles the module on the JS side and caches it, evicting the least recently used entries if the cache is full.
+     * @param async compile with WebAssembly.compile, so the module can only be installed with compiled_fxn::install_async
+     * until it's done (install compiles it again)
+     * @return the new entry. only valid until the next insert.
+     */
+    static cache_entry *insert(const std::string &key, const char *binary, size_t len, uint32_t arena_size, uint32_t features,
+                               bool async = false);
+
+    /**
+     * Replaces the module of an entry with its optimized build, if the entry still exists.
+     */
+    static void update(uint32_t id, const char *binary, size_t len);
+
+    /**
+     * @return the entry with the given id, or nullptr if it has been evicted. only valid until the next insert.
+     */
+    static cache_entry *find(uint32_t id);
+
+    /**
+     * Compiles a module on the JS side without caching it, e.g. when the cache is disabled. Must be forgotten after
+     * it is instantiated.
+     * @return id of the module
+     */
+    static uint32_t compile_uncached(const char *binary, size_t len, bool async = false);
+
+    static void forget(uint32_t id);
+
+    static void set_capacity(uint32_t capacity);
+
+    static void clear();
+
+    static uint32_t get_hits();
+
+    static uint32_t get_misses();
+
+private:
+    using lru_list = std::list<std::pair<std::string, cache_entry>>;
+
+    static lru_list entries; // most recently used first
+    static std::unordered_map<std::string, lru_list::iterator> index;
+    static uint32_t capacity;
+    static uint32_t next_id;
+    static uint32_t hits;
+    static uint32_t misses;
+
+    static void evict(size_t target_size);
+};
+
+#endif //GLAMCORE_COMPILE_CACHE_H
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "expr_dag.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <set>
+#include <sstream>
+
+// operators that take real arguments to real results
+static const std::set<std::string> real_operators = { "+", "-", "*", "/", expr_dag::neg_operator, "sin", "cos", "tan", "sinh",
+                                                      "cosh", "tanh" };
+
+std::string expr_dag::format_complex(std::complex<double> z) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%a %a", z.real(), z.imag());
+    return buf;
+}
+
+std::complex<double> expr_dag::parse_complex(const std::string &value) {
+    char *end;
+    double re = std::strtod(value.c_str(), &end);
+    double im = std::strtod(end, nullptr);
+    return { re, im };
+}
+
+bool expr_dag::is_binary(const std::string &op) {
+    return op == "+" || op == "-" || op == "*" || op == "/" || op == "^" || op == pair_operator;
+}
+
+std::string expr_dag::key_of(const expr_node &n) {
+    std::stringstream key;
+    key << n.kind << '|' << n.name << '|' << n.exponent << '|';
+    if (n.kind == EXPR_CONSTANT) {
+        key << format_complex(n.value);
+    }
+    for (auto arg : n.args) {
+        key << ' ' << arg;
+    }
+    return key.str();
+}
+
+expr_id expr_dag::intern(expr_node n) {
+    auto key = key_of(n);
+    auto it = interned.find(key);
+    if (it != interned.end()) {
+        return it->second;
+    }
+    auto id = static_cast<expr_id>(nodes.size());
+    nodes.push_back(std::move(n));
+    interned.emplace(std::move(key), id);
+    return id;
+}
+
+expr_id expr_dag::constant(std::complex<double> z) {
+    expr_node n;
+    n.kind = EXPR_CONSTANT;
+    n.type = z.imag() == 0 ? EXPR_TYPE_REAL : EXPR_TYPE_COMPLEX;
+    n.value = z;
+    return intern(std::move(n));
+}
+
+expr_id expr_dag::identifier(const std::string &name) {
+    expr_node n;
+    n.kind = EXPR_IDENTIFIER;
+    n.type = EXPR_TYPE_COMPLEX;
+    n.name = name;
+    return intern(std::move(n));
+}
+
+expr_id expr_dag::number(const std::string &value) {
+    expr_node n;
+    n.kind = EXPR_NUMBER;
+    n.type = EXPR_TYPE_COMPLEX;
+    n.name = value;
+    return intern(std::move(n));
+}
+
+expr_id expr_dag::op(const std::string &name, std::vector<expr_id> args) {
+    expr_node n;
+    n.kind = EXPR_OPERATOR;
+    bool real_args = std::all_of(args.begin(), args.end(), [&](expr_id arg) { return nodes[arg].type == EXPR_TYPE_REAL; });
+    n.type = real_args && real_operators.count(name) ? EXPR_TYPE_REAL : EXPR_TYPE_COMPLEX;
+    n.name = name;
+    n.args = std::move(args);
+    return intern(std::move(n));
+}
+
+expr_id expr_dag::fxncall(const std::string &name, expr_id arg) {
+    expr_node n;
+    n.kind = EXPR_FXNCALL;
+    n.type = EXPR_TYPE_COMPLEX;
+    n.name = name;
+    n.args.push_back(arg);
+    return intern(std::move(n));
+}
+
+expr_id expr_dag::power(expr_id base, int exponent) {
+    expr_node n;
+    n.kind = EXPR_POWER;
+    n.type = nodes[base].type;
+    n.exponent = exponent;
+    n.args.push_back(base);
+    return intern(std::move(n));
+}
+
+bool expr_dag::parse(const token_stack &tokens) {
+    nodes.clear();
+    interned.clear();
+    return parse_body(tokens, parameter_name, std::numeric_limits<expr_id>::max(), 0, root);
+}
+
+bool expr_dag::parse_body(const token_stack &tokens, const std::string &parameter, expr_id argument, uint32_t depth, expr_id &result) {
+    const bool bound = argument != std::numeric_limits<expr_id>::max();
+    std::vector<expr_id> stack;
+    std::map<std::string, expr_id> temporaries;
+    for (const auto &token : tokens) {
+        switch (token.type) {
+            case TOKEN_NUMBER: {
+                char *end;
+                double d = std::strtod(token.value.c_str(), &end);
+                if (!exact_numbers && *end == '\0' && !token.value.empty()) {
+                    stack.push_back(constant(d));
+                } else {
+                    stack.push_back(number(token.value));
+                }
+                break;
+            }
+            case TOKEN_COMPLEX:
+                stack.push_back(constant(parse_complex(token.value)));
+                break;
+            case TOKEN_IDENTIFIER: {
+                auto z = consts.find(token.value);
+                if (token.value == parameter && bound) {
+                    stack.push_back(argument);
+                } else if (token.value != parameter && z != consts.end()) {
+                    stack.push_back(constant(z->second));
+                } else {
+                    stack.push_back(identifier(token.value));
+                }
+                break;
+            }
+            case TOKEN_OPERATOR:
+            case TOKEN_FXNCALL: {
+                size_t arity = token.type == TOKEN_OPERATOR && is_binary(token.value) ? 2 : 1;
+                if (stack.size() < arity) {
+                    return false;
+                }
+                std::vector<expr_id> args(stack.end() - arity, stack.end());
+                stack.resize(stack.size() - arity);
+                if (token.type == TOKEN_OPERATOR) {
+                    stack.push_back(op(token.value, std::move(args)));
+                    break;
+                }
+                auto callee = definitions ? definitions->find(token.value) : std::map<std::string, expr_definition>::const_iterator();
+                if (definitions && callee != definitions->end() && depth < max_inline_depth) {
+                    expr_id body;
+                    if (!parse_body(callee->second.tokens, callee->second.parameter_name, args[0], depth + 1, body)) {
+                        return false;
+                    }
+                    stack.push_back(body);
+                } else {
+                    stack.push_back(fxncall(token.value, args[0]));
+                }
+                break;
+            }
+            case TOKEN_TEE:
+                if (stack.empty()) {
+                    return false;
+                }
+                temporaries[token.value] = stack.back();
+                break;
+            case TOKEN_GET: {
+                auto t = temporaries.find(token.value);
+                if (t == temporaries.end()) {
+                    return false;
+                }
+                stack.push_back(t->second);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if (stack.size() != 1) {
+        return false;
+    }
+    result = stack.back();
+    return true;
+}
+
+void expr_dag::prune() {
+    // arguments are always interned before the nodes that use them, so one pass from the root down finds everything
+    // reachable, and renumbering in order keeps that property
+    std::vector<bool> live(nodes.size());
+    live[root] = true;
+    for (size_t id = nodes.size(); id-- > 0;) {
+        if (live[id]) {
+            for (auto arg : nodes[id].args) {
+                live[arg] = true;
+            }
+        }
+    }
+
+    std::vector<expr_id> renumbered(nodes.size());
+    std::vector<expr_node> old_nodes;
+    std::swap(old_nodes, nodes);
+    interned.clear();
+    for (size_t id = 0; id < old_nodes.size(); id++) {
+        if (!live[id]) {
+            continue;
+        }
+        auto n = std::move(old_nodes[id]);
+        for (auto &arg : n.args) {
+            arg = renumbered[arg];
+        }
+        renumbered[id] = intern(std::move(n));
+    }
+    root = renumbered[root];
+}
+
+namespace {
+    struct expr_emitter {
+        const expr_dag &dag;
+        std::vector<uint32_t> uses;
+        std::map<expr_id, uint32_t> temporaries;
+        uint32_t next_temporary = 0;
+        token_stack out;
+
+        expr_emitter(const expr_dag &_dag, bool share): dag(_dag), uses(_dag.size()) {
+            if (!share) {
+                return;
+            }
+            std::vector<bool> live(dag.size());
+            live[dag.get_root()] = true;
+            for (size_t id = dag.size(); id-- > 0;) {
+                if (live[id]) {
+                    for (auto arg : dag[id].args) {
+                        live[arg] = true;
+                        uses[arg]++;
+                    }
+                }
+            }
+        }
+
+        void emit(expr_id id) {
+            auto t = temporaries.find(id);
+            if (t != temporaries.end()) {
+                out.push_back({ TOKEN_GET, std::to_string(t->second) });
+                return;
+            }
+            const auto &n = dag[id];
+            switch (n.kind) {
+                case EXPR_CONSTANT:
+                    out.push_back({ TOKEN_COMPLEX, expr_dag::format_complex(n.value) });
+                    return; // leaves are never worth a temporary
+                case EXPR_IDENTIFIER:
+                    out.push_back({ TOKEN_IDENTIFIER, n.name });
+                    return;
+                case EXPR_NUMBER:
+                    out.push_back({ TOKEN_NUMBER, n.name });
+                    return;
+                case EXPR_OPERATOR:
+                case EXPR_FXNCALL:
+                    for (auto arg : n.args) {
+                        emit(arg);
+                    }
+                    out.push_back({ n.kind == EXPR_OPERATOR ? TOKEN_OPERATOR : TOKEN_FXNCALL, n.name });
+                    break;
+                case EXPR_POWER:
+                    emit_power(n);
+                    break;
+            }
+            if (uses[id] > 1) {
+                temporaries[id] = next_temporary;
+                out.push_back({ TOKEN_TEE, std::to_string(next_temporary++) });
+            }
+        }
+
+        void emit_power(const expr_node &n) {
+            // left-to-right binary exponentiation: for each bit after the leading one, square, then multiply by the base
+            // if the bit is set. the base and the running power each live in a temporary; if the base is shared it
+            // already has one.
+            emit(n.args[0]);
+            auto t = temporaries.find(n.args[0]);
+            std::string base;
+            if (t != temporaries.end()) {
+                base = std::to_string(t->second);
+            } else {
+                base = std::to_string(next_temporary++);
+                out.push_back({ TOKEN_TEE, base });
+            }
+            auto power = std::to_string(next_temporary++);
+            int bit = 0;
+            while ((n.exponent >> (bit + 1)) != 0) {
+                bit++;
+            }
+            while (bit-- > 0) {
+                out.push_back({ TOKEN_TEE, power });
+                out.push_back({ TOKEN_GET, power });
+                out.push_back({ TOKEN_OPERATOR, "*" });
+                if ((n.exponent >> bit) & 1) {
+                    out.push_back({ TOKEN_GET, base });
+                    out.push_back({ TOKEN_OPERATOR, "*" });
+                }
+            }
+        }
+    };
+}
+
+token_stack expr_dag::emit(bool share) const {
+    expr_emitter emitter(*this, share);
+    emitter.emit(root);
+    return std::move(emitter.out);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_EXPR_DAG_H
+#define GLAMCORE_EXPR_DAG_H
+
+#include <complex>
+#include <map>
+#include <unordered_map>
+#include "stack_token.h"
+
+enum expr_kind {
+    EXPR_CONSTANT, // value
+    EXPR_IDENTIFIER, // the parameter, or something we don't know about (name)
+    EXPR_NUMBER, // a number we couldn't parse, kept as is (name)
+    EXPR_OPERATOR, // name applied to args
+    EXPR_FXNCALL, // name applied to args[0]
+    EXPR_POWER // args[0] to the power of exponent, which is at least 2
+};
+
+/**
+ * What is known about the value of a node. Real values are complex numbers with an imaginary part of exactly 0.
+ */
+enum expr_type {
+    EXPR_TYPE_COMPLEX, EXPR_TYPE_REAL
+};
+
+using expr_id = uint32_t;
+
+/**
+ * What a fxn was defined as, for inlining it into its callers.
+ */
+struct expr_definition {
+    std::string parameter_name;
+    token_stack tokens;
+};
+
+struct expr_node {
+    expr_kind kind;
+    expr_type type;
+    std::complex<double> value;
+    std::string name;
+    int exponent = 0;
+    std::vector<expr_id> args;
+};
+
+/**
+ * Expression DAG built from a token stack. Nodes are immutable and hash-consed, so structurally equal subexpressions
+ * are always the same node, which is all common subexpression elimination takes. Passes rewrite the DAG by building
+ * new nodes and moving the root; whatever is no longer reachable from it is dead, and is dropped by prune() (and never
+ * emitted in any case).
+ */
+class expr_dag {
+public:
+    constexpr static const char *neg_operator = "_neg"; // internal unary operator, can't come from the parser
+    constexpr static const char *pair_operator = "_pair"; // internal binary operator, see expr_derivative
+    constexpr static uint32_t max_inline_depth = 16;
+
+private:
+    std::string parameter_name;
+    std::map<std::string, std::complex<double>> consts;
+    std::vector<expr_node> nodes;
+    std::unordered_map<std::string, expr_id> interned;
+    expr_id root = 0;
+    bool exact_numbers = false;
+    const std::map<std::string, expr_definition> *definitions = nullptr;
+
+    expr_id intern(expr_node n);
+
+    // parses the body of a fxn whose parameter is bound to `argument`, or is itself if there is no argument
+    bool parse_body(const token_stack &tokens, const std::string &parameter, expr_id argument, uint32_t depth, expr_id &result);
+
+    static std::string key_of(const expr_node &n);
+
+public:
+    expr_dag(const std::string &_parameter_name, const std::map<std::string, std::complex<double>> &_consts)
+            : parameter_name(_parameter_name), consts(_consts) { }
+
+    /**
+     * Keeps numbers as they are written (EXPR_NUMBER) instead of rounding them to doubles, for compilers that work in
+     * more than double precision. Must be called before parse().
+     */
+    void set_exact_numbers(bool exact) {
+        exact_numbers = exact;
+    }
+
+    /**
+     * Makes parse() inline calls to the given fxns: the callee's body is parsed in place of the call, with its parameter
+     * bound to the argument, so the rest of the pipeline sees straight through it. Calls to anything else (and calls
+     * nested more than max_inline_depth deep) stay EXPR_FXNCALLs. Must be called before parse().
+     */
+    void set_definitions(const std::map<std::string, expr_definition> *_definitions) {
+        definitions = _definitions;
+    }
+
+    /**
+     * Builds the DAG, replacing any previous contents. Globals in `consts` become constants.
+     * @return false if the stack is malformed
+     */
+    bool parse(const token_stack &tokens);
+
+    /**
+     * Converts the DAG back into a token stack. Nodes used more than once are computed the first time and kept in a
+     * temporary (TOKEN_TEE/TOKEN_GET) after that, except for leaves, which are cheaper to push again. With `share` off
+     * every use is computed from scratch, like the stack the DAG came from.
+     */
+    token_stack emit(bool share = true) const;
+
+    /**
+     * Removes every node that isn't reachable from the root.
+     */
+    void prune();
+
+    expr_id constant(std::complex<double> z);
+
+    expr_id identifier(const std::string &name);
+
+    expr_id number(const std::string &value);
+
+    expr_id op(const std::string &name, std::vector<expr_id> args);
+
+    expr_id fxncall(const std::string &name, expr_id arg);
+
+    expr_id power(expr_id base, int exponent);
+
+    const expr_node &operator[](expr_id id) const {
+        return nodes[id];
+    }
+
+    expr_id get_root() const {
+        return root;
+    }
+
+    void set_root(expr_id id) {
+        root = id;
+    }
+
+    size_t size() const {
+        return nodes.size();
+    }
+
+    static bool is_binary(const std::string &op);
+
+    static std::string format_complex(std::complex<double> z);
+
+    static std::complex<double> parse_complex(const std::string &value);
+};
+
+#endif //GLAMCORE_EXPR_DAG_H
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "expr_derivative.h"
+
+expr_id expr_derivative::add(expr_id a, expr_id b) {
+    if (a == zero) {
+        return b;
+    } else if (b == zero) {
+        return a;
+    }
+    return dag.op("+", { a, b });
+}
+
+expr_id expr_derivative::sub(expr_id a, expr_id b) {
+    if (b == zero) {
+        return a;
+    } else if (a == zero) {
+        return dag.op(expr_dag::neg_operator, { b });
+    }
+    return dag.op("-", { a, b });
+}
+
+expr_id expr_derivative::scale(expr_id x, expr_id t) {
+    return t == zero ? zero : dag.op("*", { x, t });
+}
+
+expr_id expr_derivative::tangent(expr_id id) {
+    // copy what we need, since making new nodes can move the old ones
+    const auto kind = dag[id].kind;
+    const auto name = dag[id].name;
+    const auto args = dag[id].args;
+    const auto exponent = dag[id].exponent;
+    std::vector<expr_id> d;
+    for (auto arg : args) {
+        d.push_back(tangents[arg]);
+        if (d.back() == none) {
+            return none;
+        }
+    }
+
+    switch (kind) {
+        case EXPR_CONSTANT:
+        case EXPR_NUMBER:
+            return zero;
+        case EXPR_IDENTIFIER:
+            return name == parameter_name ? dag.constant(1.) : zero;
+        case EXPR_FXNCALL:
+            return none;
+        case EXPR_POWER: {
+            // (a^n)' = n a^(n - 1) a'
+            expr_id lower = exponent > 2 ? dag.power(args[0], exponent - 1) : args[0];
+            return scale(dag.op("*", { dag.constant(static_cast<double>(exponent)), lower }), d[0]);
+        }
+        case EXPR_OPERATOR:
+            break;
+    }
+
+    if (name == "+") {
+        return add(d[0], d[1]);
+    } else if (name == "-") {
+        return sub(d[0], d[1]);
+    } else if (name == "*") {
+        return add(scale(args[1], d[0]), scale(args[0], d[1]));
+    } else if (name == "/") {
+        // (a / b)' = (a' - (a / b) b') / b, which reuses the quotient
+        auto numerator = sub(d[0], scale(id, d[1]));
+        return numerator == zero ? zero : dag.op("/", { numerator, args[1] });
+    } else if (name == "^") {
+        if (d[1] == zero) {
+            // (a^b)' = b a^(b - 1) a'
+            auto lower = dag.op("^", { args[0], dag.op("-", { args[1], dag.constant(1.) }) });
+            return scale(dag.op("*", { args[1], lower }), d[0]);
+        } else if (d[0] == zero && dag[args[0]].kind == EXPR_CONSTANT) {
+            // (c^b)' = c^b log(c) b', which reuses the power, and log(c) is just another constant. 0^b is 0 everywhere
+            const auto base = dag[args[0]].value;
+            return base == 0. ? zero : scale(dag.op("*", { id, dag.constant(std::log(base)) }), d[1]);
+        }
+        return none;
+    } else if (name == expr_dag::neg_operator) {
+        return d[0] == zero ? zero : dag.op(expr_dag::neg_operator, { d[0] });
+    } else if (name == "sin") {
+        return scale(dag.op("cos", args), d[0]);
+    } else if (name == "cos") {
+        return scale(dag.op(expr_dag::neg_operator, { dag.op("sin", args) }), d[0]);
+    } else if (name == "tan") {
+        // 1 + tan^2, which reuses the tangent
+        return scale(dag.op("+", { dag.constant(1.), dag.power(id, 2) }), d[0]);
+    } else if (name == "sinh") {
+        return scale(dag.op("cosh", args), d[0]);
+    } else if (name == "cosh") {
+        return scale(dag.op("sinh", args), d[0]);
+    } else if (name == "tanh") {
+        return scale(dag.op("-", { dag.constant(1.), dag.power(id, 2) }), d[0]);
+    }
+    return none;
+}
+
+expr_id expr_derivative::differentiate(expr_id id) {
+    // arguments are always interned before the nodes that use them, so visiting in order sees every argument's tangent
+    // first. nodes made along the way are after id, and are left alone, as is anything id doesn't depend on.
+    std::vector<bool> live(id + 1);
+    live[id] = true;
+    for (expr_id i = id + 1; i-- > 0;) {
+        if (live[i]) {
+            for (auto arg : dag[i].args) {
+                live[arg] = true;
+            }
+        }
+    }
+    tangents.assign(id + 1, zero);
+    for (expr_id i = 0; i <= id; i++) {
+        if (live[i]) {
+            tangents[i] = tangent(i);
+        }
+    }
+    auto result = tangents[id];
+    return result == zero ? dag.constant(0.) : result;
+}
+
+bool expr_derivative::pair_with_derivative() {
+    auto f = dag.get_root();
+    auto derivative = differentiate(f);
+    if (derivative == none) {
+        return false;
+    }
+    dag.set_root(dag.op(expr_dag::pair_operator, { f, derivative }));
+    return true;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_EXPR_DERIVATIVE_H
+#define GLAMCORE_EXPR_DERIVATIVE_H
+
+#include <limits>
+#include <string>
+#include <vector>
+#include "expr_dag.h"
+
+/**
+ * Forward-mode differentiation over an expr_dag. Every node gets a tangent node, built from the tangents of its
+ * arguments with the usual dual number rules, so f and f' share all of their intermediates: sin(u) contributes cos(u)
+ * u', a quotient q = a / b contributes (a' - q b') / b, and so on. Tangents that are known to be zero are never built,
+ * which keeps the derivative of anything that doesn't depend on the parameter free.
+ */
+class expr_derivative {
+    constexpr static expr_id zero = std::numeric_limits<expr_id>::max() - 1;
+
+    expr_dag &dag;
+    std::string parameter_name;
+    std::vector<expr_id> tangents;
+
+    expr_id add(expr_id a, expr_id b);
+
+    expr_id sub(expr_id a, expr_id b);
+
+    // x times the tangent t
+    expr_id scale(expr_id x, expr_id t);
+
+    expr_id tangent(expr_id id);
+
+public:
+    constexpr static expr_id none = std::numeric_limits<expr_id>::max();
+
+    expr_derivative(expr_dag &_dag, const std::string &_parameter_name): dag(_dag), parameter_name(_parameter_name) { }
+
+    /**
+     * Adds the derivative of `id` with respect to the parameter to the DAG.
+     * @return the derivative, or none if `id` calls a fxn (which can't be seen into) or raises something other than a
+     * constant to a power that depends on the parameter (which would take a logarithm at runtime)
+     */
+    expr_id differentiate(expr_id id);
+
+    /**
+     * Makes the root expr_dag::pair_operator applied to the old root and its derivative, which leaves both on the stack
+     * when emitted, so a kernel can compute f and f' at once.
+     * @return false if the root can't be differentiated, in which case the DAG is left alone
+     */
+    bool pair_with_derivative();
+};
+
+#endif //GLAMCORE_EXPR_DERIVATIVE_H
@@ -15,19 +15,190 @@
  */
 
 #include "globals.h"
+#include <algorithm>
+#include <functional>
 
-std::map<std::string, mp_complex *> globals::consts_mp = { std::make_pair("e", new mp_complex(mp_e)),
-        std::make_pair("\\pi", new mp_complex(mp_pi)), std::make_pair("i", new mp_i) };
+std::map<std::string, mp_complex *> globals::consts_mp = []() {
+    mp_precision::scope precision(mp_precision::max_digits);
+    return std::map<std::string, mp_complex *> { std::make_pair("e", new mp_complex(mp_e)), std::make_pair("\\pi", new mp_complex(mp_pi)),
+            std::make_pair("i", new mp_i) };
+}();
 
 std::map<std::string, std::complex<double>> globals::consts_dp = { std::make_pair("e", std::complex(M_E, 0.)),
         std::make_pair("\\pi", std::complex(M_PI, 0.)), std::make_pair("i", std::complex(0., 1.)) };
 
+std::map<std::string, dd_complex> globals::consts_dd = { std::make_pair("e", dd_complex(dd_math::e)),
+        std::make_pair("\\pi", dd_complex(dd_math::pi)), std::make_pair("i", dd_complex(0., 1.)) };
+
 std::map<std::string, uintptr_t> globals::fxn_table;
 
+std::set<std::string> globals::multi_value_fxns;
+
+std::set<std::string> globals::mp_fxns;
+
+std::set<std::string> globals::outdated;
+
+std::map<std::string, std::weak_ptr<const mp_complex>> globals::literals_mp;
+
+std::map<std::string, expr_definition> globals::definitions;
+
+std::map<std::string, expr_definition> globals::sources;
+
+std::map<std::string, std::set<std::string>> globals::callees;
+
+std::map<std::string, uint64_t> globals::revisions;
+
+std::map<std::string, tier_stats> globals::tiers;
+
+bool globals::measure_tiers = false;
+
+bool globals::is_outdated(const std::string &fxn_name) {
+    return outdated.count(fxn_name);
+}
+
 bool globals::is_fxn(const std::string &name) {
     return fxn_table.count(name);
 }
 
+tier_stats globals::get_tier_stats(const std::string &name) {
+    auto iter = tiers.find(name);
+    return iter == tiers.end() ? tier_stats() : iter->second;
+}
+
+void globals::set_measure_tiers(bool measure) {
+    measure_tiers = measure;
+}
+
+std::shared_ptr<const mp_complex> globals::intern_mp(const mp_complex &z) {
+    // str() uses as many digits as it takes to round-trip, but the same value can be wanted at several precisions
+    auto key = std::to_string(z.precision()) + " " + z.real().str() + " " + z.imag().str();
+    auto literal = literals_mp[key].lock();
+    if (!literal) {
+        // whatever was let go of is dropped whenever there is something new, so the table only grows with the literals in use
+        for (auto iter = literals_mp.begin(); iter != literals_mp.end();) {
+            iter = iter->first != key && iter->second.expired() ? literals_mp.erase(iter) : std::next(iter);
+        }
+        literal = std::make_shared<const mp_complex>(z);
+        literals_mp[key] = literal;
+    }
+    return literal;
+}
+
+namespace {
+    uint64_t last_revision = 0;
+
+    void derive(const std::string &fxn_name, const expr_definition &source) {
+        expr_dag dag(source.parameter_name, { });
+        dag.set_exact_numbers(true);
+        dag.set_definitions(&globals::definitions);
+        if (dag.parse(source.tokens)) {
+            globals::definitions[fxn_name] = { source.parameter_name, dag.emit() };
+        } else {
+            globals::definitions.erase(fxn_name);
+        }
+    }
+}
+
+void globals::define(const std::string &fxn_name, const std::string &parameter_name, const token_stack &tokens) {
+    expr_definition source = { parameter_name, tokens };
+    auto previous = sources.find(fxn_name);
+    bool recursive = std::any_of(tokens.begin(), tokens.end(), [&](const stack_token &token) {
+        return token.type == TOKEN_FXNCALL && token.value == fxn_name;
+    });
+    if (recursive && previous != sources.end()) {
+        // a fxn calling itself calls its previous definition, so that's substituted into the source once and for all.
+        // otherwise re-deriving it would substitute the current one.
+        const std::map<std::string, expr_definition> substitution = { *previous };
+        expr_dag dag(parameter_name, { });
+        dag.set_exact_numbers(true);
+        dag.set_definitions(&substitution);
+        if (dag.parse(tokens)) {
+            source.tokens = dag.emit();
+        }
+    }
+
+    auto &called = callees[fxn_name];
+    called.clear();
+    for (const auto &token : source.tokens) {
+        if (token.type == TOKEN_FXNCALL && token.value != fxn_name) {
+            called.insert(token.value);
+        }
+    }
+    sources[fxn_name] = source;
+    derive(fxn_name, sources[fxn_name]);
+    revisions[fxn_name] = ++last_revision;
+
+    // the dependents' definitions have the old one inlined
+    for (const auto &dependent : dependents(fxn_name)) {
+        auto source = sources.find(dependent);
+        if (source != sources.end()) {
+            derive(dependent, source->second);
+        }
+    }
+}
+
+void globals::forget(const std::string &fxn_name) {
+    definitions.erase(fxn_name);
+    sources.erase(fxn_name);
+    callees.erase(fxn_name);
+}
+
+std::vector<std::string> globals::dependents(const std::string &fxn_name) {
+    std::set<std::string> affected;
+    std::vector<std::string> work = { fxn_name };
+    while (!work.empty()) {
+        auto name = work.back();
+        work.pop_back();
+        for (const auto &entry : callees) {
+            if (entry.first != fxn_name && entry.second.count(name) && affected.insert(entry.first).second) {
+                work.push_back(entry.first);
+            }
+        }
+    }
+
+    // depth-first, so callees are emitted before their callers. cycles are cut wherever they're entered.
+    std::vector<std::string> order;
+    std::set<std::string> visited;
+    std::function<void(const std::string &)> visit = [&](const std::string &name) {
+        if (!visited.insert(name).second) {
+            return;
+        }
+        auto called = callees.find(name);
+        for (const auto &callee : called->second) {
+            if (affected.count(callee)) {
+                visit(callee);
+            }
+        }
+        order.push_back(name);
+    };
+    for (const auto &name : affected) {
+        visit(name);
+    }
+    return order;
+}
+
+uint64_t globals::revision(const std::string &fxn_name) {
+    uint64_t latest = 0;
+    std::set<std::string> visited;
+    std::vector<std::string> work = { fxn_name };
+    while (!work.empty()) {
+        auto name = work.back();
+        work.pop_back();
+        if (!visited.insert(name).second) {
+            continue;
+        }
+        auto iter = revisions.find(name);
+        if (iter != revisions.end()) {
+            latest = std::max(latest, iter->second);
+        }
+        auto called = callees.find(name);
+        if (called != callees.end()) {
+            work.insert(work.end(), called->second.begin(), called->second.end());
+        }
+    }
+    return latest;
+}
+
 bool globals::is_global(const std::string &name) {
     return consts_dp.count(name) || consts_mp.count(name);
 }
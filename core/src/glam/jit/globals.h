@@ -18,18 +18,87 @@
 #define GLAMCORE_GLOBALS_H
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <utility>
+#include <vector>
 #include "../types.h"
+#include "expr_dag.h"
 
+/**
+ * How long each tier of a fxn took to compile, and how fast it runs. Throughputs are only measured if
+ * globals::measure_tiers is set, on the batch kernel right before and after the optimized tier is swapped in, and stay 0
+ * otherwise (or if there is no batch kernel).
+ */
+struct tier_stats {
+    double baseline_compile_ms = 0;
+    double optimized_compile_ms = 0;
+    double baseline_evals_per_sec = 0;
+    double optimized_evals_per_sec = 0;
+};
 
 struct globals {
-    static std::map<std::string, mp_complex *> consts_mp;
+    static std::map<std::string, mp_complex *> consts_mp; // at mp_precision::max_digits, to be rounded to the fxn's precision
     static std::map<std::string, std::complex<double>> consts_dp;
+    static std::map<std::string, dd_complex> consts_dd;
     static std::map<std::string, uintptr_t> fxn_table;
+    static std::set<std::string> multi_value_fxns; // fxns whose table entry returns (f64, f64) instead of a pointer
+    static std::set<std::string> mp_fxns; // fxns whose table entry is (mp_complex *) -> mp_complex *
+    static std::set<std::string> outdated; // see is_outdated
+    static std::map<std::string, std::weak_ptr<const mp_complex>> literals_mp; // see intern_mp
+    static std::map<std::string, tier_stats> tiers;
+    static bool measure_tiers; // see tier_stats. off by default, since it runs every tier-up's kernel 4 times over
+    static std::map<std::string, expr_definition> definitions; // see define
+    static std::map<std::string, expr_definition> sources; // the stacks fxns were defined from, as they were written
+    static std::map<std::string, std::set<std::string>> callees; // the fxns each fxn's source calls, see dependents
+    static std::map<std::string, uint64_t> revisions; // see revision
+
+    /**
+     * @return a copy of z that is the same for every equal z of the same precision, for as long as something holds on
+     * to it. Compiled mp fxns refer to their constants this way, so their modules can be cached and shared; the arena of
+     * each fxn and the cache entry of its module keep them (see fixed_arena::consts and cache_entry::literals).
+     */
+    static std::shared_ptr<const mp_complex> intern_mp(const mp_complex &z);
+
+    /**
+     * Records what a fxn is defined as, so later fxns can inline it. Calls to fxns that are already defined are inlined
+     * into the stored definition right away, which keeps it valid when they are redefined (or it is, recursively).
+     * Nothing is folded or rounded, so the definition can be compiled at any precision.
+     */
+    static void define(const std::string &fxn_name, const std::string &parameter_name, const token_stack &tokens);
+
+    /**
+     * Forgets what a fxn is defined as. Its revision is kept, so if it's defined again, everything that depends on it
+     * still sees a change.
+     */
+    static void forget(const std::string &fxn_name);
+
+    /**
+     * Redefining a fxn re-derives the definitions of these right away, but whatever was compiled from them is out of
+     * date until it's compiled again.
+     * @return every fxn that calls this one, directly or not, ordered so that each comes after the fxns it calls
+     */
+    static std::vector<std::string> dependents(const std::string &fxn_name);
+
+    /**
+     * @return a number that changes whenever this fxn or one it calls (directly or not) is defined, or 0 for a fxn that
+     * was never defined
+     */
+    static uint64_t revision(const std::string &fxn_name);
+
+    /**
+     * A fxn that is recompiled in place keeps its table slots, so what calls it picks up the new code. If it changes
+     * signature (multi-value or not, dp or mp) it gets new slots instead, and what calls it is outdated: it goes on
+     * calling the old instance until it's compiled again.
+     * @return whether a fxn calls another through slots that no longer hold that fxn
+     */
+    static bool is_outdated(const std::string &fxn_name);
 
     static bool is_global(const std::string &name);
     static bool is_fxn(const std::string &name);
+    static tier_stats get_tier_stats(const std::string &name);
+    static void set_measure_tiers(bool measure);
 };
 
 #endif //GLAMCORE_GLOBALS_H
@@ -16,11 +16,271 @@
 
 #include "math_compiler.h"
 #include <wasm-stack.h>
+#include <wasm-builder.h>
 #include <binaryen-c.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <sstream>
 #include "globals.h"
+#include "compile_cache.h"
+#include "../vm/bytecode.h"
 
 #define GLAM_COMPILER_TRACE(msg) GLAM_TRACE("[compiler] " << msg)
 
+void wasm_math_ops::visit_value(const value &v) {
+    if (v.is_const) {
+        fv->visit_float(v.constant);
+    } else {
+        fv->visit_local_get(v.index, wasm::Type::f64);
+    }
+}
+
+wasm_math_ops::value wasm_math_ops::constant(double d) {
+    return { true, d, 0 };
+}
+
+wasm_math_ops::value wasm_math_ops::visit_result() {
+    wasm::Index index = wasm::Builder::addVar(fv->func, wasm::Type::f64);
+    fv->visit_local_set(index);
+    return { false, 0., index };
+}
+
+wasm_math_ops::value wasm_math_ops::visit_unary(wasm::UnaryOp op, value a) {
+    visit_value(a);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Unary>();
+    inst->op = op;
+    inst->type = wasm::Type::f64;
+    fv->visit_basic(inst);
+    return visit_result();
+}
+
+wasm_math_ops::value wasm_math_ops::visit_binary(wasm::BinaryOp op, value a, value b) {
+    visit_value(a);
+    visit_value(b);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Binary>();
+    inst->op = op;
+    inst->type = wasm::Type::f64;
+    fv->visit_basic(inst);
+    return visit_result();
+}
+
+wasm_math_ops::mask wasm_math_ops::visit_compare(wasm::BinaryOp op, value a, value b) {
+    visit_value(a);
+    visit_value(b);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Binary>();
+    inst->op = op;
+    inst->type = wasm::Type::i32;
+    fv->visit_basic(inst);
+    mask m = wasm::Builder::addVar(fv->func, wasm::Type::i32);
+    fv->visit_local_set(m);
+    return m;
+}
+
+wasm_math_ops::value wasm_math_ops::add(value a, value b) {
+    return visit_binary(wasm::AddFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::sub(value a, value b) {
+    return visit_binary(wasm::SubFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::mul(value a, value b) {
+    return visit_binary(wasm::MulFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::div(value a, value b) {
+    return visit_binary(wasm::DivFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::neg(value a) {
+    return visit_unary(wasm::NegFloat64, a);
+}
+
+wasm_math_ops::value wasm_math_ops::abs(value a) {
+    return visit_unary(wasm::AbsFloat64, a);
+}
+
+wasm_math_ops::value wasm_math_ops::copysign(value a, value b) {
+    return visit_binary(wasm::CopySignFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::floor(value a) {
+    return visit_unary(wasm::FloorFloat64, a);
+}
+
+wasm_math_ops::value wasm_math_ops::nearest(value a) {
+    return visit_unary(wasm::NearestFloat64, a);
+}
+
+wasm_math_ops::value wasm_math_ops::min(value a, value b) {
+    return visit_binary(wasm::MinFloat64, a, b);
+}
+
+wasm_math_ops::value wasm_math_ops::max(value a, value b) {
+    return visit_binary(wasm::MaxFloat64, a, b);
+}
+
+wasm_math_ops::mask wasm_math_ops::lt(value a, value b) {
+    return visit_compare(wasm::LtFloat64, a, b);
+}
+
+wasm_math_ops::mask wasm_math_ops::gt(value a, value b) {
+    return visit_compare(wasm::GtFloat64, a, b);
+}
+
+wasm_math_ops::mask wasm_math_ops::eq(value a, value b) {
+    return visit_compare(wasm::EqFloat64, a, b);
+}
+
+wasm_math_ops::mask wasm_math_ops::land(mask a, mask b) {
+    fv->visit_local_get(a, wasm::Type::i32);
+    fv->visit_local_get(b, wasm::Type::i32);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Binary>();
+    inst->op = wasm::AndInt32;
+    inst->type = wasm::Type::i32;
+    fv->visit_basic(inst);
+    mask m = wasm::Builder::addVar(fv->func, wasm::Type::i32);
+    fv->visit_local_set(m);
+    return m;
+}
+
+wasm_math_ops::mask wasm_math_ops::lor(mask a, mask b) {
+    fv->visit_local_get(a, wasm::Type::i32);
+    fv->visit_local_get(b, wasm::Type::i32);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Binary>();
+    inst->op = wasm::OrInt32;
+    inst->type = wasm::Type::i32;
+    fv->visit_basic(inst);
+    mask m = wasm::Builder::addVar(fv->func, wasm::Type::i32);
+    fv->visit_local_set(m);
+    return m;
+}
+
+wasm_math_ops::value wasm_math_ops::select(mask m, value a, value b) {
+    visit_value(a);
+    visit_value(b);
+    fv->visit_local_get(m, wasm::Type::i32);
+    auto inst = fv->parent->module->allocator.alloc<wasm::Select>();
+    inst->type = wasm::Type::f64;
+    fv->visit_basic(inst);
+    return visit_result();
+}
+
+wasm_math_ops::value wasm_math_ops::scalbn(value x, value k) {
+    // x * reinterpret((k + 1023) << 52)
+    visit_value(x);
+    visit_value(k);
+    auto trunc = fv->parent->module->allocator.alloc<wasm::Unary>();
+    trunc->op = wasm::TruncSFloat64ToInt64;
+    trunc->type = wasm::Type::i64;
+    fv->visit_basic(trunc);
+
+    auto bias = fv->parent->module->allocator.alloc<wasm::Const>();
+    bias->type = wasm::Type::i64;
+    bias->value = wasm::Literal(static_cast<int64_t>(1023));
+    fv->visit_basic(bias);
+    auto add = fv->parent->module->allocator.alloc<wasm::Binary>();
+    add->op = wasm::AddInt64;
+    add->type = wasm::Type::i64;
+    fv->visit_basic(add);
+
+    auto shift = fv->parent->module->allocator.alloc<wasm::Const>();
+    shift->type = wasm::Type::i64;
+    shift->value = wasm::Literal(static_cast<int64_t>(52));
+    fv->visit_basic(shift);
+    auto shl = fv->parent->module->allocator.alloc<wasm::Binary>();
+    shl->op = wasm::ShlInt64;
+    shl->type = wasm::Type::i64;
+    fv->visit_basic(shl);
+
+    auto reinterpret = fv->parent->module->allocator.alloc<wasm::Unary>();
+    reinterpret->op = wasm::ReinterpretInt64;
+    reinterpret->type = wasm::Type::f64;
+    fv->visit_basic(reinterpret);
+
+    auto mul = fv->parent->module->allocator.alloc<wasm::Binary>();
+    mul->op = wasm::MulFloat64;
+    mul->type = wasm::Type::f64;
+    fv->visit_basic(mul);
+    return visit_result();
+}
+
+wasm_math_ops::value wasm_math_ops::exponent(value x) {
+    // ((reinterpret(x) >> 52) & 0x7ff) - 1023
+    visit_value(x);
+    auto reinterpret = fv->parent->module->allocator.alloc<wasm::Unary>();
+    reinterpret->op = wasm::ReinterpretFloat64;
+    reinterpret->type = wasm::Type::i64;
+    fv->visit_basic(reinterpret);
+
+    auto shift = fv->parent->module->allocator.alloc<wasm::Const>();
+    shift->type = wasm::Type::i64;
+    shift->value = wasm::Literal(static_cast<int64_t>(52));
+    fv->visit_basic(shift);
+    auto shr = fv->parent->module->allocator.alloc<wasm::Binary>();
+    shr->op = wasm::ShrUInt64;
+    shr->type = wasm::Type::i64;
+    fv->visit_basic(shr);
+
+    auto bits = fv->parent->module->allocator.alloc<wasm::Const>();
+    bits->type = wasm::Type::i64;
+    bits->value = wasm::Literal(static_cast<int64_t>(0x7ff));
+    fv->visit_basic(bits);
+    auto mask = fv->parent->module->allocator.alloc<wasm::Binary>();
+    mask->op = wasm::AndInt64;
+    mask->type = wasm::Type::i64;
+    fv->visit_basic(mask);
+
+    auto bias = fv->parent->module->allocator.alloc<wasm::Const>();
+    bias->type = wasm::Type::i64;
+    bias->value = wasm::Literal(static_cast<int64_t>(1023));
+    fv->visit_basic(bias);
+    auto sub = fv->parent->module->allocator.alloc<wasm::Binary>();
+    sub->op = wasm::SubInt64;
+    sub->type = wasm::Type::i64;
+    fv->visit_basic(sub);
+
+    auto convert = fv->parent->module->allocator.alloc<wasm::Unary>();
+    convert->op = wasm::ConvertSInt64ToFloat64;
+    convert->type = wasm::Type::f64;
+    fv->visit_basic(convert);
+    return visit_result();
+}
+
+wasm_math_ops::value wasm_math_ops::mantissa(value x) {
+    // reinterpret((reinterpret(x) & 0x000fffffffffffff) | 0x3ff0000000000000)
+    visit_value(x);
+    auto reinterpret = fv->parent->module->allocator.alloc<wasm::Unary>();
+    reinterpret->op = wasm::ReinterpretFloat64;
+    reinterpret->type = wasm::Type::i64;
+    fv->visit_basic(reinterpret);
+
+    auto bits = fv->parent->module->allocator.alloc<wasm::Const>();
+    bits->type = wasm::Type::i64;
+    bits->value = wasm::Literal(static_cast<int64_t>(0x000fffffffffffffll));
+    fv->visit_basic(bits);
+    auto mask = fv->parent->module->allocator.alloc<wasm::Binary>();
+    mask->op = wasm::AndInt64;
+    mask->type = wasm::Type::i64;
+    fv->visit_basic(mask);
+
+    auto one = fv->parent->module->allocator.alloc<wasm::Const>();
+    one->type = wasm::Type::i64;
+    one->value = wasm::Literal(static_cast<int64_t>(0x3ff0000000000000ll));
+    fv->visit_basic(one);
+    auto orInst = fv->parent->module->allocator.alloc<wasm::Binary>();
+    orInst->op = wasm::OrInt64;
+    orInst->type = wasm::Type::i64;
+    fv->visit_basic(orInst);
+
+    auto back = fv->parent->module->allocator.alloc<wasm::Unary>();
+    back->op = wasm::ReinterpretInt64;
+    back->type = wasm::Type::f64;
+    fv->visit_basic(back);
+    return visit_result();
+}
+
 void module_visitor::visit_module() {
     GLAM_COMPILER_TRACE("visit_module");
     this->module = BinaryenModuleCreate();
@@ -38,6 +298,127 @@ void module_visitor::visit_export(const std::string &inner_name, const std::stri
     module->addExport(exp);
 }
 
+void module_visitor::visit_batch(const std::string &inner_name, bool multi_value) {
+    GLAM_COMPILER_TRACE("visit_batch " << inner_name);
+    // the loop has control flow, so unlike the kernel itself it is built as regular binaryen IR
+    wasm::Builder builder(*module);
+    const wasm::Index in = 0, out = 1, count = 2, result = 3;
+    const wasm::Type pair({ wasm::Type::f64, wasm::Type::f64 });
+    const wasm::Type resultType = multi_value ? pair : wasm::Type(wasm::Type::i32);
+    auto load = [&](wasm::Index ptr, uint32_t offset) {
+        return builder.makeLoad(8, false, offset, 8, builder.makeLocalGet(ptr, wasm::Type::i32), wasm::Type::f64);
+    };
+    auto component = [&](wasm::Index i) -> wasm::Expression * {
+        if (multi_value) {
+            return builder.makeTupleExtract(builder.makeLocalGet(result, pair), i);
+        } else {
+            return load(result, 8 * i);
+        }
+    };
+    auto advance = [&](wasm::Index ptr) {
+        return builder.makeLocalSet(ptr, builder.makeBinary(wasm::AddInt32, builder.makeLocalGet(ptr, wasm::Type::i32),
+                                                            builder.makeConst(wasm::Literal(static_cast<int32_t>(16)))));
+    };
+
+    auto loop = builder.makeLoop("next", builder.makeBlock({
+        builder.makeLocalSet(result, builder.makeCall(inner_name, { load(in, 0), load(in, 8) }, resultType)),
+        builder.makeStore(8, 0, 8, builder.makeLocalGet(out, wasm::Type::i32), component(0), wasm::Type::f64),
+        builder.makeStore(8, 8, 8, builder.makeLocalGet(out, wasm::Type::i32), component(1), wasm::Type::f64),
+        advance(in),
+        advance(out),
+        builder.makeBreak("next", nullptr, builder.makeLocalTee(count, builder.makeBinary(wasm::SubInt32,
+                                                                                          builder.makeLocalGet(count, wasm::Type::i32),
+                                                                                          builder.makeConst(wasm::Literal(static_cast<int32_t>(1)))),
+                                                                wasm::Type::i32))
+    }));
+    auto body = builder.makeBlock("done", {
+        builder.makeBreak("done", nullptr, builder.makeUnary(wasm::EqZInt32, builder.makeLocalGet(count, wasm::Type::i32))),
+        loop
+    });
+
+    auto batch = builder.makeFunction("_batch", wasm::Signature({ wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 }, wasm::Type::none),
+                                      { resultType }, body);
+    module->addFunction(std::move(batch));
+    visit_export("_batch", "_batch");
+}
+
+void module_visitor::visit_store(const std::string &inner_name) {
+    GLAM_COMPILER_TRACE("visit_store " << inner_name);
+    wasm::Builder builder(*module);
+    const wasm::Index re = 0, im = 1, out = 2, result = 3;
+    const wasm::Type pair({ wasm::Type::f64, wasm::Type::f64 });
+    auto body = builder.makeBlock({
+        builder.makeLocalSet(result, builder.makeCall(inner_name, { builder.makeLocalGet(re, wasm::Type::f64),
+                                                                    builder.makeLocalGet(im, wasm::Type::f64) }, pair)),
+        builder.makeStore(8, 0, 8, builder.makeLocalGet(out, wasm::Type::i32),
+                          builder.makeTupleExtract(builder.makeLocalGet(result, pair), 0), wasm::Type::f64),
+        builder.makeStore(8, 8, 8, builder.makeLocalGet(out, wasm::Type::i32),
+                          builder.makeTupleExtract(builder.makeLocalGet(result, pair), 1), wasm::Type::f64)
+    });
+
+    auto store = builder.makeFunction("_store", wasm::Signature({ wasm::Type::f64, wasm::Type::f64, wasm::Type::i32 }, wasm::Type::none),
+                                      { pair }, body);
+    module->addFunction(std::move(store));
+    visit_export("_store", "_store");
+}
+
+std::string module_visitor::visit_dual(const std::string &inner_name) {
+    GLAM_COMPILER_TRACE("visit_dual " << inner_name);
+    wasm::Builder builder(*module);
+    const wasm::Type pair({ wasm::Type::f64, wasm::Type::f64 });
+    const wasm::Type quad({ wasm::Type::f64, wasm::Type::f64, wasm::Type::f64, wasm::Type::f64 });
+
+    // f alone, which is what _entry, _batch and _store are made of
+    const std::string value_name = inner_name + "_value";
+    {
+        const wasm::Index re = 0, im = 1, result = 2;
+        auto body = builder.makeBlock({
+            builder.makeLocalSet(result, builder.makeCall(inner_name, { builder.makeLocalGet(re, wasm::Type::f64),
+                                                                        builder.makeLocalGet(im, wasm::Type::f64) }, quad)),
+            builder.makeTupleMake({ builder.makeTupleExtract(builder.makeLocalGet(result, quad), 0),
+                                    builder.makeTupleExtract(builder.makeLocalGet(result, quad), 1) })
+        });
+        module->addFunction(builder.makeFunction(value_name, wasm::Signature(pair, pair), { quad }, body));
+    }
+
+    const wasm::Index in = 0, out = 1, count = 2, result = 3;
+    auto load = [&](uint32_t offset) {
+        return builder.makeLoad(8, false, offset, 8, builder.makeLocalGet(in, wasm::Type::i32), wasm::Type::f64);
+    };
+    auto store = [&](wasm::Index i) {
+        return builder.makeStore(8, 8 * i, 8, builder.makeLocalGet(out, wasm::Type::i32),
+                                 builder.makeTupleExtract(builder.makeLocalGet(result, quad), i), wasm::Type::f64);
+    };
+    auto advance = [&](wasm::Index ptr, int32_t bytes) {
+        return builder.makeLocalSet(ptr, builder.makeBinary(wasm::AddInt32, builder.makeLocalGet(ptr, wasm::Type::i32),
+                                                            builder.makeConst(wasm::Literal(bytes))));
+    };
+
+    auto loop = builder.makeLoop("next", builder.makeBlock({
+        builder.makeLocalSet(result, builder.makeCall(inner_name, { load(0), load(8) }, quad)),
+        store(0),
+        store(1),
+        store(2),
+        store(3),
+        advance(in, 16),
+        advance(out, 32),
+        builder.makeBreak("next", nullptr, builder.makeLocalTee(count, builder.makeBinary(wasm::SubInt32,
+                                                                                          builder.makeLocalGet(count, wasm::Type::i32),
+                                                                                          builder.makeConst(wasm::Literal(static_cast<int32_t>(1)))),
+                                                                wasm::Type::i32))
+    }));
+    auto body = builder.makeBlock("done", {
+        builder.makeBreak("done", nullptr, builder.makeUnary(wasm::EqZInt32, builder.makeLocalGet(count, wasm::Type::i32))),
+        loop
+    });
+
+    auto dual = builder.makeFunction("_dual", wasm::Signature({ wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 }, wasm::Type::none),
+                                     { quad }, body);
+    module->addFunction(std::move(dual));
+    visit_export("_dual", "_dual");
+    return value_name;
+}
+
 function_visitor *module_visitor::visit_function(const std::string &name, wasm::Signature sig) {
     GLAM_COMPILER_TRACE("visit_function " << name);
     auto fv = new function_visitor(this);
@@ -48,7 +429,8 @@ function_visitor *module_visitor::visit_function(const std::string &name, wasm::
     return fv;
 }
 
-template <typename T> compiled_fxn<T> module_visitor::visit_end() {
+template <typename T> compiled_fxn<T> module_visitor::visit_end(uint32_t optimize_level, const std::string &cache_key,
+                                                                 const typename compiled_fxn<T>::install_callback &installed) {
     GLAM_COMPILER_TRACE("visit_end module");
     uint32_t globalFlags = 0;
     uint32_t totalArenaSize = 0;
@@ -94,15 +476,59 @@ template <typename T> compiled_fxn<T> module_visitor::visit_end() {
         BinaryenAddGlobalImport(module, "_arena", "env", "_arena", wasm::Type::i32, false);
     }
 
+    // the constant table. the values are interned, so the pointers are the same for every module that uses them
+    wasm::Builder builder(*module);
+    std::vector<std::shared_ptr<const mp_complex>> literals;
+    std::for_each(children.begin(), children.end(), [&](function_visitor *fv) {
+        for (size_t i = 0; i < fv->local_consts.size(); i++) {
+            auto ptr = static_cast<int32_t>(reinterpret_cast<uintptr_t>(fv->local_consts[i].get()));
+            module->addGlobal(builder.makeGlobal(fv->visit_const_name(i), wasm::Type::i32, builder.makeConst(wasm::Literal(ptr)),
+                                                 wasm::Builder::Immutable));
+        }
+        literals.insert(literals.end(), fv->local_consts.begin(), fv->local_consts.end());
+    });
+
+    if (globalFlags & function_visitor::GEN_SIMD) {
+        GLAM_COMPILER_TRACE("uses simd");
+        BinaryenModuleSetFeatures(module, BinaryenModuleGetFeatures(module) | BinaryenFeatureSIMD128());
+    }
+
+    if (globalFlags & function_visitor::USES_MULTI_VALUE) {
+        GLAM_COMPILER_TRACE("uses multi-value");
+        BinaryenModuleSetFeatures(module, BinaryenModuleGetFeatures(module) | BinaryenFeatureMultivalue());
+    }
+
     auto result = BinaryenModuleAllocateAndWrite(module, nullptr);
     compiled_fxn<T> fxn(entry_point, fxn_name, parameter_name, result.binary, result.binaryBytes, totalArenaSize);
+    if constexpr (std::is_same<T, mp_complex>()) {
+        fxn.hold_consts(literals);
+    }
+    auto features = BinaryenModuleGetFeatures(module);
     BinaryenModuleDispose(module);
 
     std::for_each(children.begin(), children.end(), [&](function_visitor *fv) {
         delete fv;
     });
 
-    fxn.install(result.binary, result.binaryBytes);
+    const bool async = static_cast<bool>(installed);
+    auto entry = compile_cache::insert(cache_key, static_cast<char *>(result.binary), result.binaryBytes, totalArenaSize, features,
+                                       async);
+    uint32_t module_id = entry ? entry->id : compile_cache::compile_uncached(static_cast<char *>(result.binary), result.binaryBytes,
+                                                                             async);
+    if (entry) {
+        entry->literals = std::move(literals); // for the fxns that reuse the module
+    }
+    if (async) {
+        fxn.install_async(module_id, result.binary, result.binaryBytes, features, optimize_level, entry ? entry->id : 0, installed);
+    } else {
+        fxn.install(module_id, result.binary, result.binaryBytes);
+        if (!entry) {
+            compile_cache::forget(module_id);
+        }
+        if (optimize_level) {
+            fxn.schedule_tier_up(result.binary, result.binaryBytes, features, optimize_level, entry ? entry->id : 0);
+        }
+    }
     free(result.binary);
 
     GLAM_COMPILER_TRACE("compilation complete");
@@ -130,6 +556,127 @@ void function_visitor::visit_entry_point() {
     parent->entry_point = func->name.str;
 }
 
+void function_visitor::visit_simd() {
+    GLAM_COMPILER_TRACE("visit_simd");
+    flags |= GEN_SIMD;
+}
+
+void function_visitor::visit_inline_math() {
+    GLAM_COMPILER_TRACE("visit_inline_math");
+    flags |= GEN_INLINE_MATH;
+}
+
+void function_visitor::visit_multi_value() {
+    GLAM_COMPILER_TRACE("visit_multi_value");
+    flags |= GEN_MULTI_VALUE | USES_MULTI_VALUE | GEN_INLINE_MATH;
+}
+
+void function_visitor::visit_dual() {
+    GLAM_COMPILER_TRACE("visit_dual");
+    flags |= GEN_DUAL | USES_MULTI_VALUE;
+}
+
+void function_visitor::visit_pair() {
+    GLAM_COMPILER_TRACE("visit_pair");
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        // f' is on top, so it has to be set aside while f is unpacked
+        visit_unpack_v128();
+        wasm::Index re = wasm::Builder::addVar(func, wasm::Type::f64);
+        wasm::Index im = wasm::Builder::addVar(func, wasm::Type::f64);
+        visit_local_set(im);
+        visit_local_set(re);
+        visit_unpack_v128();
+        visit_local_get(re, wasm::Type::f64);
+        visit_local_get(im, wasm::Type::f64);
+    }
+}
+
+void function_visitor::visit_mp() {
+    GLAM_COMPILER_TRACE("visit_mp");
+    flags |= GEN_MP;
+}
+
+void function_visitor::visit_local_get(wasm::Index index, wasm::Type type) {
+    auto localGet = parent->module->allocator.alloc<wasm::LocalGet>();
+    localGet->index = index;
+    localGet->type = type;
+    visit_basic(localGet);
+}
+
+void function_visitor::visit_local_set(wasm::Index index) {
+    auto localSet = parent->module->allocator.alloc<wasm::LocalSet>();
+    localSet->index = index;
+    visit_basic(localSet);
+}
+
+void function_visitor::visit_local_tee(wasm::Index index, wasm::Type type) {
+    auto localTee = parent->module->allocator.alloc<wasm::LocalSet>();
+    localTee->index = index;
+    localTee->type = type;
+    visit_basic(localTee);
+}
+
+void function_visitor::visit_pack_v128() {
+    // (re, im) -> v128. there is no two-operand constructor, so we splat the real part and replace lane 1.
+    wasm::Index im = wasm::Builder::addVar(func, wasm::Type::f64);
+    visit_local_set(im);
+
+    auto splat = parent->module->allocator.alloc<wasm::Unary>();
+    splat->op = wasm::SplatVecF64x2;
+    splat->type = wasm::Type::v128;
+    visit_basic(splat);
+
+    visit_local_get(im, wasm::Type::f64);
+
+    auto replace = parent->module->allocator.alloc<wasm::SIMDReplace>();
+    replace->op = wasm::ReplaceLaneVecF64x2;
+    replace->index = 1;
+    replace->type = wasm::Type::v128;
+    visit_basic(replace);
+}
+
+void function_visitor::visit_unpack_v128() {
+    // v128 -> (re, im), used at the boundary with morphemes and other fxns, which all take scalar arguments
+    wasm::Index v = wasm::Builder::addVar(func, wasm::Type::v128);
+    visit_local_tee(v, wasm::Type::v128);
+
+    auto extractRe = parent->module->allocator.alloc<wasm::SIMDExtract>();
+    extractRe->op = wasm::ExtractLaneVecF64x2;
+    extractRe->index = 0;
+    extractRe->type = wasm::Type::f64;
+    visit_basic(extractRe);
+
+    visit_local_get(v, wasm::Type::v128);
+
+    auto extractIm = parent->module->allocator.alloc<wasm::SIMDExtract>();
+    extractIm->op = wasm::ExtractLaneVecF64x2;
+    extractIm->index = 1;
+    extractIm->type = wasm::Type::f64;
+    visit_basic(extractIm);
+}
+
+void function_visitor::visit_swizzle_f64x2(wasm::Index index, uint8_t lane0, uint8_t lane1) {
+    // pushes the v128 in local `index` with its f64 lanes rearranged, e.g. (1, 0) swaps the real and imaginary parts
+    visit_local_get(index, wasm::Type::v128);
+    visit_local_get(index, wasm::Type::v128);
+
+    auto shuffle = parent->module->allocator.alloc<wasm::SIMDShuffle>();
+    for (uint8_t i = 0; i < 8; i++) {
+        shuffle->mask[i] = lane0 * 8 + i;
+        shuffle->mask[8 + i] = lane1 * 8 + i;
+    }
+    shuffle->type = wasm::Type::v128;
+    visit_basic(shuffle);
+}
+
+void function_visitor::visit_v128_binary(wasm::BinaryOp op) {
+    auto inst = parent->module->allocator.alloc<wasm::Binary>();
+    inst->type = wasm::Type::v128;
+    inst->op = op;
+    visit_basic(inst);
+}
+
 void function_visitor::visit_float(double d) {
     GLAM_COMPILER_TRACE("visit_float " << d);
     auto c = parent->module->allocator.alloc<wasm::Const>();
@@ -139,8 +686,16 @@ void function_visitor::visit_float(double d) {
 }
 
 void function_visitor::visit_complex(std::complex<double> z) {
-    visit_float(z.real());
-    visit_float(z.imag());
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        auto c = parent->module->allocator.alloc<wasm::Const>();
+        c->type = wasm::Type::v128;
+        c->value = wasm::Literal(std::array<wasm::Literal, 2> { wasm::Literal(z.real()), wasm::Literal(z.imag()) });
+        visit_basic(c);
+    } else {
+        visit_float(z.real());
+        visit_float(z.imag());
+    }
 }
 
 void function_visitor::visit_basic(wasm::Expression *inst) {
@@ -153,11 +708,18 @@ void function_visitor::visit_basic(wasm::Expression *inst) {
 }
 
 void function_visitor::visit_complex(const mp_complex &z) {
-    auto ptr = std::find(local_consts.begin(), local_consts.end(), z);
-    if (ptr == local_consts.end()) {
-        local_consts.push_back(z);
+    GLAM_COMPILER_TRACE("visit_complex " << z);
+    auto ptr = globals::intern_mp(z);
+    auto iter = std::find(local_consts.begin(), local_consts.end(), ptr);
+    auto index = iter - local_consts.begin();
+    if (iter == local_consts.end()) {
+        local_consts.push_back(ptr);
     }
-    visit_global_get("_complex_" + std::to_string(ptr - local_consts.begin()));
+    visit_global_get(visit_const_name(index));
+}
+
+std::string function_visitor::visit_const_name(size_t index) {
+    return std::string(func->name.str) + "_complex_" + std::to_string(index);
 }
 
 template <typename T> void function_visitor::visit_ptr(T *ptr) {
@@ -171,11 +733,12 @@ void function_visitor::visit_global_get(const std::string &name) {
     auto globalGet = parent->module->allocator.alloc<wasm::GlobalGet>();
     globalGet->type = wasm::Type::i32;
     globalGet->name = name;
+    visit_basic(globalGet);
 }
 
 void function_visitor::visit_mpcx2(morpheme_mpcx2 *morph) {
     GLAM_COMPILER_TRACE("visit_mpcx2");
-    arena_size += 2;
+    arena_size++;
     flags |= USES_MPCx2;
     auto globalGet = parent->module->allocator.alloc<wasm::GlobalGet>();
     globalGet->type = wasm::Type::i32;
@@ -224,7 +787,8 @@ bool function_visitor::visit_variable_mp(const std::string &name) {
         if (ptr == globals::consts_mp.end()) {
             return false;
         } else {
-            visit_ptr(ptr->second);
+            // rounded to the precision being compiled for, so the fxn doesn't compute with more digits than it has to
+            visit_complex(mp_complex(*ptr->second, mp_precision::get()));
             return true;
         }
     }
@@ -269,7 +833,8 @@ void function_visitor::visit_binary_splat(wasm::BinaryOp op) {
 void function_visitor::visit_add() {
     GLAM_COMPILER_TRACE("visit_add (dp)");
     if (flags & GEN_SIMD) {
-
+        visit_unwrap();
+        visit_v128_binary(wasm::AddVecF64x2);
     } else {
         visit_unwrap();
         visit_binary_splat(wasm::AddFloat64);
@@ -279,7 +844,8 @@ void function_visitor::visit_add() {
 void function_visitor::visit_sub() {
     GLAM_COMPILER_TRACE("visit_sub (dp)");
     if (flags & GEN_SIMD) {
-
+        visit_unwrap();
+        visit_v128_binary(wasm::SubVecF64x2);
     } else {
         visit_unwrap();
         visit_binary_splat(wasm::SubFloat64);
@@ -289,7 +855,24 @@ void function_visitor::visit_sub() {
 void function_visitor::visit_mul() {
     GLAM_COMPILER_TRACE("visit_mul (dp)");
     if (flags & GEN_SIMD) {
-
+        // (a, b) * (c, d) = (a, b) * (c, c) + (b, a) * (d, d) * (-1, 1)
+        visit_unwrap();
+        wasm::Index y = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(y);
+        wasm::Index x = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(x);
+
+        visit_local_get(x, wasm::Type::v128);
+        visit_swizzle_f64x2(y, 0, 0);
+        visit_v128_binary(wasm::MulVecF64x2);
+
+        visit_swizzle_f64x2(x, 1, 0);
+        visit_swizzle_f64x2(y, 1, 1);
+        visit_v128_binary(wasm::MulVecF64x2);
+        visit_complex(std::complex<double>(-1., 1.));
+        visit_v128_binary(wasm::MulVecF64x2);
+
+        visit_v128_binary(wasm::AddVecF64x2);
     } else {
         visit_unwrap();
         wasm::Index i = visit_binary();
@@ -342,17 +925,150 @@ void function_visitor::visit_mul() {
 
 void function_visitor::visit_div() {
     GLAM_COMPILER_TRACE("visit_div (dp)");
-    if (flags & GEN_SIMD) {
-
+    if ((flags & GEN_INLINE_MATH) && !(flags & GEN_SIMD)) {
+        visit_inline_f64x4(&inline_math<wasm_math_ops>::cdiv);
+    } else if (flags & GEN_SIMD) {
+        // (a, b) / (c, d) = s * (a, b) * conj(s * (c, d)) / |s * (c, d)|^2, where s = 2^-k brings max(|c|, |d|) to
+        // [1, 2) so that the square neither overflows nor underflows. k is clamped to [-1000, 1000], which keeps s
+        // normal and is still enough to keep the square in range.
+        visit_unwrap();
+        wasm::Index y = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(y);
+        wasm::Index x = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(x);
+
+        // m = max(|c|, |d|) in both lanes, clamped to [2^-1000, 2^1000]
+        visit_local_get(y, wasm::Type::v128);
+        auto abs = parent->module->allocator.alloc<wasm::Unary>();
+        abs->op = wasm::AbsVecF64x2;
+        abs->type = wasm::Type::v128;
+        visit_basic(abs);
+        wasm::Index s = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(s);
+        visit_local_get(s, wasm::Type::v128);
+        visit_swizzle_f64x2(s, 1, 0);
+        visit_v128_binary(wasm::MaxVecF64x2);
+        visit_complex(std::complex<double>(0x1p-1000, 0x1p-1000));
+        visit_v128_binary(wasm::MaxVecF64x2);
+        visit_complex(std::complex<double>(0x1p1000, 0x1p1000));
+        visit_v128_binary(wasm::MinVecF64x2);
+
+        // s = 2^-k has biased exponent 2046 - (k + 1023), so its bits are those of 2^1023 less the exponent bits of m
+        const double inf = std::numeric_limits<double>::infinity(); // all exponent bits set
+        visit_complex(std::complex<double>(inf, inf));
+        visit_v128_binary(wasm::AndVec128);
+        visit_local_set(s);
+        visit_complex(std::complex<double>(0x1p1023, 0x1p1023));
+        visit_local_get(s, wasm::Type::v128);
+        visit_v128_binary(wasm::SubVecI64x2);
+        visit_local_set(s);
+
+        visit_local_get(y, wasm::Type::v128);
+        visit_local_get(s, wasm::Type::v128);
+        visit_v128_binary(wasm::MulVecF64x2);
+        visit_local_set(y);
+
+        visit_local_get(x, wasm::Type::v128);
+        visit_swizzle_f64x2(y, 0, 0);
+        visit_v128_binary(wasm::MulVecF64x2);
+
+        visit_swizzle_f64x2(x, 1, 0);
+        visit_swizzle_f64x2(y, 1, 1);
+        visit_v128_binary(wasm::MulVecF64x2);
+        visit_complex(std::complex<double>(1., -1.));
+        visit_v128_binary(wasm::MulVecF64x2);
+
+        visit_v128_binary(wasm::AddVecF64x2);
+
+        // splat |y|^2 into both lanes
+        visit_local_get(y, wasm::Type::v128);
+        visit_local_get(y, wasm::Type::v128);
+        visit_v128_binary(wasm::MulVecF64x2);
+        wasm::Index norm = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(norm);
+        visit_local_get(norm, wasm::Type::v128);
+        visit_swizzle_f64x2(norm, 1, 0);
+        visit_v128_binary(wasm::AddVecF64x2);
+
+        visit_v128_binary(wasm::DivVecF64x2);
+        visit_local_get(s, wasm::Type::v128);
+        visit_v128_binary(wasm::MulVecF64x2);
     } else {
         // we use a morpheme here because division is hard
         visit_f64x4(&_fmorpheme_div);
     }
 }
 
+void function_visitor::visit_neg() {
+    GLAM_COMPILER_TRACE("visit_neg (dp)");
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        auto neg = parent->module->allocator.alloc<wasm::Unary>();
+        neg->op = wasm::NegVecF64x2;
+        neg->type = wasm::Type::v128;
+        visit_basic(neg);
+    } else {
+        auto negIm = parent->module->allocator.alloc<wasm::Unary>();
+        negIm->op = wasm::NegFloat64;
+        negIm->type = wasm::Type::f64;
+        visit_basic(negIm);
+        wasm::Index im = wasm::Builder::addVar(func, wasm::Type::f64);
+        visit_local_set(im);
+
+        auto negRe = parent->module->allocator.alloc<wasm::Unary>();
+        negRe->op = wasm::NegFloat64;
+        negRe->type = wasm::Type::f64;
+        visit_basic(negRe);
+        visit_local_get(im, wasm::Type::f64);
+    }
+}
+
+void function_visitor::visit_temporary_tee(uint32_t temporary) {
+    GLAM_COMPILER_TRACE("visit_temporary_tee " << temporary);
+    visit_unwrap();
+    if (flags & GEN_MP) {
+        if (!temporaries.count(temporary)) {
+            temporaries[temporary] = wasm::Builder::addVar(func, wasm::Type::i32);
+        }
+        visit_local_tee(temporaries[temporary], wasm::Type::i32);
+    } else if (flags & GEN_SIMD) {
+        if (!temporaries.count(temporary)) {
+            temporaries[temporary] = wasm::Builder::addVar(func, wasm::Type::v128);
+        }
+        visit_local_tee(temporaries[temporary], wasm::Type::v128);
+    } else {
+        if (!temporaries.count(temporary)) {
+            temporaries[temporary] = wasm::Builder::addVar(func, wasm::Type::f64);
+            wasm::Builder::addVar(func, wasm::Type::f64);
+        }
+        wasm::Index re = temporaries[temporary];
+        visit_local_set(re + 1);
+        visit_local_tee(re, wasm::Type::f64);
+        visit_local_get(re + 1, wasm::Type::f64);
+    }
+}
+
+void function_visitor::visit_temporary_get(uint32_t temporary) {
+    GLAM_COMPILER_TRACE("visit_temporary_get " << temporary);
+    visit_unwrap();
+    assert(temporaries.count(temporary));
+    wasm::Index index = temporaries[temporary];
+    if (flags & GEN_MP) {
+        visit_local_get(index, wasm::Type::i32);
+    } else if (flags & GEN_SIMD) {
+        visit_local_get(index, wasm::Type::v128);
+    } else {
+        visit_local_get(index, wasm::Type::f64);
+        visit_local_get(index + 1, wasm::Type::f64);
+    }
+}
+
 void function_visitor::visit_f64x2(morpheme_f64x2 *morph) {
     GLAM_COMPILER_TRACE("visit_f64x2");
     visit_unwrap();
+    if (flags & GEN_SIMD) {
+        visit_unpack_v128();
+    }
     arena_size++;
     flags |= USES_F64x2;
 
@@ -397,7 +1113,19 @@ wasm::Index function_visitor::visit_binary() {
 }
 
 void function_visitor::visit_unwrap() {
-    if (needs_unwrap) {
+    if (needs_unwrap && (flags & GEN_SIMD)) {
+        GLAM_COMPILER_TRACE("visit_unwrap (simd)");
+        this->flags |= USES_UNWRAP;
+
+        // std::complex<double> is laid out as (re, im), which is exactly an f64x2
+        auto load = parent->module->allocator.alloc<wasm::Load>();
+        load->type = wasm::Type::v128;
+        load->offset = 0;
+        load->bytes = 16;
+        load->isAtomic = false;
+        visit_basic(load);
+        needs_unwrap = false;
+    } else if (needs_unwrap) {
         GLAM_COMPILER_TRACE("visit_unwrap");
         this->flags |= USES_UNWRAP;
         visit_dupi32();
@@ -431,6 +1159,13 @@ void function_visitor::visit_unwrap() {
 void function_visitor::visit_f64x4(morpheme_f64x4 *morph) {
     GLAM_COMPILER_TRACE("visit_f64x4");
     visit_unwrap();
+    if (flags & GEN_SIMD) {
+        wasm::Index y = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(y);
+        visit_unpack_v128();
+        visit_local_get(y, wasm::Type::v128);
+        visit_unpack_v128();
+    }
     arena_size++;
     flags |= USES_F64x4;
 
@@ -451,30 +1186,112 @@ void function_visitor::visit_f64x4(morpheme_f64x4 *morph) {
     needs_unwrap = true;
 }
 
+void function_visitor::visit_inline_f64x2(inline_f64x2 fn) {
+    GLAM_COMPILER_TRACE("visit_inline_f64x2");
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        visit_unpack_v128();
+    }
+    wasm_math_ops ops(this);
+    wasm_math_ops::value b = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(b.index);
+    wasm_math_ops::value a = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(a.index);
+
+    inline_math<wasm_math_ops> math(ops);
+    auto result = (math.*fn)(a, b);
+    ops.visit_value(result.first);
+    ops.visit_value(result.second);
+    if (flags & GEN_SIMD) {
+        visit_pack_v128();
+    }
+}
+
+void function_visitor::visit_inline_f64x4(inline_f64x4 fn) {
+    GLAM_COMPILER_TRACE("visit_inline_f64x4");
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        wasm::Index y = wasm::Builder::addVar(func, wasm::Type::v128);
+        visit_local_set(y);
+        visit_unpack_v128();
+        visit_local_get(y, wasm::Type::v128);
+        visit_unpack_v128();
+    }
+    wasm_math_ops ops(this);
+    wasm_math_ops::value d = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(d.index);
+    wasm_math_ops::value c = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(c.index);
+    wasm_math_ops::value b = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(b.index);
+    wasm_math_ops::value a = { false, 0., wasm::Builder::addVar(func, wasm::Type::f64) };
+    visit_local_set(a.index);
+
+    inline_math<wasm_math_ops> math(ops);
+    auto result = (math.*fn)(a, b, c, d);
+    ops.visit_value(result.first);
+    ops.visit_value(result.second);
+    if (flags & GEN_SIMD) {
+        visit_pack_v128();
+    }
+}
+
 void function_visitor::visit_fxncall(const std::string &name) {
     uintptr_t ptr = globals::fxn_table[name];
     assert(ptr); // should never fail, the parser checks first
     GLAM_COMPILER_TRACE("visit_fxncall " << name << " @ " << ptr);
+    visit_unwrap();
+    if (flags & GEN_SIMD) {
+        visit_unpack_v128();
+    }
 
     auto c = parent->module->allocator.alloc<wasm::Const>();
     c->type = wasm::Type::i32;
     c->value = wasm::Literal(static_cast<uint32_t>(ptr));
     visit_basic(c);
 
-    // todo for now we assume that it's also a double-precision fxn, i.e. it is (f64, f64)->i32
     auto callIndirect = parent->module->allocator.alloc<wasm::CallIndirect>();
     callIndirect->isReturn = false;
-    callIndirect->sig = wasm::Signature({ wasm::Type::f64, wasm::Type::f64 }, wasm::Type::i32);
     callIndirect->table = "table";
-    callIndirect->type = wasm::Type::i32;
-    visit_basic(callIndirect);
-    needs_unwrap = true;
+    if (flags & GEN_MP) {
+        // the callee's result lives in its own arena, which doesn't get reset between calls, so it would be
+        // overwritten once the callee has been called often enough. copy it into ours before that can happen.
+        callIndirect->sig = wasm::Signature(wasm::Type::i32, wasm::Type::i32);
+        callIndirect->type = wasm::Type::i32;
+        visit_basic(callIndirect);
+        visit_mpcx1(&_morpheme_copy);
+    } else if (globals::multi_value_fxns.count(name)) {
+        flags |= USES_MULTI_VALUE;
+        callIndirect->sig = wasm::Signature({ wasm::Type::f64, wasm::Type::f64 }, { wasm::Type::f64, wasm::Type::f64 });
+        callIndirect->type = callIndirect->sig.results;
+        visit_basic(callIndirect);
+        if (flags & GEN_SIMD) {
+            visit_pack_v128();
+        }
+    } else {
+        callIndirect->sig = wasm::Signature({ wasm::Type::f64, wasm::Type::f64 }, wasm::Type::i32);
+        callIndirect->type = wasm::Type::i32;
+        visit_basic(callIndirect);
+        needs_unwrap = true;
+    }
 }
 
 bool function_visitor::visit_variable_dp(const std::string &name) {
     GLAM_COMPILER_TRACE("visit_variable_dp " << name);
     visit_unwrap();
-    if (name == parent->parameter_name) {
+    if (name == parent->parameter_name && (flags & GEN_SIMD)) {
+        // the code is straight-line, so the first use always runs before the others
+        if (simd_parameter) {
+            visit_local_get(simd_parameter, wasm::Type::v128);
+        } else {
+            visit_local_get(0, wasm::Type::f64);
+            visit_local_get(1, wasm::Type::f64);
+            visit_pack_v128();
+            simd_parameter = wasm::Builder::addVar(func, wasm::Type::v128);
+            visit_local_tee(simd_parameter, wasm::Type::v128);
+        }
+        return true;
+    } else if (name == parent->parameter_name) {
         auto localGet = parent->module->allocator.alloc<wasm::LocalGet>();
         localGet->type = wasm::Type::f64;
         localGet->index = 0;
@@ -526,10 +1343,18 @@ function_visitor::~function_visitor() noexcept {
 
 std::string function_visitor::visit_end() {
     GLAM_COMPILER_TRACE("visit_end function");
-    if (!needs_unwrap) {
+    if (flags & (GEN_MP | GEN_DUAL)) {
+        // the stack already holds the result: a pointer, or what visit_pair left
+    } else if (flags & GEN_MULTI_VALUE) {
+        // leave (re, im) on the stack as the return values
+        visit_unwrap();
+        if (flags & GEN_SIMD) {
+            visit_unpack_v128();
+        }
+    } else if (!needs_unwrap) {
         // now we actually need to wrap
         GLAM_COMPILER_TRACE("wrapping complex");
-        visit_f64x2(&_fmorpheme_wrap);
+        visit_f64x2(&_fmorpheme_wrap); // unpacks the v128 first if we are generating simd
     }
 
     auto ret = parent->module->allocator.alloc<wasm::Return>();
@@ -545,6 +1370,13 @@ std::map<std::string, morpheme_f64x2 *> math_compiler_dp::unary_morphemes = { st
 
 std::map<std::string, morpheme_f64x4 *> math_compiler_dp::binary_morphemes = { std::make_pair("^", &_fmorpheme_exp) };
 
+std::map<std::string, inline_f64x2> math_compiler_dp::unary_inlines = { std::make_pair("sin", &inline_math<wasm_math_ops>::csin),
+        std::make_pair("cos", &inline_math<wasm_math_ops>::ccos), std::make_pair("tan", &inline_math<wasm_math_ops>::ctan),
+        std::make_pair("sinh", &inline_math<wasm_math_ops>::csinh), std::make_pair("cosh", &inline_math<wasm_math_ops>::ccosh),
+        std::make_pair("tanh", &inline_math<wasm_math_ops>::ctanh) };
+
+std::map<std::string, inline_f64x4> math_compiler_dp::binary_inlines = { std::make_pair("^", &inline_math<wasm_math_ops>::cpow) };
+
 void math_compiler_dp::visit_operator(function_visitor *fv, const std::string &op) {
     GLAM_COMPILER_TRACE("compiling operator " << op);
     if (op == "+") {
@@ -559,7 +1391,26 @@ void math_compiler_dp::visit_operator(function_visitor *fv, const std::string &o
     } else if (op == "/") {
         fv->visit_div();
         return;
-    } else {
+    } else if (op == expr_dag::neg_operator) {
+        fv->visit_neg();
+        return;
+    } else if (op == expr_dag::pair_operator) {
+        fv->visit_pair();
+        return;
+    } else if (options & (OPT_INLINE_MATH | OPT_MULTI_VALUE)) {
+        auto iter1 = unary_inlines.find(op);
+        if (iter1 != unary_inlines.end()) {
+            fv->visit_inline_f64x2(iter1->second);
+            return;
+        }
+        auto iter2 = binary_inlines.find(op);
+        if (iter2 != binary_inlines.end()) {
+            fv->visit_inline_f64x4(iter2->second);
+            return;
+        }
+    }
+
+    {
         auto iter1 = unary_morphemes.find(op);
         if (iter1 != unary_morphemes.end()) {
             fv->visit_f64x2(*iter1->second);
@@ -576,35 +1427,395 @@ void math_compiler_dp::visit_operator(function_visitor *fv, const std::string &o
     abort();
 }
 
-fxn<std::complex<double>, compiled_fxn<std::complex<double>>> math_compiler_dp::compile(const emscripten::val &stack) {
-    module_visitor mv(fxn_name, parameter_name);
-    mv.visit_module();
-    auto fv = mv.visit_function(name, wasm::Signature({ wasm::Type::f64, wasm::Type::f64 }, wasm::Type::i32));
+void math_compiler_dp::set_option(compiler_option option, bool enabled) {
+    if (enabled) {
+        options |= option;
+    } else {
+        options &= ~option;
+    }
+}
+
+bool math_compiler_dp::get_option(compiler_option option) {
+    return options & option;
+}
+
+void math_compiler_dp::set_optimize_level(uint32_t level) {
+    optimize_level = level;
+}
+
+uint32_t math_compiler_dp::get_optimize_level() {
+    return optimize_level;
+}
+
+std::string math_compiler_dp::cache_key(const token_stack &tokens) {
+    // anything that doesn't change the generated code is left out, e.g. the names of the fxn and its parameter
+    std::ostringstream key;
+    key << std::hexfloat << options;
+    for (const auto &token : tokens) {
+        key << '\n' << token.type << ' ';
+        switch (token.type) {
+            case TOKEN_NUMBER: {
+                auto z = mp_complex(token.value).convert_to<std::complex<double>>();
+                key << z.real() << ' ' << z.imag();
+                break;
+            }
+            case TOKEN_IDENTIFIER: {
+                auto z = globals::consts_dp.find(token.value);
+                if (token.value == parameter_name) {
+                    key << '$';
+                } else if (z != globals::consts_dp.end()) {
+                    key << z->second.real() << ' ' << z->second.imag();
+                } else {
+                    key << token.value;
+                }
+                break;
+            }
+            case TOKEN_FXNCALL: {
+                // the callee is called through its table slot, with a signature that depends on its ABI
+                auto slot = globals::fxn_table.find(token.value);
+                key << (slot == globals::fxn_table.end() ? 0 : slot->second) << (globals::multi_value_fxns.count(token.value) ? " mv" : "");
+                break;
+            }
+            default:
+                key << token.value;
+        }
+    }
+    return key.str();
+}
+
+static token_stack read_stack(const emscripten::val &stack) {
+    token_stack tokens;
     const auto len = stack["length"].as<size_t>();
-    assert(len > 0);
     for (size_t i = 0; i < len; i++) {
         emscripten::val stackObj = stack[i];
-        auto type = stackObj["type"].as<int32_t>();
-        auto value = stackObj["value"].as<std::string>();
-        switch (type) {
-            case 0: // NUMBER
+        tokens.push_back({ static_cast<stack_token_type>(stackObj["type"].as<int32_t>()), stackObj["value"].as<std::string>() });
+    }
+    return tokens;
+}
+
+fxn<std::complex<double>, compiled_fxn<std::complex<double>>> math_compiler_dp::compile(const emscripten::val &stack) {
+    return compile(read_stack(stack), nullptr);
+}
+
+fxn<std::complex<double>, compiled_fxn<std::complex<double>>> math_compiler_dp::compile(const token_stack &input) {
+    return compile(input, nullptr);
+}
+
+void math_compiler_dp::compile_async(const emscripten::val &stack, emscripten::val callback) {
+    // the fxn returned here isn't ready() yet, and the callback gets its own copy
+    compile(read_stack(stack), [callback](compiled_fxn<std::complex<double>> f) {
+        callback(static_cast<fxn<std::complex<double>, compiled_fxn<std::complex<double>>>>(f));
+    });
+}
+
+fxn<std::complex<double>, compiled_fxn<std::complex<double>>> math_compiler_dp::compile(const token_stack &input,
+        const compiled_fxn<std::complex<double>>::install_callback &installed) {
+    auto start = std::chrono::steady_clock::now();
+    token_stack tokens = input;
+    bool dual = false;
+    if (options & (OPT_FOLD | OPT_CSE | OPT_INLINE_CALLS | OPT_DERIVATIVE)) {
+        expr_dag dag(parameter_name, globals::consts_dp);
+        if (options & OPT_INLINE_CALLS) {
+            dag.set_definitions(&globals::definitions);
+        }
+        if (dag.parse(input)) {
+            if (options & OPT_FOLD) {
+                stack_optimizer::fold(dag);
+            }
+            if (options & OPT_DERIVATIVE) {
+                dual = expr_derivative(dag, parameter_name).pair_with_derivative();
+                if (!dual) {
+                    GLAM_COMPILER_TRACE("can't differentiate " << name << ", compiling it without a derivative");
+                } else if (options & OPT_FOLD) {
+                    stack_optimizer::fold(dag); // the derivative is built naively, e.g. with lots of multiplications by 1
+                }
+            }
+            dag.prune();
+            tokens = dag.emit(options & OPT_CSE);
+            GLAM_COMPILER_TRACE("dag: " << input.size() << " -> " << tokens.size() << " tokens");
+        } else {
+            GLAM_COMPILER_TRACE("couldn't parse stack, compiling it as is");
+        }
+    }
+    std::shared_ptr<const vm_program> program;
+    if (options & OPT_ENCLOSURE) {
+        // from the original stack, since the vm has its own dag pipeline, and before define(), in case the fxn calls
+        // its own previous definition
+        program = bytecode_compiler(name, fxn_name, parameter_name).compile_program(input);
+    }
+    globals::define(fxn_name, parameter_name, input);
+    auto record_latency = [&]() {
+        tier_stats stats;
+        stats.baseline_compile_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        globals::tiers[fxn_name] = stats;
+    };
+
+    // the fxn handed to the callback is a copy made once it's installed, so it needs the program by then
+    compiled_fxn<std::complex<double>>::install_callback on_installed;
+    if (installed) {
+        on_installed = [done = installed, program](compiled_fxn<std::complex<double>> fxn) {
+            fxn.set_program(program);
+            done(fxn);
+        };
+    }
+
+    auto key = cache_key(tokens) + (dual ? "\ndual" : "");
+    auto entry = compile_cache::lookup(key);
+    if (entry) {
+        GLAM_COMPILER_TRACE("cache hit for " << name << ", reusing module " << entry->id);
+        compiled_fxn<std::complex<double>> fxn(name, fxn_name, parameter_name, entry->binary.data(), entry->binary.size(),
+                                               entry->arena_size);
+        fxn.set_program(program);
+        if (on_installed) {
+            fxn.install_async(entry->id, entry->binary.data(), entry->binary.size(), entry->features,
+                              entry->optimized ? 0 : optimize_level, entry->id, on_installed);
+        } else {
+            fxn.install(entry->id, entry->binary.data(), entry->binary.size());
+            if (optimize_level && !entry->optimized) {
+                fxn.schedule_tier_up(entry->binary.data(), entry->binary.size(), entry->features, optimize_level, entry->id);
+            }
+        }
+        record_latency();
+        return fxn;
+    }
+
+    module_visitor mv(fxn_name, parameter_name);
+    mv.visit_module();
+    const bool multi_value = dual || (options & OPT_MULTI_VALUE);
+    wasm::Type results = wasm::Type::i32;
+    if (dual) {
+        results = wasm::Type({ wasm::Type::f64, wasm::Type::f64, wasm::Type::f64, wasm::Type::f64 });
+    } else if (multi_value) {
+        results = wasm::Type({ wasm::Type::f64, wasm::Type::f64 });
+    }
+    auto fv = mv.visit_function(name, wasm::Signature({ wasm::Type::f64, wasm::Type::f64 }, results));
+    if (options & OPT_SIMD) {
+        fv->visit_simd();
+    }
+    if (options & OPT_INLINE_MATH) {
+        fv->visit_inline_math();
+    }
+    if (dual) {
+        fv->visit_dual();
+    } else if (multi_value) {
+        fv->visit_multi_value();
+    }
+    assert(!tokens.empty());
+    for (const auto &token : tokens) {
+        const auto &value = token.value;
+        switch (token.type) {
+            case TOKEN_NUMBER:
                 // we take advantage of boost's parsing even if we don't want a multiprecision complex number
                 fv->visit_complex(mp_complex(value).convert_to<std::complex<double>>());
                 break;
-            case 1: // IDENTIFIER
+            case TOKEN_IDENTIFIER:
                 if (!fv->visit_variable_dp(value)) {
                     mv.abort();
                     abort();
                 }
                 break;
-            case 2: // OPERATOR
+            case TOKEN_OPERATOR:
                 visit_operator(fv, value);
                 break;
-            case 3: // FXNCALL
+            case TOKEN_FXNCALL:
+                fv->visit_fxncall(value);
+                break;
+            case TOKEN_COMPLEX:
+                fv->visit_complex(expr_dag::parse_complex(value));
+                break;
+            case TOKEN_TEE:
+                fv->visit_temporary_tee(std::stoul(value));
+                break;
+            case TOKEN_GET:
+                fv->visit_temporary_get(std::stoul(value));
+                break;
+            default:
+                GLAM_COMPILER_TRACE("unrecognized stack object " << token.type);
+                mv.abort();
+                abort();
+        }
+    }
+
+    fv->visit_entry_point();
+    auto f_name = fv->visit_end();
+    if (dual) {
+        f_name = mv.visit_dual(f_name);
+    }
+    mv.visit_export(f_name, "_entry"); // not `name`, so the module can be shared by fxns with the same definition
+    mv.visit_batch(f_name, multi_value);
+    if (multi_value) {
+        mv.visit_store(f_name);
+    }
+    auto fxn = mv.visit_end<std::complex<double>>(optimize_level, key, on_installed);
+    fxn.set_program(program);
+    record_latency();
+    return fxn;
+}
+
+std::map<std::string, morpheme_mpcx1 *> math_compiler_mp::unary_morphemes = { std::make_pair("sin", &_morpheme_sin),
+        std::make_pair("cos", &_morpheme_cos), std::make_pair("tan", &_morpheme_tan), std::make_pair("sinh", &_morpheme_sinh),
+        std::make_pair("cosh", &_morpheme_cosh), std::make_pair("tanh", &_morpheme_tanh) };
+
+std::map<std::string, morpheme_mpcx2 *> math_compiler_mp::binary_morphemes = { std::make_pair("+", &_morpheme_add),
+        std::make_pair("-", &_morpheme_sub), std::make_pair("*", &_morpheme_mul), std::make_pair("/", &_morpheme_div),
+        std::make_pair("^", &_morpheme_exp) };
+
+void math_compiler_mp::set_optimize_level(uint32_t level) {
+    optimize_level = level;
+}
+
+uint32_t math_compiler_mp::get_optimize_level() {
+    return optimize_level;
+}
+
+void math_compiler_mp::set_precision(uint32_t _digits) {
+    digits = std::clamp(_digits, mp_precision::min_digits, mp_precision::max_digits);
+}
+
+uint32_t math_compiler_mp::get_precision() {
+    return digits;
+}
+
+std::string math_compiler_mp::cache_key(const token_stack &tokens) {
+    // numbers are kept as written, since they are parsed at full precision, but their constants are only as precise as
+    // the module they were compiled for
+    std::ostringstream key;
+    key << "mp" << digits;
+    for (const auto &token : tokens) {
+        key << '\n' << token.type << ' ';
+        switch (token.type) {
+            case TOKEN_IDENTIFIER: {
+                auto z = globals::consts_mp.find(token.value);
+                if (token.value == parameter_name) {
+                    key << '$';
+                } else if (z != globals::consts_mp.end()) {
+                    key << z->second;
+                } else {
+                    key << token.value;
+                }
+                break;
+            }
+            case TOKEN_FXNCALL: {
+                auto slot = globals::fxn_table.find(token.value);
+                key << (slot == globals::fxn_table.end() ? 0 : slot->second);
+                break;
+            }
+            default:
+                key << token.value;
+        }
+    }
+    return key.str();
+}
+
+fxn<mp_complex, compiled_fxn<mp_complex>> math_compiler_mp::compile(const emscripten::val &stack) {
+    return compile(read_stack(stack), nullptr);
+}
+
+fxn<mp_complex, compiled_fxn<mp_complex>> math_compiler_mp::compile(const token_stack &input) {
+    return compile(input, nullptr);
+}
+
+void math_compiler_mp::compile_async(const emscripten::val &stack, emscripten::val callback) {
+    compile(read_stack(stack), [callback](compiled_fxn<mp_complex> f) {
+        callback(static_cast<fxn<mp_complex, compiled_fxn<mp_complex>>>(f));
+    });
+}
+
+fxn<mp_complex, compiled_fxn<mp_complex>> math_compiler_mp::compile(const token_stack &input,
+        const compiled_fxn<mp_complex>::install_callback &installed) {
+    auto start = std::chrono::steady_clock::now();
+    mp_precision::scope precision(digits); // for the constants, and the arena
+    token_stack tokens = input;
+    // no consts and exact numbers, so the dag only shares subexpressions and never rounds anything to a double
+    expr_dag dag(parameter_name, { });
+    dag.set_exact_numbers(true);
+    dag.set_definitions(&globals::definitions);
+    if (dag.parse(input)) {
+        dag.prune();
+        tokens = dag.emit();
+        GLAM_COMPILER_TRACE("dag: " << input.size() << " -> " << tokens.size() << " tokens");
+    } else {
+        GLAM_COMPILER_TRACE("couldn't parse stack, compiling it as is");
+    }
+    globals::define(fxn_name, parameter_name, input);
+    auto record_latency = [&]() {
+        tier_stats stats;
+        stats.baseline_compile_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        globals::tiers[fxn_name] = stats;
+    };
+
+    auto key = cache_key(tokens);
+    auto entry = compile_cache::lookup(key);
+    if (entry) {
+        GLAM_COMPILER_TRACE("cache hit for " << name << ", reusing module " << entry->id);
+        compiled_fxn<mp_complex> fxn(name, fxn_name, parameter_name, entry->binary.data(), entry->binary.size(), entry->arena_size);
+        fxn.hold_consts(entry->literals);
+        if (installed) {
+            fxn.install_async(entry->id, entry->binary.data(), entry->binary.size(), entry->features,
+                              entry->optimized ? 0 : optimize_level, entry->id, installed);
+        } else {
+            fxn.install(entry->id, entry->binary.data(), entry->binary.size());
+            if (optimize_level && !entry->optimized) {
+                fxn.schedule_tier_up(entry->binary.data(), entry->binary.size(), entry->features, optimize_level, entry->id);
+            }
+        }
+        record_latency();
+        return fxn;
+    }
+
+    module_visitor mv(fxn_name, parameter_name);
+    mv.visit_module();
+    auto fv = mv.visit_function(name, wasm::Signature(wasm::Type::i32, wasm::Type::i32));
+    fv->visit_mp();
+    assert(!tokens.empty());
+    for (const auto &token : tokens) {
+        const auto &value = token.value;
+        switch (token.type) {
+            case TOKEN_NUMBER:
+                fv->visit_complex(mp_complex(value));
+                break;
+            case TOKEN_COMPLEX: {
+                auto z = expr_dag::parse_complex(value);
+                fv->visit_complex(mp_complex(z.real(), z.imag()));
+                break;
+            }
+            case TOKEN_IDENTIFIER:
+                if (!fv->visit_variable_mp(value)) {
+                    mv.abort();
+                    abort();
+                }
+                break;
+            case TOKEN_OPERATOR: {
+                GLAM_COMPILER_TRACE("compiling operator " << value);
+                auto iter1 = unary_morphemes.find(value);
+                auto iter2 = binary_morphemes.find(value);
+                if (iter1 != unary_morphemes.end()) {
+                    fv->visit_mpcx1(iter1->second);
+                } else if (iter2 != binary_morphemes.end()) {
+                    fv->visit_mpcx2(iter2->second);
+                } else {
+                    GLAM_COMPILER_TRACE("unrecognized operator");
+                    mv.abort();
+                    abort();
+                }
+                break;
+            }
+            case TOKEN_FXNCALL:
+                if (!globals::mp_fxns.count(value)) {
+                    GLAM_COMPILER_TRACE("can't call " << value << ", it isn't a multiprecision fxn");
+                    mv.abort();
+                    abort();
+                }
                 fv->visit_fxncall(value);
                 break;
+            case TOKEN_TEE:
+                fv->visit_temporary_tee(std::stoul(value));
+                break;
+            case TOKEN_GET:
+                fv->visit_temporary_get(std::stoul(value));
+                break;
             default:
-                GLAM_COMPILER_TRACE("unrecognized stack object " << type);
+                GLAM_COMPILER_TRACE("unrecognized stack object " << token.type);
                 mv.abort();
                 abort();
         }
@@ -612,6 +1823,8 @@ fxn<std::complex<double>, compiled_fxn<std::complex<double>>> math_compiler_dp::
 
     fv->visit_entry_point();
     auto f_name = fv->visit_end();
-    mv.visit_export(f_name, name);
-    return mv.visit_end<std::complex<double>>();
+    mv.visit_export(f_name, "_entry");
+    auto fxn = mv.visit_end<mp_complex>(optimize_level, key, installed);
+    record_latency();
+    return fxn;
 }
@@ -24,9 +24,91 @@
 #include "../types.h"
 #include "../morphemes.h"
 #include "../fxn.h"
+#include "inline_math.h"
+#include "stack_token.h"
+#include "stack_optimizer.h"
+#include "expr_derivative.h"
 
 class function_visitor;
 
+/**
+ * Lets inline_math emit wasm. Every value lives in its own f64 local (or is a constant), and every mask in an i32 local,
+ * so each operation is a handful of gets, the instruction and a set.
+ */
+class wasm_math_ops {
+    function_visitor *fv;
+
+public:
+    struct value {
+        bool is_const;
+        double constant;
+        wasm::Index index;
+    };
+    using mask = wasm::Index;
+
+    explicit wasm_math_ops(function_visitor *_fv): fv(_fv) { }
+
+    void visit_value(const value &v);
+
+    value constant(double d);
+
+    value add(value a, value b);
+
+    value sub(value a, value b);
+
+    value mul(value a, value b);
+
+    value div(value a, value b);
+
+    value neg(value a);
+
+    value abs(value a);
+
+    value copysign(value a, value b);
+
+    value floor(value a);
+
+    value nearest(value a);
+
+    value min(value a, value b);
+
+    value max(value a, value b);
+
+    mask lt(value a, value b);
+
+    mask gt(value a, value b);
+
+    mask eq(value a, value b);
+
+    mask land(mask a, mask b);
+
+    mask lor(mask a, mask b);
+
+    value select(mask m, value a, value b);
+
+    value scalbn(value x, value k);
+
+    value exponent(value x);
+
+    value mantissa(value x);
+
+private:
+    value visit_unary(wasm::UnaryOp op, value a);
+
+    value visit_binary(wasm::BinaryOp op, value a, value b);
+
+    mask visit_compare(wasm::BinaryOp op, value a, value b);
+
+    value visit_result();
+};
+
+using inline_f64x2 = inline_math<wasm_math_ops>::complex_pair (inline_math<wasm_math_ops>::*)(wasm_math_ops::value,
+                                                                                              wasm_math_ops::value);
+using inline_f64x4 = inline_math<wasm_math_ops>::complex_pair (inline_math<wasm_math_ops>::*)(wasm_math_ops::value,
+                                                                                              wasm_math_ops::value,
+                                                                                              wasm_math_ops::value,
+                                                                                              wasm_math_ops::value);
+
 class module_visitor {
     friend class function_visitor;
 
@@ -46,34 +128,126 @@ public:
 
     void visit_export(const std::string &inner_name, const std::string &outer_name);
 
-    template <typename T> compiled_fxn<T> visit_end();
+    /**
+     * Adds and exports `_batch`, an (in_ptr, out_ptr, count) kernel that evaluates the given dp function at `count`
+     * std::complex<double> samples starting at in_ptr, and writes the results to out_ptr.
+     * @param inner_name name of a function with signature (f64, f64) -> i32, or (f64, f64) -> (f64, f64) if multi_value
+     * @param multi_value whether the function returns its result directly instead of as an arena pointer
+     */
+    void visit_batch(const std::string &inner_name, bool multi_value);
+
+    /**
+     * Adds and exports `_store`, an (f64, f64, out_ptr) trampoline that calls the given multi-value function and writes
+     * its result to out_ptr. This is how C++ calls a multi-value fxn, since it can't receive more than one return value.
+     * @param inner_name name of a function with signature (f64, f64) -> (f64, f64)
+     */
+    void visit_store(const std::string &inner_name);
+
+    /**
+     * Adds and exports `_dual`, an (in_ptr, out_ptr, count) kernel like `_batch` that writes f and f' for each sample,
+     * interleaved. Also adds a function that only returns f, for everything else.
+     * @param inner_name name of a function with signature (f64, f64) -> (f64, f64, f64, f64), see visit_dual
+     * @return name of the (f64, f64) -> (f64, f64) function returning f
+     */
+    std::string visit_dual(const std::string &inner_name);
+
+    /**
+     * Writes and installs the module.
+     * @param optimize_level if nonzero, an optimized build of the module replaces it once it is ready (see
+     * compiled_fxn::schedule_tier_up)
+     * @param cache_key key to cache the module under in compile_cache
+     * @param installed if set, the module is compiled and installed asynchronously (see compiled_fxn::install_async),
+     * and this is called with the fxn once it's done. the fxn returned right away isn't ready() in that case.
+     */
+    template <typename T> compiled_fxn<T> visit_end(uint32_t optimize_level, const std::string &cache_key,
+                                                    const typename compiled_fxn<T>::install_callback &installed = nullptr);
 
     void abort();
 };
 
 class function_visitor {
     friend class module_visitor;
+    friend class wasm_math_ops;
 
     enum {
         USES_MPCx1 = 1 << 0, USES_MPCx2 = 1 << 1, GEN_SIMD = 1 << 2, USES_F64x2 = 1 << 3, USES_F64x4 = 1 << 4, USES_UNWRAP = 1 << 5,
-        USES_BINARY = 1 << 6, USES_DUPF64 = 1 << 7
+        USES_BINARY = 1 << 6, USES_DUPF64 = 1 << 7, GEN_INLINE_MATH = 1 << 8,
+        GEN_MULTI_VALUE = 1 << 9, USES_MULTI_VALUE = 1 << 10, GEN_MP = 1 << 11, GEN_DUAL = 1 << 12
     };
 
     uint32_t flags = 0;
 
     module_visitor *parent;
     wasm::Function *func;
-    std::vector<mp_complex> local_consts; // stored in arena
+    std::vector<std::shared_ptr<const mp_complex>> local_consts; // interned, and materialized as module globals by module_visitor::visit_end
     uint32_t arena_size = 0;
     bool needs_unwrap = false;
+    wasm::Index simd_parameter = 0; // v128 copy of the parameter, 0 until it is first used
+    std::map<uint32_t, wasm::Index> temporaries; // first of the locals holding each TOKEN_TEE temporary
 
     explicit function_visitor(module_visitor *_parent);
 
     ~function_visitor() noexcept;
 
+    void visit_local_get(wasm::Index index, wasm::Type type);
+
+    void visit_local_set(wasm::Index index);
+
+    void visit_local_tee(wasm::Index index, wasm::Type type);
+
+    // simd
+    void visit_pack_v128();
+
+    void visit_unpack_v128();
+
+    void visit_swizzle_f64x2(wasm::Index index, uint8_t lane0, uint8_t lane1);
+
+    void visit_v128_binary(wasm::BinaryOp op);
+
+    // name of the global holding local_consts[index]
+    std::string visit_const_name(size_t index);
+
 public:
     void visit_entry_point();
 
+    /**
+     * Switches the function to SIMD codegen. Every complex value on the stack is then kept in a single v128 as an
+     * f64x2 (real part in lane 0, imaginary part in lane 1) instead of two f64s. Must be called before anything is
+     * pushed onto the stack.
+     */
+    void visit_simd();
+
+    /**
+     * Makes division use inline_math instead of a morpheme.
+     */
+    void visit_inline_math();
+
+    /**
+     * Makes the function return (f64, f64) instead of an arena pointer, so the result doesn't need to be wrapped by a
+     * morpheme. Everything else is emitted inline, since morphemes still return arena pointers. Must be called before
+     * anything is pushed onto the stack, and the function signature must be (f64, f64) -> (f64, f64).
+     */
+    void visit_multi_value();
+
+    /**
+     * Makes the function return (f64, f64, f64, f64): the value and the derivative, which the stack has to end with,
+     * joined by expr_dag::pair_operator. Must be called before anything is pushed onto the stack.
+     */
+    void visit_dual();
+
+    /**
+     * Unboxes the two complex numbers on top of the stack into (re, im, re', im'), the return values of a dual
+     * function.
+     */
+    void visit_pair();
+
+    /**
+     * Switches the function to multiprecision codegen. Values on the stack are then mp_complex pointers, either into
+     * the arena or to constants, and the function returns one. Must be called before anything is pushed onto the stack,
+     * and the function signature must be (i32) -> i32.
+     */
+    void visit_mp();
+
     template <typename T> void visit_ptr(T *ptr);
 
     void visit_basic(wasm::Expression *inst);
@@ -91,6 +265,10 @@ public:
 
     bool visit_variable_mp(const std::string &name);
 
+    /**
+     * Pushes a pointer to a copy of z, which is read from a global of the module so the constant table is visible in
+     * the disassembly.
+     */
     void visit_complex(const mp_complex &z);
 
     // double-precision
@@ -114,30 +292,147 @@ public:
 
     void visit_div();
 
+    void visit_neg();
+
+    /**
+     * Copies the complex number on top of the stack into a temporary, leaving it on the stack. In multiprecision
+     * functions only the pointer is copied: arena entries aren't reused before the function returns.
+     */
+    void visit_temporary_tee(uint32_t temporary);
+
+    void visit_temporary_get(uint32_t temporary);
+
     void visit_f64x2(morpheme_f64x2 *morph);
 
     void visit_f64x4(morpheme_f64x4 *morph);
 
+    void visit_inline_f64x2(inline_f64x2 fn);
+
+    void visit_inline_f64x4(inline_f64x4 fn);
+
     void visit_fxncall(const std::string &name);
 
     std::string visit_end();
 };
 
+/**
+ * Code generation options for math_compiler_dp.
+ */
+enum compiler_option: uint32_t {
+    OPT_SIMD = 1 << 0,
+    OPT_INLINE_MATH = 1 << 1, // emit elementary functions as wasm instead of calling morphemes. on by default.
+    OPT_MULTI_VALUE = 1 << 2, // return (f64, f64) instead of an arena pointer. implies OPT_INLINE_MATH.
+    OPT_FOLD = 1 << 3, // run stack_optimizer before codegen. on by default.
+    OPT_CSE = 1 << 4, // compute repeated subexpressions once and keep them in temporaries. on by default.
+    OPT_INLINE_CALLS = 1 << 5, // inline calls to other fxns instead of calling them through the table. on by default.
+    OPT_DERIVATIVE = 1 << 6, // also compile a kernel computing f and f' together (see fxn::eval_dual). implies OPT_MULTI_VALUE.
+    OPT_ENCLOSURE = 1 << 7 // also compile the fxn to bytecode, so it can compute range bounds with fxn::enclose.
+};
+
 class math_compiler_dp {
     static std::map<std::string, morpheme_f64x2 *> unary_morphemes;
     static std::map<std::string, morpheme_f64x4 *> binary_morphemes;
+    static std::map<std::string, inline_f64x2> unary_inlines;
+    static std::map<std::string, inline_f64x4> binary_inlines;
 
     std::string name;
     std::string fxn_name;
     std::string parameter_name;
+    uint32_t options = OPT_INLINE_MATH | OPT_FOLD | OPT_CSE | OPT_INLINE_CALLS;
+    uint32_t optimize_level = 2;
 
     void visit_operator(function_visitor *fv, const std::string &op);
 
+    std::string cache_key(const token_stack &tokens);
+
+    // if `installed` is set, the module is compiled and installed in the background, see compile_async
+    fxn<std::complex<double>, compiled_fxn<std::complex<double>>> compile(const token_stack &input,
+            const compiled_fxn<std::complex<double>>::install_callback &installed);
+
 public:
     math_compiler_dp(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name)
             : name(_name), fxn_name(_fxn_name), parameter_name(_parameter_name) { }
 
+    void set_option(compiler_option option, bool enabled);
+
+    bool get_option(compiler_option option);
+
+    /**
+     * Sets the binaryen -O level of the optimized tier. 0 disables it, so the unoptimized module is kept.
+     */
+    void set_optimize_level(uint32_t level);
+
+    uint32_t get_optimize_level();
+
     fxn<std::complex<double>, compiled_fxn<std::complex<double>>> compile(const emscripten::val &stack);
+
+    /**
+     * Compiles the fxn, or installs a new instance of a cached module if an identical fxn has been compiled before.
+     * Inlined callees are copied into the fxn, so it has to be recompiled to pick up a redefinition of one.
+     */
+    fxn<std::complex<double>, compiled_fxn<std::complex<double>>> compile(const token_stack &input);
+
+    /**
+     * Compiles the fxn like compile, but compiles and instantiates the module in the background, so that the thread
+     * isn't blocked (and browsers that only allow small modules to be compiled synchronously don't refuse).
+     * @param callback called with the fxn once it's ready(). it isn't if the fxn was compiled again in the meantime,
+     * but it still has to be released.
+     */
+    void compile_async(const emscripten::val &stack, emscripten::val callback);
+};
+
+/**
+ * Compiles fxns that evaluate in multiprecision. Every operation is a morpheme call that writes its result into the
+ * next entry of the fxn's arena; entries are allocated once when the fxn is created, and the arena has exactly one
+ * per call, so evaluating the fxn doesn't allocate. Nothing is folded, since the folder works in double precision,
+ * but repeated subexpressions are still computed once.
+ */
+class math_compiler_mp {
+    static std::map<std::string, morpheme_mpcx1 *> unary_morphemes;
+    static std::map<std::string, morpheme_mpcx2 *> binary_morphemes;
+
+    std::string name;
+    std::string fxn_name;
+    std::string parameter_name;
+    uint32_t optimize_level = 2;
+    uint32_t digits = mp_precision::default_digits;
+
+    std::string cache_key(const token_stack &tokens);
+
+    fxn<mp_complex, compiled_fxn<mp_complex>> compile(const token_stack &input, const compiled_fxn<mp_complex>::install_callback &installed);
+
+public:
+    math_compiler_mp(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name)
+            : name(_name), fxn_name(_fxn_name), parameter_name(_parameter_name) { }
+
+    /**
+     * Sets the binaryen -O level of the optimized tier. 0 disables it, so the unoptimized module is kept.
+     */
+    void set_optimize_level(uint32_t level);
+
+    uint32_t get_optimize_level();
+
+    /**
+     * Sets the precision fxns are compiled at, in decimal digits. This is the precision of their constants, and the
+     * initial precision of their results, which a multipoint changes to its own (see fxn::set_precision). It should be
+     * at least the precision of the multipoints the fxn is evaluated in, see mp_precision::for_view.
+     */
+    void set_precision(uint32_t digits);
+
+    uint32_t get_precision();
+
+    fxn<mp_complex, compiled_fxn<mp_complex>> compile(const emscripten::val &stack);
+
+    /**
+     * Compiles the fxn, or installs a new instance of a cached module if an identical fxn has been compiled before.
+     * Calls are inlined whenever the callee's definition is known; the rest can only call other multiprecision fxns.
+     */
+    fxn<mp_complex, compiled_fxn<mp_complex>> compile(const token_stack &input);
+
+    /**
+     * @see math_compiler_dp::compile_async
+     */
+    void compile_async(const emscripten::val &stack, emscripten::val callback);
 };
 
 #endif //GLAMCORE_MATH_COMPILER_H
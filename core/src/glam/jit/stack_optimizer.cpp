@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "stack_optimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+static const std::map<std::string, std::function<std::complex<double>(std::complex<double>)>> unary_folds = {
+        { "sin", [](auto z) { return std::sin(z); } }, { "cos", [](auto z) { return std::cos(z); } },
+        { "tan", [](auto z) { return std::tan(z); } }, { "sinh", [](auto z) { return std::sinh(z); } },
+        { "cosh", [](auto z) { return std::cosh(z); } }, { "tanh", [](auto z) { return std::tanh(z); } },
+        { expr_dag::neg_operator, [](auto z) { return -z; } }
+};
+
+static const std::map<std::string, std::function<std::complex<double>(std::complex<double>, std::complex<double>)>> binary_folds = {
+        { "+", [](auto a, auto b) { return a + b; } }, { "-", [](auto a, auto b) { return a - b; } },
+        { "*", [](auto a, auto b) { return a * b; } }, { "/", [](auto a, auto b) { return a / b; } },
+        { "^", [](auto a, auto b) { return a == 0. ? 0. : std::pow(a, b); } } // like inline_math::cpow
+};
+
+static bool is_constant(const expr_dag &dag, expr_id id, std::complex<double> z) {
+    return dag[id].kind == EXPR_CONSTANT && dag[id].value == z;
+}
+
+void stack_optimizer::fold(expr_dag &dag) {
+    std::unordered_map<expr_id, expr_id> folded;
+    dag.set_root(fold(dag, dag.get_root(), folded));
+}
+
+expr_id stack_optimizer::fold(expr_dag &dag, expr_id id, std::unordered_map<expr_id, expr_id> &folded) {
+    auto memo = folded.find(id);
+    if (memo != folded.end()) {
+        return memo->second; // shared subexpressions are only folded once
+    }
+
+    // copy what we need, since making new nodes can move the old ones
+    const auto kind = dag[id].kind;
+    const auto name = dag[id].name;
+    auto args = dag[id].args;
+    for (auto &arg : args) {
+        arg = fold(dag, arg, folded);
+    }
+
+    expr_id result = id;
+    bool constant_args = std::all_of(args.begin(), args.end(), [&](expr_id arg) { return dag[arg].kind == EXPR_CONSTANT; });
+    if (kind == EXPR_OPERATOR && constant_args && args.size() == 1 && unary_folds.count(name)) {
+        result = dag.constant(unary_folds.at(name)(dag[args[0]].value));
+    } else if (kind == EXPR_OPERATOR && constant_args && args.size() == 2 && binary_folds.count(name)) {
+        result = dag.constant(binary_folds.at(name)(dag[args[0]].value, dag[args[1]].value));
+    } else if (kind == EXPR_OPERATOR && args.size() == 2) {
+        result = simplify_binary(dag, name, args[0], args[1]);
+    } else if (kind == EXPR_OPERATOR) {
+        result = dag.op(name, args);
+    } else if (kind == EXPR_FXNCALL) {
+        result = dag.fxncall(name, args[0]);
+    } else if (kind == EXPR_POWER) {
+        result = dag.power(args[0], dag[id].exponent);
+    }
+    folded[id] = result;
+    return result;
+}
+
+expr_id stack_optimizer::simplify_binary(expr_dag &dag, const std::string &op, expr_id a, expr_id b) {
+    if ((op == "+" && is_constant(dag, b, 0.)) || (op == "-" && is_constant(dag, b, 0.)) || (op == "*" && is_constant(dag, b, 1.)) ||
+        (op == "/" && is_constant(dag, b, 1.)) || (op == "^" && is_constant(dag, b, 1.))) {
+        return a;
+    } else if ((op == "+" && is_constant(dag, a, 0.)) || (op == "*" && is_constant(dag, a, 1.))) {
+        return b;
+    } else if (op == "*" && is_constant(dag, b, -1.)) {
+        return dag.op(expr_dag::neg_operator, { a });
+    } else if (op == "*" && is_constant(dag, a, -1.)) {
+        return dag.op(expr_dag::neg_operator, { b });
+    } else if (op == "/" && dag[b].kind == EXPR_CONSTANT && dag[b].value.imag() == 0) {
+        // otherwise the reciprocal is rounded, and z / 3 isn't z * (1 / 3)
+        int exp;
+        const double d = dag[b].value.real(), reciprocal = 1. / d;
+        if (std::isfinite(reciprocal) && std::abs(std::frexp(d, &exp)) == 0.5 && 1. / reciprocal == d) {
+            return dag.op("*", { a, dag.constant(reciprocal) });
+        }
+    } else if (op == "^" && dag[b].kind == EXPR_CONSTANT) {
+        auto e = dag[b].value;
+        // not x^0 or x^-n, which would be 1 and 1 / x^n, since 0^w is 0 at runtime (see inline_math::cpow)
+        if (e.imag() == 0 && std::floor(e.real()) == e.real() && e.real() >= 2 && e.real() <= max_power) {
+            return dag.power(a, static_cast<int>(e.real()));
+        }
+    }
+    return dag.op(op, { a, b });
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_STACK_OPTIMIZER_H
+#define GLAMCORE_STACK_OPTIMIZER_H
+
+#include <map>
+#include <unordered_map>
+#include "expr_dag.h"
+
+/**
+ * Folding pass over an expr_dag, which replaces the root with a cheaper expression that computes the same thing:
+ *  - constant subexpressions (including globals like \pi) are folded into a single constant
+ *  - x + 0, x - 0, x * 1 and x / 1 become x, and x * -1 (which is how the parser writes -x) becomes a negation
+ *  - division by a real power of two becomes multiplication by its reciprocal, which is exact
+ *  - positive integer powers up to max_power become EXPR_POWER nodes, which are emitted as multiplication chains
+ *
+ * Folding happens in double precision with std::complex, so the result is only meant for the dp compiler. Nothing is
+ * reassociated, so the rounding is the same as evaluating the original stack.
+ */
+class stack_optimizer {
+public:
+    constexpr static int max_power = 64;
+
+    /**
+     * Folds everything reachable from the root of `dag`. The nodes that were replaced are left for expr_dag::prune().
+     */
+    static void fold(expr_dag &dag);
+
+private:
+    static expr_id fold(expr_dag &dag, expr_id id, std::unordered_map<expr_id, expr_id> &folded);
+
+    static expr_id simplify_binary(expr_dag &dag, const std::string &op, expr_id a, expr_id b);
+};
+
+#endif //GLAMCORE_STACK_OPTIMIZER_H
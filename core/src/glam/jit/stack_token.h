@@ -0,0 +1,44 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_STACK_TOKEN_H
+#define GLAMCORE_STACK_TOKEN_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Kinds of stack objects. The first four are produced by the parser in the UI (StackObjectType in MathQuillField.tsx),
+ * the rest only by expr_dag::emit():
+ *  - TOKEN_COMPLEX: an exact complex constant, written as two hex floats separated by a space
+ *  - TOKEN_TEE: copies the top of the stack into the temporary with the given index, leaving it on the stack
+ *  - TOKEN_GET: pushes the temporary with the given index
+ */
+enum stack_token_type: int32_t {
+    TOKEN_NUMBER = 0, TOKEN_IDENTIFIER = 1, TOKEN_OPERATOR = 2, TOKEN_FXNCALL = 3, TOKEN_COMPLEX = 4, TOKEN_TEE = 5, TOKEN_GET = 6
+};
+
+/**
+ * One element of an expression in reverse polish notation.
+ */
+struct stack_token {
+    stack_token_type type;
+    std::string value;
+};
+
+using token_stack = std::vector<stack_token>;
+
+#endif //GLAMCORE_STACK_TOKEN_H
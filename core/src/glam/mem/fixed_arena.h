@@ -18,38 +18,60 @@
 #define GLAMCORE_FIXED_ARENA_H
 
 #include "../utilities.h"
+#include "../thread_pool.h"
 
+/**
+ * Slots that morphemes write their results into, reused round-robin. Each lane of thread_pool::shared() has its own
+ * slots, so a fxn can be evaluated on all of them at once.
+ */
 template <typename T> class fixed_arena {
-    std::vector<T *> arena;
-    uint32_t index;
+    // each cursor is written by a single lane, so they get a cache line each
+    struct alignas(64) cursor {
+        uint32_t index = 0;
+    };
+
+    std::vector<T *> arena; // lane k owns [k * size, (k + 1) * size)
+    std::vector<cursor> cursors;
+    uint32_t size;
 
 public:
-    std::vector<T *> consts;
+    std::vector<std::shared_ptr<const T>> consts; // interned constants the fxn's code points to, see globals::intern_mp
 
-    explicit fixed_arena(uint32_t _arena_size): arena(_arena_size), index(0) {
+    explicit fixed_arena(uint32_t _arena_size): arena(_arena_size * thread_pool::shared().size()),
+                                                cursors(thread_pool::shared().size()), size(_arena_size) {
         GLAM_TRACE("arena size " << _arena_size);
         std::generate(arena.begin(), arena.end(), []() { return new T(0); });
     }
 
-    ~fixed_arena() noexcept {
-        std::for_each(consts.begin(), consts.end(), [](auto v) { delete v; });
-    }
-
     T *alloc() {
-        if (this->index >= this->arena.size()) {
-            this->reset();
+        const uint32_t lane = thread_pool::lane();
+        auto &c = cursors[lane];
+        if (c.index >= this->size) {
+            c.index = 0;
         }
-        auto r = arena[this->index];
-        this->index++;
-        return r;
+        return arena[lane * this->size + c.index++];
     }
 
+    /**
+     * Starts over on the calling lane's slots.
+     */
     void reset() {
-        this->index = 0;
+        cursors[thread_pool::lane()].index = 0;
+    }
+
+    /**
+     * Gives every slot `digits` of precision, for variable precision T (see mp_precision). Morphemes write their results
+     * into slots, so this is the precision they are computed at.
+     */
+    void set_precision(uint32_t digits) {
+        std::for_each(arena.begin(), arena.end(), [digits](auto v) { v->precision(digits); });
     }
 
+    /**
+     * @return the number of slots each lane has
+     */
     uint32_t get_size() {
-        return arena.size();
+        return this->size;
     }
 
     void release() {
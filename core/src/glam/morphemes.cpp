@@ -66,19 +66,25 @@ DEFINE_MPCx1(tan) {
 
 DEFINE_MPCx1(sinh) {
     auto r = arena->alloc();
-    *r = boost::multiprecision::sin(*a);
+    *r = boost::multiprecision::sinh(*a);
     return r;
 }
 
 DEFINE_MPCx1(cosh) {
     auto r = arena->alloc();
-    *r = boost::multiprecision::cos(*a);
+    *r = boost::multiprecision::cosh(*a);
     return r;
 }
 
 DEFINE_MPCx1(tanh) {
     auto r = arena->alloc();
-    *r = boost::multiprecision::tan(*a);
+    *r = boost::multiprecision::tanh(*a);
+    return r;
+}
+
+DEFINE_MPCx1(copy) {
+    auto r = arena->alloc();
+    *r = *a;
     return r;
 }
 
@@ -88,6 +94,78 @@ DEFINE_MPCx1(conj) {
     return r;
 }
 
+DEFINE_DDx2(add) {
+    auto r = arena->alloc();
+    *r = *a + *b;
+    return r;
+}
+
+DEFINE_DDx2(sub) {
+    auto r = arena->alloc();
+    *r = *a - *b;
+    return r;
+}
+
+DEFINE_DDx2(mul) {
+    auto r = arena->alloc();
+    *r = *a * *b;
+    return r;
+}
+
+DEFINE_DDx2(div) {
+    auto r = arena->alloc();
+    *r = *a / *b;
+    return r;
+}
+
+DEFINE_DDx2(exp) {
+    auto r = arena->alloc();
+    *r = dd_math::pow(*a, *b);
+    return r;
+}
+
+DEFINE_DDx1(sin) {
+    auto r = arena->alloc();
+    *r = dd_math::sin(*a);
+    return r;
+}
+
+DEFINE_DDx1(cos) {
+    auto r = arena->alloc();
+    *r = dd_math::cos(*a);
+    return r;
+}
+
+DEFINE_DDx1(tan) {
+    auto r = arena->alloc();
+    *r = dd_math::tan(*a);
+    return r;
+}
+
+DEFINE_DDx1(sinh) {
+    auto r = arena->alloc();
+    *r = dd_math::sinh(*a);
+    return r;
+}
+
+DEFINE_DDx1(cosh) {
+    auto r = arena->alloc();
+    *r = dd_math::cosh(*a);
+    return r;
+}
+
+DEFINE_DDx1(tanh) {
+    auto r = arena->alloc();
+    *r = dd_math::tanh(*a);
+    return r;
+}
+
+DEFINE_DDx1(copy) {
+    auto r = arena->alloc();
+    *r = *a;
+    return r;
+}
+
 DEFINE_f64x4(div) {
     auto r = arena->alloc();
     *r = std::complex(a, b) / std::complex(c, d);
@@ -20,15 +20,19 @@
 #include "types.h"
 #include "mem/fixed_arena.h"
 #include <complex>
-#include <emscripten.h>
+#include "web/bindings.h"
 
 #define DEFINE_MPCx1(name) EMSCRIPTEN_KEEPALIVE mp_complex *_morpheme_ ## name(mp_complex *a, fixed_arena<mp_complex> *arena)
 #define DEFINE_MPCx2(name) EMSCRIPTEN_KEEPALIVE mp_complex *_morpheme_ ## name(mp_complex *a, mp_complex *b, fixed_arena<mp_complex> *arena)
+#define DEFINE_DDx1(name) EMSCRIPTEN_KEEPALIVE dd_complex *_ddmorpheme_ ## name(dd_complex *a, fixed_arena<dd_complex> *arena)
+#define DEFINE_DDx2(name) EMSCRIPTEN_KEEPALIVE dd_complex *_ddmorpheme_ ## name(dd_complex *a, dd_complex *b, fixed_arena<dd_complex> *arena)
 #define DEFINE_f64x2(name) EMSCRIPTEN_KEEPALIVE std::complex<double> *_fmorpheme_ ## name(double a, double b, fixed_arena<std::complex<double>> *arena)
 #define DEFINE_f64x4(name) EMSCRIPTEN_KEEPALIVE std::complex<double> *_fmorpheme_ ## name(double a, double b, double c, double d, fixed_arena<std::complex<double>> *arena)
 
 using morpheme_mpcx1 = mp_complex *(mp_complex *, fixed_arena<mp_complex> *);
 using morpheme_mpcx2 = mp_complex *(mp_complex *, mp_complex *, fixed_arena<mp_complex> *);
+using morpheme_ddx1 = dd_complex *(dd_complex *, fixed_arena<dd_complex> *);
+using morpheme_ddx2 = dd_complex *(dd_complex *, dd_complex *, fixed_arena<dd_complex> *);
 using morpheme_f64x2 = std::complex<double> *(double, double, fixed_arena<std::complex<double>> *);
 using morpheme_f64x4 = std::complex<double> *(double, double, double, double, fixed_arena<std::complex<double>> *);
 
@@ -54,6 +58,32 @@ DEFINE_MPCx1(cosh);
 
 DEFINE_MPCx1(tanh);
 
+DEFINE_MPCx1(copy); // copies a into the arena, e.g. to take ownership of a value from another fxn's arena
+
+DEFINE_DDx2(add);
+
+DEFINE_DDx2(sub);
+
+DEFINE_DDx2(mul);
+
+DEFINE_DDx2(div);
+
+DEFINE_DDx2(exp);
+
+DEFINE_DDx1(sin);
+
+DEFINE_DDx1(cos);
+
+DEFINE_DDx1(tan);
+
+DEFINE_DDx1(sinh);
+
+DEFINE_DDx1(cosh);
+
+DEFINE_DDx1(tanh);
+
+DEFINE_DDx1(copy);
+
 DEFINE_f64x4(div);
 
 DEFINE_f64x4(exp);
@@ -16,11 +16,50 @@
 
 #include "multipoint.h"
 
+#include <cmath>
+#include <optional>
 #include <utility>
+#ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
+#endif
 #include "utilities.h"
 #include "web/bindings.h"
 #include "colors.h"
+#include "jit/globals.h"
+#include "thread_pool.h"
+#include "vm/bytecode.h"
+#include "vm/x64_jit.h"
+
+namespace {
+    // complex domains are sampled on a lattice, see multipoint::origin
+    template <typename D> constexpr bool is_lattice() {
+        return !std::is_same<D, double>() && !std::is_same<D, mp_float>();
+    }
+
+    template <typename D> void fill_lattice(const D &origin, uint32_t width, uint32_t res, std::vector<D> &samples) {
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples[i] = origin + D(i % width, i / width) / D(res);
+        }
+    }
+
+    template <typename D> std::complex<double> to_double(const D &z) {
+        if constexpr (is_mp<D>()) {
+            return z.template convert_to<std::complex<double>>();
+        } else {
+            return static_cast<std::complex<double>>(z);
+        }
+    }
+
+    // the index on the old lattice of a row or column `k` of the new one, which is `offset` samples past the old origin,
+    // or -1 if there isn't a sample there
+    int64_t old_index(int64_t k, int64_t offset, uint32_t old_res, uint32_t res, uint32_t old_size) {
+        const int64_t scaled = (k + offset) * old_res;
+        if (scaled < 0 || scaled % res != 0 || scaled / res >= old_size) {
+            return -1;
+        }
+        return scaled / res;
+    }
+}
 
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE multipoint<D, R>::multipoint(std::string _name, _domain_t from, _domain_t to,
                                                                                     uint32_t res, functor_t _generator)
@@ -28,17 +67,76 @@ template <typename D, typename R> EMSCRIPTEN_KEEPALIVE multipoint<D, R>::multipo
     inner_init(from, to, res);
 }
 
+template <typename D, typename R> template <typename FxnType> multipoint<D, R>::multipoint(fxn<_range_t, FxnType> f,
+                                                                                          const _domain_t &from, const _domain_t &to,
+                                                                                          uint32_t res)
+        : multipoint(f.get_fxn_name(), from, to, res, [f](const D &z) mutable {
+    return f(z);
+}) {
+    static_assert(!is_mp<R>(), "native fxns don't evaluate in multiprecision");
+    // the VM's registers are per thread, and x64 kernels allocate from their arena's lane
+    parallel = true;
+    batch = [f](const D *in, R *out, size_t count) mutable {
+        if constexpr (std::is_same<D, R>()) {
+            f.eval_batch(in, out, count);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                out[i] = f(in[i]);
+            }
+        }
+    };
+    if constexpr (std::is_same<R, std::complex<double>>()) {
+        // enclosures are computed in double precision, so they say nothing about a double-double's error
+        if (f.has_enclosure()) {
+            error_estimate = [f](const D &z) mutable {
+                return f.estimate_error(std::complex<double>(z));
+            };
+        }
+    }
+    GLAM_TRACE("constructed native multipoint for " << f.get_name());
+}
+
+#ifdef __EMSCRIPTEN__
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE multipoint<D, R>::multipoint(fxn<_range_t, compiled_fxn<_range_t>> f,
                                                                                     multipoint::D_JS from, multipoint::D_JS to,
                                                                                     uint32_t res)
-        : multipoint(f.get_fxn_name(), js_type<D>::from(from), js_type<D>::from(to), res, [f, this, i = 0](const D &z) mutable {
-    auto result = f(z);
-    colors.buffer[i++] = rgba(Lab::from_complex<R>(result), 0xff);
-    return result;
+        : multipoint(f.get_fxn_name(), js_type<D>::from(from), js_type<D>::from(to), res, [f](const D &z) mutable {
+    return f(z);
 }) {
+    if constexpr (is_mp<R>()) {
+        // the generator's copy shares the arena
+        on_precision = [f](uint32_t _digits) mutable {
+            f.set_precision(_digits);
+        };
+        on_precision(digits);
+    }
+    // parallel stays unset: modules are instantiated into the table of the thread that compiled them, so the pool's
+    // workers can't call them
+    if constexpr (std::is_same<D, R>() && !is_mp<R>()) {
+        if (f.has_batch()) {
+            batch = [f](const D *in, R *out, size_t count) mutable {
+                f.eval_batch(in, out, count);
+            };
+        }
+    }
+    if constexpr (!is_mp<R>()) {
+        if (f.has_enclosure()) {
+            error_estimate = [f](const D &z) mutable {
+                return f.estimate_error(std::complex<double>(z));
+            };
+        }
+    }
     GLAM_TRACE("constructed multipoint for " << f.get_name());
 }
 
+template <typename D, typename R> EMSCRIPTEN_KEEPALIVE void multipoint<D, R>::set_escalation(fxn<mp_complex, compiled_fxn<mp_complex>> f) {
+    if constexpr (!is_mp<R>()) {
+        escalation = [f](const D &z) mutable {
+            return f(mp_complex(z)).template convert_to<R>();
+        };
+    }
+}
+
 template EMSCRIPTEN_KEEPALIVE multipoint<double, std::complex<double>>::multipoint(fxn<_range_t, compiled_fxn<_range_t>> f, D_JS from,
                                                                                    D_JS to, uint32_t res);
 
@@ -50,17 +148,151 @@ template EMSCRIPTEN_KEEPALIVE multipoint<mp_float, mp_complex>::multipoint(fxn<_
 
 template EMSCRIPTEN_KEEPALIVE multipoint<mp_complex, mp_complex>::multipoint(fxn<_range_t, compiled_fxn<_range_t>> f, D_JS from, D_JS to,
                                                                              uint32_t res);
+#endif
 
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE std::pair<D, R> multipoint<D, R>::operator[](size_t n) {
     return std::make_pair(this->samples[n], this->values[n]);
 }
 
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE void multipoint<D, R>::full_eval() {
-    std::transform(samples.begin(), samples.end(), std::back_inserter(values), [&](auto z) {
-        return this->generator(z);
-    });
+    revision = globals::revision(name);
+    eval_samples(nullptr);
+    stride = 1;
 }
 
+template <typename D, typename R> EMSCRIPTEN_KEEPALIVE uint32_t multipoint<D, R>::refine() {
+    if (stride == 1 && !is_stale()) {
+        return stride;
+    }
+    const uint32_t previous = stride > 1 && !is_stale() ? stride : 0;
+    stride = previous ? previous / 2 : coarsest_stride;
+    revision = globals::revision(name);
+    // the samples on this pass's lattice that weren't on the last one's
+    std::vector<size_t> fresh;
+    for (uint32_t r = 0; r < height; r += stride) {
+        for (uint32_t c = 0; c < width; c += stride) {
+            if (!previous || r % previous != 0 || c % previous != 0) {
+                fresh.push_back(static_cast<size_t>(r) * width + c);
+            }
+        }
+    }
+    eval_samples(&fresh);
+    if (stride > 1) {
+        // the rest are drawn like the evaluated sample at the lower-left of their block
+        for (uint32_t r = 0; r < height; r++) {
+            for (uint32_t c = 0; c < width; c++) {
+                const size_t i = static_cast<size_t>(r) * width + c;
+                const size_t anchor = static_cast<size_t>(r - r % stride) * width + (c - c % stride);
+                if (i != anchor) {
+                    values[i] = values[anchor];
+                    colors.buffer[i] = colors.buffer[anchor];
+                }
+            }
+        }
+    }
+    GLAM_TRACE("refined to stride " << stride << ", evaluating " << fresh.size() << " samples");
+    return stride;
+}
+
+template <typename D, typename R> void multipoint<D, R>::eval_samples(const std::vector<size_t> *indices) {
+    std::optional<mp_precision::scope> precision;
+    if constexpr (is_mp<R>()) {
+        precision.emplace(digits); // for the temporaries the fxn creates
+    }
+    values.resize(samples.size());
+    const size_t count = indices ? indices->size() : samples.size();
+    auto color = [this](size_t i) {
+        colors.buffer[i] = rgba(Lab::from_complex<R>(values[i]), 0xff);
+    };
+    if (!batch) {
+        for (size_t k = 0; k < count; k++) {
+            const size_t i = indices ? (*indices)[k] : k;
+            values[i] = generator(samples[i]);
+            color(i);
+        }
+        return;
+    }
+    // a batch call takes a row's worth of samples, which are contiguous unless they're picked out by `indices`
+    const size_t chunks = (count + width - 1) / width;
+    auto eval_chunks = [&](size_t first, size_t last) {
+        std::vector<_domain_t> in;
+        std::vector<_range_t> out;
+        for (size_t chunk = first; chunk < last; chunk++) {
+            const size_t begin = chunk * width;
+            const size_t n = std::min<size_t>(width, count - begin);
+            if (indices) {
+                in.resize(n);
+                out.resize(n);
+                for (size_t k = 0; k < n; k++) {
+                    in[k] = samples[(*indices)[begin + k]];
+                }
+                batch(in.data(), out.data(), n);
+                for (size_t k = 0; k < n; k++) {
+                    const size_t i = (*indices)[begin + k];
+                    values[i] = out[k];
+                    color(i);
+                }
+            } else {
+                batch(&samples[begin], &values[begin], n);
+                for (size_t i = begin; i < begin + n; i++) {
+                    color(i);
+                }
+            }
+        }
+    };
+    auto &pool = thread_pool::shared();
+    if (parallel && pool.size() > 1) {
+        const size_t tiles = std::min<size_t>(chunks, pool.size() * tiles_per_lane);
+        pool.run(tiles, [&](size_t tile) {
+            eval_chunks(chunks * tile / tiles, chunks * (tile + 1) / tiles);
+        });
+    } else {
+        eval_chunks(0, chunks);
+    }
+}
+
+template <typename D, typename R> EMSCRIPTEN_KEEPALIVE uint32_t multipoint<D, R>::mixed_eval(double tolerance) {
+    full_eval();
+    if (!escalation) {
+        return 0;
+    }
+    // screening reads the samples and values only, so it can run on the pool. escalations don't have to be thread-safe.
+    std::vector<uint8_t> suspect(samples.size(), 0);
+    if constexpr (!is_mp<R>()) { // otherwise it's already as precise as it gets
+        auto screen = [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                const double magnitude = std::abs(static_cast<std::complex<double>>(values[i]));
+                // the negation also catches nans
+                suspect[i] = !(magnitude < suspect_magnitude) || (error_estimate && !(error_estimate(samples[i]) <= tolerance));
+            }
+        };
+        auto &pool = thread_pool::shared();
+        if (parallel && pool.size() > 1) {
+            const size_t tiles = std::min<size_t>(samples.size(), pool.size() * tiles_per_lane);
+            pool.run(tiles, [&](size_t tile) {
+                screen(samples.size() * tile / tiles, samples.size() * (tile + 1) / tiles);
+            });
+        } else {
+            screen(0, samples.size());
+        }
+    }
+    uint32_t escalated = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (suspect[i]) {
+            values[i] = escalation(samples[i]);
+            colors.buffer[i] = rgba(Lab::from_complex<R>(values[i]), 0xff);
+            escalated++;
+        }
+    }
+    GLAM_TRACE("escalated " << escalated << " of " << samples.size() << " samples");
+    return escalated;
+}
+
+template <typename D, typename R> EMSCRIPTEN_KEEPALIVE bool multipoint<D, R>::is_stale() {
+    return globals::revision(name) != revision;
+}
+
+#ifdef __EMSCRIPTEN__
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE emscripten::val multipoint<D, R>::get_values() {
     if constexpr (is_mp<R>()) {
         auto converted = new js_complex[this->values.size()];
@@ -79,28 +311,105 @@ template <typename D, typename R> EMSCRIPTEN_KEEPALIVE emscripten::val multipoin
 template <typename D, typename R> EMSCRIPTEN_KEEPALIVE emscripten::val multipoint<D, R>::get_colors() {
     return emscripten::val(emscripten::typed_memory_view(colors.length * 4, reinterpret_cast<uint8_t *>(colors.buffer)));
 }
+#endif
 
 template <typename D, typename R> void multipoint<D, R>::resize(const _domain_t &from, const _domain_t &to, uint32_t res) {
+    if (res == 0) {
+        res = resolution;
+    }
+    const bool reusable = stride == 1 && values.size() == samples.size() && !samples.empty() && !is_stale();
+    const _domain_t old_origin = origin;
+    const uint32_t old_res = resolution, old_width = width, old_height = height, old_digits = digits;
+    std::vector<_domain_t> old_samples = std::move(samples);
+    std::vector<_range_t> old_values = std::move(values);
+    rgba *old_colors = colors.buffer;
+
+    inner_init(from, to, res);
+    resolution = res;
+    values.clear();
+    if (digits != old_digits && on_precision) {
+        on_precision(digits);
+    }
+
+    // the new origin has to be a whole number of samples from the old one
+    int64_t dx = 0, dy = 0;
+    bool aligned = false;
+    if constexpr (is_lattice<D>()) {
+        const std::complex<double> offset = to_double<D>(origin - old_origin) * static_cast<double>(res);
+        dx = std::llround(offset.real());
+        dy = std::llround(offset.imag());
+        aligned = std::abs(offset.real() - dx) <= 1e-6 && std::abs(offset.imag() - dy) <= 1e-6;
+    }
+    if (!reusable || !aligned || digits != old_digits) {
+        delete[] old_colors;
+        GLAM_TRACE("resized without reusing samples");
+        full_eval();
+        return;
+    }
+
+    std::vector<int64_t> cols(width);
+    for (uint32_t c = 0; c < width; c++) {
+        cols[c] = old_index(c, dx, old_res, res, old_width);
+    }
+    std::vector<size_t> fresh;
+    values.resize(samples.size());
+    for (uint32_t r = 0; r < height; r++) {
+        const int64_t old_row = old_index(r, dy, old_res, res, old_height);
+        for (uint32_t c = 0; c < width; c++) {
+            const size_t i = static_cast<size_t>(r) * width + c;
+            if (old_row < 0 || cols[c] < 0) {
+                fresh.push_back(i);
+                continue;
+            }
+            // the old sample is the same point up to rounding, and keeps its value exact
+            const size_t j = static_cast<size_t>(old_row) * old_width + cols[c];
+            samples[i] = old_samples[j];
+            values[i] = old_values[j];
+            colors.buffer[i] = old_colors[j];
+        }
+    }
+    delete[] old_colors;
+    eval_samples(&fresh);
+    stride = 1;
+    GLAM_TRACE("resized, reusing " << samples.size() - fresh.size() << " of " << samples.size() << " samples");
+}
 
+#ifdef __EMSCRIPTEN__
+template <typename D, typename R> EMSCRIPTEN_KEEPALIVE void multipoint<D, R>::resize_js(multipoint::D_JS from, multipoint::D_JS to,
+                                                                                      uint32_t res) {
+    resize(js_type<D>::from(from), js_type<D>::from(to), res);
 }
+#endif
 
 template <> EMSCRIPTEN_KEEPALIVE void multipoint<mp_float, mp_complex>::inner_init(const _domain_t &from, const _domain_t &to,
                                                                                    uint32_t res) {
     GLAM_TRACE("inner init mp (R->C)");
+    digits = mp_precision::for_view(from, to, res);
+    mp_precision::scope precision(digits);
     samples = std::vector<_domain_t>(boost::multiprecision::ceil((to - from) * res).convert_to<size_t>());
-    linspace(from, to, samples);
+    // the samples are computed from the endpoints, so they need the view's precision too
+    linspace(_domain_t(from, digits), _domain_t(to, digits), samples);
+    this->width = samples.size();
+    this->height = 1;
+    this->origin = _domain_t(from, digits);
     this->colors = color_buffer(samples.size());
-    GLAM_TRACE("initialized with " << samples.size() << " samples.");
+    GLAM_TRACE("initialized with " << samples.size() << " samples at " << digits << " digits.");
 }
 
 template <> EMSCRIPTEN_KEEPALIVE void multipoint<mp_complex, mp_complex>::inner_init(const _domain_t &from, const _domain_t &to,
                                                                                      uint32_t res) {
     GLAM_TRACE("inner init mp (C->C)");
+    digits = mp_precision::for_view(from, to, res);
+    mp_precision::scope precision(digits);
     auto dim = (to - from).convert_to<_domain_t>();
-    samples = std::vector<_domain_t>(boost::multiprecision::ceil(dim.real() * dim.imag() * res * res).convert_to<size_t>());
-    latspace(from, to, _domain_t(1. / res, 1. / res), samples);
+    this->width = std::max<uint32_t>(1, boost::multiprecision::ceil(dim.real() * res).convert_to<uint32_t>());
+    this->height = std::max<uint32_t>(1, boost::multiprecision::ceil(dim.imag() * res).convert_to<uint32_t>());
+    // the samples are computed from the origin, so it needs the view's precision too
+    this->origin = _domain_t(from, digits);
+    samples = std::vector<_domain_t>(static_cast<size_t>(width) * height);
+    fill_lattice(origin, width, res, samples);
     this->colors = color_buffer(samples.size());
-    GLAM_TRACE("initialized with " << samples.size() << " samples.");
+    GLAM_TRACE("initialized with " << samples.size() << " samples at " << digits << " digits.");
 }
 
 template <> EMSCRIPTEN_KEEPALIVE void multipoint<double, std::complex<double>>::inner_init(const _domain_t &from, const _domain_t &to,
@@ -108,6 +417,9 @@ template <> EMSCRIPTEN_KEEPALIVE void multipoint<double, std::complex<double>>::
     GLAM_TRACE("inner init dp (R->C)");
     samples = std::vector<_domain_t>(static_cast<size_t>(std::ceil(to - from) * res));
     linspace(from, to, samples);
+    this->width = samples.size();
+    this->height = 1;
+    this->origin = from;
     this->colors = color_buffer(samples.size());
     GLAM_TRACE("initialized with " << samples.size() << " samples.");
 }
@@ -117,9 +429,45 @@ template <> EMSCRIPTEN_KEEPALIVE void multipoint<std::complex<double>, std::comp
                                                                                                          uint32_t res) {
     GLAM_TRACE("inner init dp (C->C)");
     auto dim = to - from;
-    samples = std::vector<_domain_t>(static_cast<size_t>(ceil(dim.real() * dim.imag() * res * res)));
-    latspace(from, to, _domain_t(1. / res, 1. / res), samples);
+    this->width = std::max<uint32_t>(1, static_cast<uint32_t>(ceil(dim.real() * res)));
+    this->height = std::max<uint32_t>(1, static_cast<uint32_t>(ceil(dim.imag() * res)));
+    this->origin = from;
+    samples = std::vector<_domain_t>(static_cast<size_t>(width) * height);
+    fill_lattice(origin, width, res, samples);
     this->colors = color_buffer(samples.size());
     GLAM_TRACE("initialized with " << samples.size() << " samples.");
 }
 
+template <> EMSCRIPTEN_KEEPALIVE void multipoint<dd_complex, dd_complex>::inner_init(const _domain_t &from, const _domain_t &to,
+                                                                                     uint32_t res) {
+    GLAM_TRACE("inner init dd (C->C)");
+    auto dim = static_cast<std::complex<double>>(to - from);
+    this->width = std::max<uint32_t>(1, static_cast<uint32_t>(ceil(dim.real() * res)));
+    this->height = std::max<uint32_t>(1, static_cast<uint32_t>(ceil(dim.imag() * res)));
+    this->origin = from;
+    samples = std::vector<_domain_t>(static_cast<size_t>(width) * height);
+    fill_lattice(origin, width, res, samples);
+    this->colors = color_buffer(samples.size());
+    GLAM_TRACE("initialized with " << samples.size() << " samples.");
+}
+
+template multipoint<double, std::complex<double>>::multipoint(fxn<std::complex<double>, native_fxn> f, const _domain_t &from,
+                                                              const _domain_t &to, uint32_t res);
+template multipoint<std::complex<double>, std::complex<double>>::multipoint(fxn<std::complex<double>, native_fxn> f,
+                                                                            const _domain_t &from, const _domain_t &to, uint32_t res);
+template multipoint<dd_complex, dd_complex>::multipoint(fxn<dd_complex, native_dd_fxn> f, const _domain_t &from, const _domain_t &to,
+                                                        uint32_t res);
+
+#ifdef GLAM_X64_JIT
+template multipoint<double, std::complex<double>>::multipoint(fxn<std::complex<double>, x64_fxn> f, const _domain_t &from,
+                                                              const _domain_t &to, uint32_t res);
+template multipoint<std::complex<double>, std::complex<double>>::multipoint(fxn<std::complex<double>, x64_fxn> f,
+                                                                            const _domain_t &from, const _domain_t &to, uint32_t res);
+#endif
+
+#ifndef __EMSCRIPTEN__
+// there are no bindings to instantiate the rest of the members natively
+template class multipoint<double, std::complex<double>>;
+template class multipoint<std::complex<double>, std::complex<double>>;
+template class multipoint<dd_complex, dd_complex>;
+#endif
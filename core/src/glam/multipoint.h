@@ -21,7 +21,6 @@
 #include "colors.h"
 #include "fxn.h"
 #include <vector>
-#include <emscripten/emscripten.h>
 
 /**
  * Represents the result of evaluating a fxn.
@@ -33,18 +32,75 @@ public:
     using _domain_t = D;
     using _range_t = R;
     using functor_t = std::function<R(const D &)>;
+    using batch_t = std::function<void(const D *, R *, size_t)>;
     using D_JS = typename js_type<D>::type;
 
     std::vector<_domain_t> samples;
     std::vector<_range_t> values;
     color_buffer colors;
     uint32_t resolution;
+    uint32_t width; // number of samples in one row of the lattice
+    uint32_t height; // number of rows in the lattice, 1 for a real domain
+    _domain_t origin; // the first sample. for a complex domain, the one at row r and column c is origin + (c + ri) / resolution
     std::string name;
+    uint64_t revision = 0; // of the fxn named `name`, as of the last full_eval
+    uint32_t digits = 0; // precision of the samples and values, if they are multiprecision. see mp_precision::for_view
+    uint32_t stride = 0; // of the samples evaluated so far, see refine. 1 once they all are, 0 before any are
 
     void inner_init(const _domain_t &from, const _domain_t &to, uint32_t res);
 
+    /**
+     * Evaluates the samples at `indices`, or all of them if null, and colors them. See parallel.
+     */
+    void eval_samples(const std::vector<size_t> *indices);
+
     functor_t generator;
 
+    /**
+     * If set, full_eval uses this instead of the generator, making one call per row of samples.
+     */
+    batch_t batch;
+
+    /**
+     * If set, full_eval runs the batch on thread_pool::shared(), splitting the rows of samples into tiles. Only for fxns
+     * that can be evaluated on any thread.
+     */
+    bool parallel = false;
+
+    /**
+     * Tiles each lane of the pool gets on average, see parallel. More tiles balance better when some rows are slower to
+     * evaluate than others, at the cost of more scheduling.
+     */
+    static constexpr uint32_t tiles_per_lane = 8;
+
+    /**
+     * If set, mixed_eval re-evaluates suspect samples with this, e.g. a multiprecision build of the same fxn. Set for
+     * fxns compiled with an enclosure.
+     */
+    functor_t escalation;
+
+    /**
+     * If set, resize calls this with the new digits when they change, so a multiprecision fxn computes at the view's
+     * precision.
+     */
+    std::function<void(uint32_t)> on_precision;
+
+    /**
+     * If set, estimates the error of the value full_eval computes at a sample, relative to its magnitude (see
+     * fxn::estimate_error). Cancellation makes this large.
+     */
+    std::function<double(const D &)> error_estimate;
+
+    /**
+     * Stride of the first pass of refine.
+     */
+    static constexpr uint32_t coarsest_stride = 8;
+
+    /**
+     * Results at least this big are suspect, as they are close to a pole or to overflowing.
+     */
+    static constexpr double suspect_magnitude = 1e150;
+
     /**
      * Constructs a multipoint with the given initial bounds. This has different behavior depending on the template
      * arguments. For real or integer domains, the sample points are constructed as a standard doubly-closed interval.
@@ -60,6 +116,17 @@ public:
      */
     EMSCRIPTEN_KEEPALIVE multipoint(std::string _name, _domain_t from, _domain_t to, uint32_t res, functor_t _generator);
 
+    /**
+     * Instantiates a multipoint that is evaluated natively, on the bytecode VM (native_fxn, or native_dd_fxn for
+     * double-double ranges) or as x86-64 code (x64_fxn).
+     * @param f the fxn to evaluate
+     * @param from lower bound
+     * @param to upper bound
+     * @param res number of samples per unit distance
+     */
+    template <typename FxnType> multipoint(fxn<_range_t, FxnType> f, const _domain_t &from, const _domain_t &to, uint32_t res);
+
+#ifdef __EMSCRIPTEN__
     /**
      * Called from javascript to instantiate a multipoint.
      * @param f the fxn to evaluate
@@ -68,6 +135,7 @@ public:
      * @param res number of samples per unit distance
      */
     EMSCRIPTEN_KEEPALIVE multipoint(fxn<_range_t, compiled_fxn<_range_t>> f, D_JS from, D_JS to, uint32_t res);
+#endif
 
     /**
      * Get a (domain, range) pair on the fxn.
@@ -77,10 +145,45 @@ public:
     EMSCRIPTEN_KEEPALIVE std::pair<_domain_t, _range_t> operator[](size_t n);
 
     /**
-     * Calculate the value of the fxn at each point in the sample vector.
+     * Calculate the value of the fxn at each point in the sample vector. See parallel.
      */
     EMSCRIPTEN_KEEPALIVE void full_eval();
 
+    /**
+     * Evaluates the samples coarse to fine, so there is something to show long before full_eval would be done. The
+     * first call evaluates the samples in every coarsest_stride-th column of every coarsest_stride-th row, and fills in
+     * the values and colors of the rest with copies of them, so each is drawn as a block. Each call after that halves the
+     * stride, evaluating only the samples it adds, until every sample is evaluated. In between, `values` and `colors`
+     * hold the partial image.
+     * @return the stride of the samples evaluated so far, which is 1 once the values are the same as full_eval's. Calling
+     * it again then does nothing, unless the values are stale, in which case it starts over.
+     */
+    EMSCRIPTEN_KEEPALIVE uint32_t refine();
+
+    /**
+     * Evaluates every sample like full_eval, then re-evaluates the suspect ones with `escalation`: those whose value
+     * isn't finite or is at least suspect_magnitude, and those whose error_estimate exceeds `tolerance`. The samples are
+     * screened on the pool if `parallel` is set.
+     * @return the number of samples that were re-evaluated
+     */
+    EMSCRIPTEN_KEEPALIVE uint32_t mixed_eval(double tolerance);
+
+#ifdef __EMSCRIPTEN__
+    /**
+     * Uses a multiprecision fxn as the escalation, see mixed_eval. Only for double precision multipoints.
+     */
+    EMSCRIPTEN_KEEPALIVE void set_escalation(fxn<mp_complex, compiled_fxn<mp_complex>> f);
+#endif
+
+    /**
+     * A multipoint is stale once the fxn it was evaluated from, or one that fxn calls, has been redefined. Dependents
+     * that call the redefined fxn through its table slot pick up the new code on their own, but inlined ones have to
+     * be compiled again (see globals::dependents) before the multipoint is re-evaluated.
+     * @return whether the values were computed before the last redefinition
+     */
+    EMSCRIPTEN_KEEPALIVE bool is_stale();
+
+#ifdef __EMSCRIPTEN__
     /**
      * Get an array representing each point in the calculated range of the function, as a javascript Float64Array. Makes a copy only
      * if the range is a multiprecision complex number.
@@ -94,16 +197,29 @@ public:
      * @return
      */
     EMSCRIPTEN_KEEPALIVE emscripten::val get_colors();
+#endif
 
     /**
      * Resizes the multipoint bounds. Will resize the `values` vector as well, computing any new values required
-     * for the specified resolution. If not specified, the resolution is taken to be the initial resolution.
+     * for the specified resolution. If not specified, the resolution is taken to be the current resolution.
+     *
+     * For a complex domain, samples of the new lattice that are also on the old one keep their values and colors, so
+     * panning by whole samples only evaluates the strips that come into view, and changing the resolution by an integer
+     * factor only evaluates the points in between (or nothing, when zooming out). Otherwise, and if the values are
+     * stale or incomplete (see refine), every sample is evaluated.
      *
      * @param from left endpoint
      * @param to right endpoint
      * @param res number of sample points per unit distance
      */
     EMSCRIPTEN_KEEPALIVE void resize(const _domain_t &from, const _domain_t &to, uint32_t res = 0);
+
+#ifdef __EMSCRIPTEN__
+    /**
+     * Called from javascript to resize the multipoint, see resize.
+     */
+    EMSCRIPTEN_KEEPALIVE void resize_js(D_JS from, D_JS to, uint32_t res);
+#endif
 };
 
 #endif //GLAM_MULTIPOINT_H
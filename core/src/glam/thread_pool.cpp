@@ -0,0 +1,126 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include "utilities.h"
+
+thread_local uint32_t thread_pool::current_lane = 0;
+
+thread_pool::thread_pool(uint32_t _lanes): lanes(std::max<uint32_t>(1, _lanes)) {
+#ifndef GLAM_THREADS
+    lanes = 1;
+#endif
+    for (uint32_t i = 0; i < lanes; i++) {
+        queues.push_back(std::make_unique<tile_queue>());
+    }
+    for (uint32_t i = 1; i < lanes; i++) {
+        workers.emplace_back(&thread_pool::work, this, i);
+    }
+    GLAM_TRACE("thread pool with " << lanes << " lanes");
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    std::for_each(workers.begin(), workers.end(), [](auto &t) { t.join(); });
+}
+
+thread_pool &thread_pool::shared() {
+    static thread_pool pool(std::thread::hardware_concurrency());
+    return pool;
+}
+
+void thread_pool::run(size_t tiles, const tile_f &body) {
+    if (lanes == 1 || tiles <= 1) {
+        for (size_t i = 0; i < tiles; i++) {
+            body(i);
+        }
+        return;
+    }
+    std::lock_guard<std::mutex> turn(run_lock);
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        // a worker that woke up late for the last job may still be looking for its tiles
+        idle.wait(guard, [this]() { return busy == 0; });
+        // contiguous blocks, so neighbouring tiles tend to run on the same lane
+        for (uint32_t i = 0; i < lanes; i++) {
+            std::lock_guard<std::mutex> q(queues[i]->lock);
+            for (size_t t = tiles * i / lanes; t < tiles * (i + 1) / lanes; t++) {
+                queues[i]->tiles.push_back(t);
+            }
+        }
+        job = &body;
+        generation++;
+    }
+    wake.notify_all();
+    drain(0, body);
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]() { return busy == 0; });
+    job = nullptr;
+}
+
+void thread_pool::work(uint32_t worker) {
+    current_lane = worker;
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> guard(lock);
+    while (true) {
+        wake.wait(guard, [&]() { return stopping || generation != seen; });
+        if (stopping) {
+            return;
+        }
+        seen = generation;
+        if (!job) {
+            continue; // the job finished before this worker got to it
+        }
+        const tile_f &body = *job;
+        busy++;
+        guard.unlock();
+        drain(worker, body);
+        guard.lock();
+        if (--busy == 0) {
+            idle.notify_all();
+        }
+    }
+}
+
+void thread_pool::drain(uint32_t own, const tile_f &body) {
+    for (uint32_t k = 0; k < lanes; k++) {
+        auto &queue = *queues[(own + k) % lanes];
+        while (true) {
+            size_t tile;
+            {
+                std::lock_guard<std::mutex> q(queue.lock);
+                if (queue.tiles.empty()) {
+                    break;
+                }
+                // the owner works front to back and thieves back to front, so they only meet at the last tile
+                if (k == 0) {
+                    tile = queue.tiles.front();
+                    queue.tiles.pop_front();
+                } else {
+                    tile = queue.tiles.back();
+                    queue.tiles.pop_back();
+                }
+            }
+            body(tile);
+        }
+    }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAM_THREAD_POOL_H
+#define GLAM_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs numbered tiles of work across a fixed set of threads. Each thread is a lane: the thread calling run() is lane 0,
+ * and the pool's workers are lanes 1 to size() - 1. The tiles are dealt out to the lanes in contiguous blocks, and a
+ * lane that runs out of its own steals from the far end of another's, so uneven tiles still keep every lane busy.
+ *
+ * Builds without GLAM_THREADS have no workers, and run() does every tile on the calling thread.
+ */
+class thread_pool {
+public:
+    using tile_f = std::function<void(size_t tile)>;
+
+    /**
+     * @param lanes number of threads to run tiles on, including the caller. at least 1
+     */
+    explicit thread_pool(uint32_t lanes);
+
+    ~thread_pool();
+
+    thread_pool(const thread_pool &) = delete;
+
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    /**
+     * The pool multipoints evaluate on, with a lane per hardware thread.
+     */
+    static thread_pool &shared();
+
+    /**
+     * @return the lane of the calling thread, which is 0 for threads that aren't workers of a pool. fixed_arena uses it
+     * to give each lane its own slots.
+     */
+    static uint32_t lane() {
+        return current_lane;
+    }
+
+    uint32_t size() const {
+        return lanes;
+    }
+
+    /**
+     * Calls `body` once for each tile in [0, tiles), and returns once they're all done. Tiles can run in any order and
+     * concurrently, but each one runs on a single lane. Calls from different threads take turns, and a tile can't call
+     * run() itself.
+     */
+    void run(size_t tiles, const tile_f &body);
+
+private:
+    struct tile_queue {
+        std::mutex lock;
+        std::deque<size_t> tiles;
+    };
+
+    static thread_local uint32_t current_lane;
+
+    uint32_t lanes;
+    std::vector<std::unique_ptr<tile_queue>> queues; // one per lane
+    std::vector<std::thread> workers;
+
+    std::mutex run_lock; // serializes run()
+    std::mutex lock; // guards everything below
+    std::condition_variable wake; // signalled when there is a new job, or the pool is stopping
+    std::condition_variable idle; // signalled when the last busy worker finishes
+    const tile_f *job = nullptr;
+    uint64_t generation = 0; // of the job, so workers join each one once
+    uint32_t busy = 0; // workers that have joined a job and not yet run out of tiles
+    bool stopping = false;
+
+    void work(uint32_t worker);
+
+    // runs tiles until there are none left in any queue, starting with `own`
+    void drain(uint32_t own, const tile_f &body);
+};
+
+#endif //GLAM_THREAD_POOL_H
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tile_cache.h"
+#include "utilities.h"
+
+tile_cache::lru_list tile_cache::entries;
+std::unordered_map<tile_key, tile_cache::lru_list::iterator, tile_key_hash> tile_cache::index;
+size_t tile_cache::budget = 64 << 20; // about 50 tiles of 256x256
+size_t tile_cache::size = 0;
+uint32_t tile_cache::hits = 0;
+uint32_t tile_cache::misses = 0;
+
+std::shared_ptr<const tile> tile_cache::lookup(const tile_key &key) {
+    auto iter = index.find(key);
+    if (iter == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->second;
+}
+
+void tile_cache::insert(const tile_key &key, std::shared_ptr<const tile> t) {
+    auto existing = index.find(key);
+    if (existing != index.end()) {
+        size -= existing->second->second->bytes();
+        entries.erase(existing->second);
+        index.erase(existing);
+    }
+    const size_t bytes = t->bytes();
+    if (bytes > budget) {
+        return;
+    }
+    evict(budget - bytes);
+    entries.emplace_front(key, std::move(t));
+    index[key] = entries.begin();
+    size += bytes;
+    GLAM_TRACE("cached tile (" << key.x << ", " << key.y << ") at zoom " << key.zoom << " of " << key.fxn_name << " (" << size
+                               << "/" << budget << " bytes)");
+}
+
+void tile_cache::evict(size_t target_size) {
+    while (size > target_size && !entries.empty()) {
+        size -= entries.back().second->bytes();
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+void tile_cache::set_budget(uint32_t _budget) {
+    budget = _budget;
+    evict(budget);
+}
+
+void tile_cache::clear() {
+    evict(0);
+    hits = 0;
+    misses = 0;
+}
+
+uint32_t tile_cache::get_hits() {
+    return hits;
+}
+
+uint32_t tile_cache::get_misses() {
+    return misses;
+}
+
+uint32_t tile_cache::get_size() {
+    return size;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAM_TILE_CACHE_H
+#define GLAM_TILE_CACHE_H
+
+#include <complex>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "colors.h"
+
+/**
+ * Identifies a tile of the plane, see tiled_multipoint. The revision (see globals::revision) stands in for the compiled
+ * fxn, since every definition of a fxn gets a new one.
+ */
+struct tile_key {
+    std::string fxn_name;
+    uint64_t revision;
+    int32_t zoom;
+    int64_t x;
+    int64_t y;
+
+    bool operator==(const tile_key &other) const {
+        return fxn_name == other.fxn_name && revision == other.revision && zoom == other.zoom && x == other.x && y == other.y;
+    }
+};
+
+struct tile_key_hash {
+    size_t operator()(const tile_key &key) const {
+        size_t h = std::hash<std::string>()(key.fxn_name);
+        for (uint64_t v : { key.revision, static_cast<uint64_t>(key.zoom), static_cast<uint64_t>(key.x), static_cast<uint64_t>(key.y) }) {
+            h ^= std::hash<uint64_t>()(v) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+};
+
+/**
+ * The values and colors of an evaluated tile, row by row from its lower-left corner.
+ */
+struct tile {
+    std::vector<std::complex<double>> values;
+    std::vector<rgba> colors;
+
+    size_t bytes() const {
+        return values.size() * sizeof(std::complex<double>) + colors.size() * sizeof(rgba);
+    }
+};
+
+/**
+ * LRU cache of evaluated tiles, bounded by the memory they take up. Tiles are shared, so one that is evicted while it's
+ * still being drawn stays valid until it's let go of.
+ */
+struct tile_cache {
+    /**
+     * Looks up a tile, counting a hit or a miss.
+     * @return the tile, or nullptr if there is none
+     */
+    static std::shared_ptr<const tile> lookup(const tile_key &key);
+
+    /**
+     * Caches a tile, evicting the least recently used ones until it fits the budget. A tile bigger than the whole budget
+     * isn't cached.
+     */
+    static void insert(const tile_key &key, std::shared_ptr<const tile> t);
+
+    /**
+     * @param budget the most memory cached tiles may take up, in bytes
+     */
+    static void set_budget(uint32_t budget);
+
+    static void clear();
+
+    static uint32_t get_hits();
+
+    static uint32_t get_misses();
+
+    /**
+     * @return the memory the cached tiles take up, in bytes
+     */
+    static uint32_t get_size();
+
+private:
+    using lru_list = std::list<std::pair<tile_key, std::shared_ptr<const tile>>>;
+
+    static lru_list entries; // most recently used first
+    static std::unordered_map<tile_key, lru_list::iterator, tile_key_hash> index;
+    static size_t budget;
+    static size_t size;
+    static uint32_t hits;
+    static uint32_t misses;
+
+    static void evict(size_t target_size);
+};
+
+#endif //GLAM_TILE_CACHE_H
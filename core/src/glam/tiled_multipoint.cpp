@@ -0,0 +1,129 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tiled_multipoint.h"
+
+#include <algorithm>
+#include <cmath>
+#ifdef __EMSCRIPTEN__
+#include <emscripten/bind.h>
+#endif
+#include "jit/globals.h"
+#include "vm/bytecode.h"
+#include "vm/x64_jit.h"
+
+template <typename FxnType> tiled_multipoint::tiled_multipoint(fxn<C, FxnType> f): name(f.get_fxn_name()) {
+    make_tile = [f](const C &from, const C &to, uint32_t res) {
+        return multipoint<C, C>(f, from, to, res);
+    };
+    colors.buffer = nullptr;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE tiled_multipoint::tiled_multipoint(fxn<C, compiled_fxn<C>> f): name(f.get_fxn_name()) {
+    make_tile = [f](const C &from, const C &to, uint32_t res) {
+        return multipoint<C, C>(f, js_complex { from.real(), from.imag() }, js_complex { to.real(), to.imag() }, res);
+    };
+    colors.buffer = nullptr;
+}
+#endif
+
+tiled_multipoint::~tiled_multipoint() {
+    delete[] colors.buffer;
+}
+
+uint32_t tiled_multipoint::resolution(int32_t zoom) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(tile_size) << (std::clamp(zoom, min_zoom, max_zoom) - min_zoom)) >> -min_zoom);
+}
+
+std::shared_ptr<const tile> tiled_multipoint::get_tile(const tile_key &key, uint32_t res, uint32_t &evaluated) {
+    auto cached = tile_cache::lookup(key);
+    if (cached) {
+        return cached;
+    }
+    // powers of two, so the corners and the samples between them are exact
+    const double span = static_cast<double>(tile_size) / res;
+    const C from(key.x * span, key.y * span);
+    auto mpt = make_tile(from, from + C(span, span), res);
+    mpt.full_eval();
+    auto t = std::make_shared<tile>();
+    t->values = std::move(mpt.values);
+    t->colors.assign(mpt.colors.buffer, mpt.colors.buffer + mpt.colors.length);
+    delete[] mpt.colors.buffer;
+    tile_cache::insert(key, t);
+    evaluated++;
+    return t;
+}
+
+EMSCRIPTEN_KEEPALIVE uint32_t tiled_multipoint::view(const C &from, const C &to, int32_t _zoom) {
+    zoom = std::clamp(_zoom, min_zoom, max_zoom);
+    const uint32_t res = resolution(zoom);
+    // the view's samples, counted from the origin of the plane
+    const auto x0 = static_cast<int64_t>(std::floor(from.real() * res)), x1 = static_cast<int64_t>(std::ceil(to.real() * res));
+    const auto y0 = static_cast<int64_t>(std::floor(from.imag() * res)), y1 = static_cast<int64_t>(std::ceil(to.imag() * res));
+    width = std::max<int64_t>(1, x1 - x0);
+    height = std::max<int64_t>(1, y1 - y0);
+    origin = C(static_cast<double>(x0) / res, static_cast<double>(y0) / res);
+    values.resize(static_cast<size_t>(width) * height);
+    delete[] colors.buffer;
+    colors = color_buffer(values.size());
+
+    const uint64_t revision = globals::revision(name);
+    auto tile_of = [](int64_t sample) {
+        // rounds toward negative infinity
+        return sample >= 0 ? sample / tile_size : -((-sample + tile_size - 1) / tile_size);
+    };
+    uint32_t evaluated = 0;
+    for (int64_t ty = tile_of(y0); ty <= tile_of(y0 + height - 1); ty++) {
+        for (int64_t tx = tile_of(x0); tx <= tile_of(x0 + width - 1); tx++) {
+            auto t = get_tile({ name, revision, zoom, tx, ty }, res, evaluated);
+            // the part of the tile in the view, in samples from the view's origin
+            const int64_t left = std::max<int64_t>(tx * tile_size, x0) - x0;
+            const int64_t right = std::min<int64_t>((tx + 1) * tile_size, x0 + width) - x0;
+            const int64_t bottom = std::max<int64_t>(ty * tile_size, y0) - y0;
+            const int64_t top = std::min<int64_t>((ty + 1) * tile_size, y0 + height) - y0;
+            for (int64_t row = bottom; row < top; row++) {
+                const size_t src = static_cast<size_t>(row + y0 - ty * tile_size) * tile_size + (left + x0 - tx * tile_size);
+                const size_t dst = static_cast<size_t>(row) * width + left;
+                std::copy_n(&t->values[src], right - left, &values[dst]);
+                std::copy_n(&t->colors[src], right - left, &colors.buffer[dst]);
+            }
+        }
+    }
+    GLAM_TRACE("viewed " << width << "x" << height << " samples of " << name << " at zoom " << zoom << ", evaluating " << evaluated
+                         << " tiles");
+    return evaluated;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE uint32_t tiled_multipoint::view_js(js_complex from, js_complex to, int32_t _zoom) {
+    return view(C(from.real, from.imag), C(to.real, to.imag), _zoom);
+}
+
+EMSCRIPTEN_KEEPALIVE emscripten::val tiled_multipoint::get_values() {
+    return emscripten::val(emscripten::typed_memory_view(values.size() * 2, reinterpret_cast<double *>(values.data())));
+}
+
+EMSCRIPTEN_KEEPALIVE emscripten::val tiled_multipoint::get_colors() {
+    return emscripten::val(emscripten::typed_memory_view(colors.length * 4, reinterpret_cast<uint8_t *>(colors.buffer)));
+}
+#endif
+
+template tiled_multipoint::tiled_multipoint(fxn<C, native_fxn> f);
+
+#ifdef GLAM_X64_JIT
+template tiled_multipoint::tiled_multipoint(fxn<C, x64_fxn> f);
+#endif
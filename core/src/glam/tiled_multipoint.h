@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAM_TILED_MULTIPOINT_H
+#define GLAM_TILED_MULTIPOINT_H
+
+#include "multipoint.h"
+#include "tile_cache.h"
+
+/**
+ * Renders a complex fxn a tile at a time, like a map. At zoom level z the plane is divided into squares of side 2^-z,
+ * each sampled at tile_size x tile_size points, and tile (x, y) is the one with its lower-left corner at (x + yi) * 2^-z.
+ * Tiles are kept in tile_cache, so panning only evaluates the tiles that come into view, and returning to a view
+ * evaluates nothing.
+ */
+class tiled_multipoint {
+public:
+    using C = std::complex<double>;
+    using tile_factory = std::function<multipoint<C, C>(const C &, const C &, uint32_t)>;
+
+    static constexpr uint32_t tile_size = 256;
+
+    // the resolution, tile_size * 2^zoom, has to be a whole number of samples per unit, and fit a uint32_t
+    static constexpr int32_t min_zoom = -8;
+    static constexpr int32_t max_zoom = 23;
+
+    std::string name;
+
+    // the view, as of the last call to view(). its samples are those of the zoom level's lattice that are in the
+    // rectangle, and `origin` is the one in its lower-left corner
+    int32_t zoom = 0;
+    C origin;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<C> values;
+    color_buffer colors;
+
+    /**
+     * @param f the fxn to evaluate, natively (see multipoint)
+     */
+    template <typename FxnType> explicit tiled_multipoint(fxn<C, FxnType> f);
+
+#ifdef __EMSCRIPTEN__
+    /**
+     * Called from javascript to instantiate a tiled multipoint.
+     */
+    EMSCRIPTEN_KEEPALIVE explicit tiled_multipoint(fxn<C, compiled_fxn<C>> f);
+#endif
+
+    ~tiled_multipoint();
+
+    tiled_multipoint(const tiled_multipoint &) = delete;
+
+    tiled_multipoint &operator=(const tiled_multipoint &) = delete;
+
+    /**
+     * @return samples per unit distance at a zoom level
+     */
+    static uint32_t resolution(int32_t zoom);
+
+    /**
+     * Evaluates the rectangle with corners `from` and `to` at a zoom level, reusing cached tiles, and puts together the
+     * values and colors of the view.
+     * @return the number of tiles that had to be evaluated
+     */
+    EMSCRIPTEN_KEEPALIVE uint32_t view(const C &from, const C &to, int32_t zoom);
+
+#ifdef __EMSCRIPTEN__
+    EMSCRIPTEN_KEEPALIVE uint32_t view_js(js_complex from, js_complex to, int32_t zoom);
+
+    /**
+     * See multipoint::get_values.
+     */
+    EMSCRIPTEN_KEEPALIVE emscripten::val get_values();
+
+    /**
+     * See multipoint::get_colors.
+     */
+    EMSCRIPTEN_KEEPALIVE emscripten::val get_colors();
+#endif
+
+private:
+    tile_factory make_tile;
+
+    std::shared_ptr<const tile> get_tile(const tile_key &key, uint32_t res, uint32_t &evaluated);
+};
+
+#endif //GLAM_TILED_MULTIPOINT_H
@@ -15,6 +15,42 @@
  */
 
 #include "types.h"
+#include <algorithm>
+#include <cmath>
+
+namespace mp_precision {
+    namespace {
+        uint32_t for_magnitude(double magnitude, uint32_t res) {
+            double digits = std::ceil(std::log10(std::max(magnitude, 1.) * std::max<uint32_t>(res, 1))) + guard_digits;
+            if (!(digits < max_digits)) { // also catches magnitudes beyond a double
+                return max_digits;
+            }
+            return std::max(min_digits, static_cast<uint32_t>(digits));
+        }
+
+        // the types start out at boost's default of 50 digits, twice what most views need
+        const bool initialized = (set(default_digits), true);
+    }
+
+    uint32_t get() {
+        return mp_complex::default_precision();
+    }
+
+    void set(uint32_t digits) {
+        mp_float::default_precision(digits);
+        mp_complex::default_precision(digits);
+        boost::multiprecision::mpfr_float::default_precision(digits); // the parts of an mp_complex
+    }
+
+    uint32_t for_view(const mp_float &from, const mp_float &to, uint32_t res) {
+        return for_magnitude(std::max(std::abs(from.convert_to<double>()), std::abs(to.convert_to<double>())), res);
+    }
+
+    uint32_t for_view(const mp_complex &from, const mp_complex &to, uint32_t res) {
+        return for_magnitude(std::max(std::abs(from.convert_to<std::complex<double>>()), std::abs(to.convert_to<std::complex<double>>())),
+                             res);
+    }
+}
 
 namespace glam_literals {
     mp_complex operator "" _i(long double f) {
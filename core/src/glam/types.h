@@ -17,12 +17,59 @@
 #ifndef GLAM_TYPES_H
 #define GLAM_TYPES_H
 
+#include <cstdint>
 #include <boost/multiprecision/gmp.hpp>
 #include <boost/multiprecision/mpc.hpp>
 #include <boost/math/constants/constants.hpp>
+#include "dd_complex.h"
 
-typedef boost::multiprecision::number<boost::multiprecision::gmp_float<25>> mp_float;
-typedef boost::multiprecision::number<boost::multiprecision::mpc_complex_backend<25>> mp_complex;
+typedef boost::multiprecision::number<boost::multiprecision::gmp_float<0>> mp_float;
+typedef boost::multiprecision::number<boost::multiprecision::mpc_complex_backend<0>> mp_complex;
+
+/**
+ * mp_float and mp_complex have variable precision, in decimal digits. New values get the default precision, and results
+ * get the precision of whatever they are written to, so a computation runs at the precision that was the default when
+ * its values were created. Each view picks the least precision it needs with for_view, and holds it with a scope while
+ * its samples and values are created.
+ */
+namespace mp_precision {
+    constexpr uint32_t min_digits = 18; // enough for every double to convert exactly
+    constexpr uint32_t default_digits = 25; // what the types were fixed at before
+    constexpr uint32_t max_digits = 1000;
+    constexpr uint32_t guard_digits = 8; // kept beyond the digits that tell samples apart, for rounding inside the fxn
+
+    uint32_t get();
+
+    void set(uint32_t digits);
+
+    /**
+     * @return the precision to evaluate [from, to] at with `res` samples per unit distance, between min_digits and
+     * max_digits
+     */
+    uint32_t for_view(const mp_float &from, const mp_float &to, uint32_t res);
+
+    uint32_t for_view(const mp_complex &from, const mp_complex &to, uint32_t res);
+
+    /**
+     * Sets the default precision for as long as it lives.
+     */
+    class scope {
+        uint32_t saved;
+
+    public:
+        explicit scope(uint32_t digits): saved(get()) {
+            set(digits);
+        }
+
+        ~scope() {
+            set(saved);
+        }
+
+        scope(const scope &) = delete;
+
+        scope &operator=(const scope &) = delete;
+    };
+}
 
 #define mp_e boost::math::constants::e<mp_float>()
 #define mp_pi boost::math::constants::pi<mp_float>()
@@ -47,6 +47,9 @@ template <typename T, typename Cont> void latspace(const T &left, const T &right
 template void latspace<mp_complex, std::vector<mp_complex>>(const mp_complex &left, const mp_complex &right, const mp_complex &spacing,
                                                             std::vector<mp_complex> &cont);
 
+template void latspace<dd_complex, std::vector<dd_complex>>(const dd_complex &left, const dd_complex &right, const dd_complex &spacing,
+                                                            std::vector<dd_complex> &cont);
+
 template void latspace<std::complex<double>, std::vector<std::complex<double>>>(const std::complex<double> &left,
                                                                                 const std::complex<double> &right,
                                                                                 const std::complex<double> &spacing,
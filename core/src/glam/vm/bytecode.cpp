@@ -0,0 +1,644 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bytecode.h"
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include "../jit/globals.h"
+#include "../jit/inline_math.h"
+#include "../jit/stack_optimizer.h"
+
+std::map<std::string, std::shared_ptr<const vm_program>> bytecode_compiler::programs;
+
+namespace {
+    const std::map<std::string, vm_opcode> operator_opcodes = { std::make_pair("+", OP_ADD), std::make_pair("-", OP_SUB),
+            std::make_pair("*", OP_MUL), std::make_pair("/", OP_DIV), std::make_pair("^", OP_POW),
+            std::make_pair(expr_dag::neg_operator, OP_NEG), std::make_pair("sin", OP_SIN), std::make_pair("cos", OP_COS),
+            std::make_pair("tan", OP_TAN), std::make_pair("sinh", OP_SINH), std::make_pair("cosh", OP_COSH),
+            std::make_pair("tanh", OP_TANH) };
+
+    const char *opcode_names[] = { "const", "param", "add", "sub", "mul", "div", "pow", "powi", "neg", "sin", "cos", "tan", "sinh",
+            "cosh", "tanh", "call" };
+
+    using complex_pair = std::pair<double, double>;
+
+    std::complex<double> from_pair(complex_pair p) {
+        return { p.first, p.second };
+    }
+
+    std::complex<double> mul(std::complex<double> x, std::complex<double> y) {
+        // same order of operations as function_visitor::visit_mul, rather than std::complex's
+        return { x.real() * y.real() - x.imag() * y.imag(), x.real() * y.imag() + x.imag() * y.real() };
+    }
+
+    // each eval gets its registers from here, so only the first eval on a thread allocates
+    thread_local std::vector<std::complex<double>> scratch;
+    thread_local std::vector<dd_complex> scratch_dd;
+
+    // rewrites x^n, for an integer n that is written out, the way stack_optimizer::fold does for constant exponents. Exact
+    // builds don't fold, so this is the only way they get multiplication chains instead of exp(n log x)
+    expr_id integer_powers(expr_dag &dag, expr_id id, std::unordered_map<expr_id, expr_id> &rewritten) {
+        auto memo = rewritten.find(id);
+        if (memo != rewritten.end()) {
+            return memo->second;
+        }
+        // copy what we need, since making new nodes can move the old ones
+        const auto kind = dag[id].kind;
+        const auto name = dag[id].name;
+        const auto exponent = dag[id].exponent;
+        auto args = dag[id].args;
+        for (auto &arg : args) {
+            arg = integer_powers(dag, arg, rewritten);
+        }
+
+        expr_id result = id;
+        if (kind == EXPR_OPERATOR && name == "^" && dag[args[1]].kind == EXPR_NUMBER) {
+            auto e = dd_real::parse(dag[args[1]].name);
+            if (e.lo == 0 && std::floor(e.hi) == e.hi && e.hi >= 1 && e.hi <= stack_optimizer::max_power) {
+                const int n = static_cast<int>(e.hi);
+                result = n >= 2 ? dag.power(args[0], n) : args[0];
+            } else {
+                result = dag.op(name, args);
+            }
+        } else if (kind == EXPR_OPERATOR) {
+            result = dag.op(name, args);
+        } else if (kind == EXPR_FXNCALL) {
+            result = dag.fxncall(name, args[0]);
+        } else if (kind == EXPR_POWER) {
+            result = dag.power(args[0], exponent);
+        }
+        rewritten[id] = result;
+        return result;
+    }
+}
+
+std::complex<double> vm_program::run(std::complex<double> z, std::complex<double> *frame) const {
+    scalar_math_ops ops;
+    inline_math<scalar_math_ops> math(ops);
+    for (const auto &ins : code) {
+        auto &dst = frame[ins.dst];
+        if (ins.op == OP_CONST) {
+            dst = constants[ins.a];
+            continue;
+        } else if (ins.op == OP_PARAM) {
+            dst = z;
+            continue;
+        }
+        // operands are read before dst is written, since dst can be one of them
+        const auto a = frame[ins.a];
+        const auto b = ins.op <= OP_POW ? frame[ins.b] : a;
+        switch (ins.op) {
+            case OP_CONST:
+            case OP_PARAM:
+                break;
+            case OP_ADD:
+                dst = { a.real() + b.real(), a.imag() + b.imag() };
+                break;
+            case OP_SUB:
+                dst = { a.real() - b.real(), a.imag() - b.imag() };
+                break;
+            case OP_MUL:
+                dst = mul(a, b);
+                break;
+            case OP_DIV:
+                dst = from_pair(math.cdiv(a.real(), a.imag(), b.real(), b.imag()));
+                break;
+            case OP_POW:
+                dst = from_pair(math.cpow(a.real(), a.imag(), b.real(), b.imag()));
+                break;
+            case OP_POWI: {
+                // left-to-right binary exponentiation, the same chain expr_dag emits for the wasm compiler
+                int bit = 0;
+                while ((ins.b >> (bit + 1)) != 0) {
+                    bit++;
+                }
+                auto power = a;
+                while (bit-- > 0) {
+                    power = mul(power, power);
+                    if ((ins.b >> bit) & 1) {
+                        power = mul(power, a);
+                    }
+                }
+                dst = power;
+                break;
+            }
+            case OP_NEG:
+                dst = { -a.real(), -a.imag() };
+                break;
+            case OP_SIN:
+                dst = from_pair(math.csin(a.real(), a.imag()));
+                break;
+            case OP_COS:
+                dst = from_pair(math.ccos(a.real(), a.imag()));
+                break;
+            case OP_TAN:
+                dst = from_pair(math.ctan(a.real(), a.imag()));
+                break;
+            case OP_SINH:
+                dst = from_pair(math.csinh(a.real(), a.imag()));
+                break;
+            case OP_COSH:
+                dst = from_pair(math.ccosh(a.real(), a.imag()));
+                break;
+            case OP_TANH:
+                dst = from_pair(math.ctanh(a.real(), a.imag()));
+                break;
+            case OP_CALL:
+                dst = callees[ins.b]->run(a, frame + registers);
+                break;
+        }
+    }
+    return frame[result];
+}
+
+dd_complex vm_program::run(const dd_complex &z, dd_complex *frame) const {
+    for (const auto &ins : code) {
+        auto &dst = frame[ins.dst];
+        if (ins.op == OP_CONST) {
+            dst = constants_dd[ins.a];
+            continue;
+        } else if (ins.op == OP_PARAM) {
+            dst = z;
+            continue;
+        }
+        const auto a = frame[ins.a];
+        const auto b = ins.op <= OP_POW ? frame[ins.b] : a;
+        switch (ins.op) {
+            case OP_CONST:
+            case OP_PARAM:
+                break;
+            case OP_ADD:
+                dst = a + b;
+                break;
+            case OP_SUB:
+                dst = a - b;
+                break;
+            case OP_MUL:
+                dst = a * b;
+                break;
+            case OP_DIV:
+                dst = a / b;
+                break;
+            case OP_POW:
+                dst = dd_math::pow(a, b);
+                break;
+            case OP_POWI:
+                dst = dd_math::powi(a, ins.b);
+                break;
+            case OP_NEG:
+                dst = -a;
+                break;
+            case OP_SIN:
+                dst = dd_math::sin(a);
+                break;
+            case OP_COS:
+                dst = dd_math::cos(a);
+                break;
+            case OP_TAN:
+                dst = dd_math::tan(a);
+                break;
+            case OP_SINH:
+                dst = dd_math::sinh(a);
+                break;
+            case OP_COSH:
+                dst = dd_math::cosh(a);
+                break;
+            case OP_TANH:
+                dst = dd_math::tanh(a);
+                break;
+            case OP_CALL:
+                dst = callees[ins.b]->run(a, frame + registers);
+                break;
+        }
+    }
+    return frame[result];
+}
+
+complex_ball vm_program::enclose(const complex_ball &region, complex_ball *frame) const {
+    for (const auto &ins : code) {
+        auto &dst = frame[ins.dst];
+        if (ins.op == OP_CONST) {
+            dst = { constants[ins.a], 0 };
+            continue;
+        } else if (ins.op == OP_PARAM) {
+            dst = region;
+            continue;
+        }
+        const auto a = frame[ins.a];
+        const auto b = ins.op <= OP_POW ? frame[ins.b] : a;
+        switch (ins.op) {
+            case OP_CONST:
+            case OP_PARAM:
+                break;
+            case OP_ADD:
+                dst = ball_math::add(a, b);
+                break;
+            case OP_SUB:
+                dst = ball_math::sub(a, b);
+                break;
+            case OP_MUL:
+                dst = ball_math::mul(a, b);
+                break;
+            case OP_DIV:
+                dst = ball_math::div(a, b);
+                break;
+            case OP_POW:
+                dst = ball_math::pow(a, b);
+                break;
+            case OP_POWI:
+                dst = ball_math::powi(a, ins.b);
+                break;
+            case OP_NEG:
+                dst = ball_math::neg(a);
+                break;
+            case OP_SIN:
+                dst = ball_math::sin(a);
+                break;
+            case OP_COS:
+                dst = ball_math::cos(a);
+                break;
+            case OP_TAN:
+                dst = ball_math::tan(a);
+                break;
+            case OP_SINH:
+                dst = ball_math::sinh(a);
+                break;
+            case OP_COSH:
+                dst = ball_math::cosh(a);
+                break;
+            case OP_TANH:
+                dst = ball_math::tanh(a);
+                break;
+            case OP_CALL:
+                dst = callees[ins.b]->enclose(a, frame + registers);
+                break;
+        }
+    }
+    return frame[result];
+}
+
+vm_running_value vm_program::run_with_error(std::complex<double> z, double error, vm_running_value *frame) const {
+    scalar_math_ops ops;
+    inline_math<scalar_math_ops> math(ops);
+    const double ulp = std::numeric_limits<double>::epsilon();
+    for (const auto &ins : code) {
+        auto &dst = frame[ins.dst];
+        if (ins.op == OP_CONST) {
+            // the constant was rounded from a literal, or folded
+            dst = { constants[ins.a], 0.5 * ulp * std::abs(constants[ins.a]) };
+            continue;
+        } else if (ins.op == OP_PARAM) {
+            dst = { z, error };
+            continue;
+        }
+        const auto a = frame[ins.a];
+        const auto b = ins.op <= OP_POW ? frame[ins.b] : a;
+        // the error the operands bring, scaled by the derivative, and the ulps this operation rounds off
+        double propagated = 0, ulps = 0;
+        switch (ins.op) {
+            case OP_CONST:
+            case OP_PARAM:
+                break;
+            case OP_ADD:
+                dst.value = { a.value.real() + b.value.real(), a.value.imag() + b.value.imag() };
+                propagated = a.error + b.error;
+                ulps = 0.5;
+                break;
+            case OP_SUB:
+                dst.value = { a.value.real() - b.value.real(), a.value.imag() - b.value.imag() };
+                propagated = a.error + b.error;
+                ulps = 0.5;
+                break;
+            case OP_MUL:
+                dst.value = mul(a.value, b.value);
+                propagated = std::abs(a.value) * b.error + std::abs(b.value) * a.error;
+                ulps = 1.5;
+                break;
+            case OP_DIV:
+                dst.value = from_pair(math.cdiv(a.value.real(), a.value.imag(), b.value.real(), b.value.imag()));
+                propagated = (a.error + std::abs(dst.value) * b.error) / std::abs(b.value);
+                ulps = 3.1;
+                break;
+            case OP_POW: {
+                // z^w = e^(w ln z), and the absolute error of w ln z becomes relative error in the result
+                dst.value = from_pair(math.cpow(a.value.real(), a.value.imag(), b.value.real(), b.value.imag()));
+                const double log_a = std::abs(std::log(a.value));
+                propagated = std::abs(dst.value) * (std::abs(b.value) * a.error / std::abs(a.value) + log_a * b.error);
+                ulps = 4 + 2 * std::abs(b.value) * log_a;
+                break;
+            }
+            case OP_POWI: {
+                int bit = 0;
+                while ((ins.b >> (bit + 1)) != 0) {
+                    bit++;
+                }
+                auto power = a.value;
+                for (int k = bit - 1; k >= 0; k--) {
+                    power = mul(power, power);
+                    if ((ins.b >> k) & 1) {
+                        power = mul(power, a.value);
+                    }
+                    ulps += ((ins.b >> k) & 1) ? 3 : 1.5;
+                }
+                dst.value = power;
+                propagated = ins.b * std::abs(power) * a.error / std::abs(a.value);
+                break;
+            }
+            case OP_NEG:
+                dst.value = -a.value;
+                propagated = a.error;
+                break;
+            // |sin'|, |cos'| <= cosh(Im z), and |sinh'|, |cosh'| <= cosh(Re z)
+            case OP_SIN:
+                dst.value = from_pair(math.csin(a.value.real(), a.value.imag()));
+                propagated = std::cosh(a.value.imag()) * a.error;
+                ulps = 4.3;
+                break;
+            case OP_COS:
+                dst.value = from_pair(math.ccos(a.value.real(), a.value.imag()));
+                propagated = std::cosh(a.value.imag()) * a.error;
+                ulps = 4.8;
+                break;
+            case OP_TAN:
+                dst.value = from_pair(math.ctan(a.value.real(), a.value.imag()));
+                propagated = std::abs(1. + dst.value * dst.value) * a.error;
+                ulps = 4.7;
+                break;
+            case OP_SINH:
+                dst.value = from_pair(math.csinh(a.value.real(), a.value.imag()));
+                propagated = std::cosh(a.value.real()) * a.error;
+                ulps = 4.3;
+                break;
+            case OP_COSH:
+                dst.value = from_pair(math.ccosh(a.value.real(), a.value.imag()));
+                propagated = std::cosh(a.value.real()) * a.error;
+                ulps = 4.8;
+                break;
+            case OP_TANH:
+                dst.value = from_pair(math.ctanh(a.value.real(), a.value.imag()));
+                propagated = std::abs(1. - dst.value * dst.value) * a.error;
+                ulps = 4.9;
+                break;
+            case OP_CALL:
+                dst = callees[ins.b]->run_with_error(a.value, a.error, frame + registers);
+                continue;
+        }
+        dst.error = propagated + ulps * ulp * std::abs(dst.value);
+    }
+    return frame[result];
+}
+
+std::string vm_program::disassemble() const {
+    std::stringstream out;
+    out << "; " << registers << " registers, frame size " << frame_size << "\n";
+    for (const auto &ins : code) {
+        out << "r" << ins.dst << " = " << opcode_names[ins.op];
+        switch (ins.op) {
+            case OP_CONST:
+                out << " " << constants[ins.a];
+                break;
+            case OP_PARAM:
+                break;
+            case OP_POWI:
+                out << " r" << ins.a << ", " << ins.b;
+                break;
+            case OP_CALL:
+                out << " " << callee_names[ins.b] << ", r" << ins.a;
+                break;
+            default:
+                out << " r" << ins.a;
+                if (ins.op <= OP_POW) {
+                    out << ", r" << ins.b;
+                }
+        }
+        out << "\n";
+    }
+    out << "ret r" << result << "\n";
+    return out.str();
+}
+
+std::complex<double> native_fxn::operator()(std::complex<double> z) {
+    if (scratch.size() < program->frame_size) {
+        scratch.resize(program->frame_size);
+    }
+    return program->run(z, scratch.data());
+}
+
+void native_fxn::eval_batch(const std::complex<double> *in, std::complex<double> *out, uint32_t count) {
+    if (scratch.size() < program->frame_size) {
+        scratch.resize(program->frame_size);
+    }
+    auto frame = scratch.data();
+    const vm_program &p = *program;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = p.run(in[i], frame);
+    }
+}
+
+bool native_fxn::ready() {
+    return program != nullptr;
+}
+
+void native_fxn::release() {
+    GLAM_TRACE("releasing native fxn " << this->name);
+    bytecode_compiler::forget(this->fxn_name, program);
+    program.reset();
+}
+
+dd_complex native_dd_fxn::operator()(dd_complex z) {
+    if (scratch_dd.size() < program->frame_size) {
+        scratch_dd.resize(program->frame_size);
+    }
+    return program->run(z, scratch_dd.data());
+}
+
+void native_dd_fxn::eval_batch(const dd_complex *in, dd_complex *out, uint32_t count) {
+    if (scratch_dd.size() < program->frame_size) {
+        scratch_dd.resize(program->frame_size);
+    }
+    auto frame = scratch_dd.data();
+    const vm_program &p = *program;
+    for (uint32_t i = 0; i < count; i++) {
+        out[i] = p.run(in[i], frame);
+    }
+}
+
+bool native_dd_fxn::ready() {
+    return program != nullptr;
+}
+
+void native_dd_fxn::release() {
+    GLAM_TRACE("releasing native dd fxn " << this->name);
+    bytecode_compiler::forget(this->fxn_name, program);
+    program.reset();
+}
+
+bool bytecode_compiler::forget(const std::string &fxn_name, const std::shared_ptr<const vm_program> &program) {
+    auto current = programs.find(fxn_name);
+    if (current == programs.end() || current->second != program) {
+        return false;
+    }
+    programs.erase(current);
+    globals::forget(fxn_name);
+    return true;
+}
+
+native_fxn bytecode_compiler::compile(const token_stack &tokens) {
+    auto program = build(tokens);
+    if (!program) {
+        return native_fxn(name, fxn_name, parameter_name, nullptr);
+    }
+    programs[fxn_name] = program;
+    globals::define(fxn_name, parameter_name, tokens);
+    GLAM_TRACE("[vm] compiled " << name << " to " << program->code.size() << " instructions");
+    return native_fxn(name, fxn_name, parameter_name, program);
+}
+
+native_dd_fxn bytecode_compiler::compile_dd(const token_stack &tokens) {
+    auto program = build(tokens, true);
+    if (!program) {
+        return native_dd_fxn(name, fxn_name, parameter_name, nullptr);
+    }
+    programs[fxn_name] = program;
+    globals::define(fxn_name, parameter_name, tokens);
+    GLAM_TRACE("[vm] compiled " << name << " to " << program->code.size() << " double-double instructions");
+    return native_dd_fxn(name, fxn_name, parameter_name, program);
+}
+
+std::shared_ptr<const vm_program> bytecode_compiler::compile_program(const token_stack &tokens) {
+    return build(tokens);
+}
+
+std::shared_ptr<vm_program> bytecode_compiler::build(const token_stack &tokens, bool exact) {
+    auto failed = [&](const std::string &why) {
+        GLAM_TRACE("[vm] can't compile " << name << ": " << why);
+        return nullptr;
+    };
+
+    // exact builds look globals up in consts_dd themselves, rather than having the dag round them
+    expr_dag dag(parameter_name, exact ? std::map<std::string, std::complex<double>>() : globals::consts_dp);
+    dag.set_exact_numbers(exact);
+    if (inline_calls) {
+        dag.set_definitions(&globals::definitions);
+    }
+    if (!dag.parse(tokens)) {
+        return failed("malformed stack");
+    }
+    if (exact) {
+        std::unordered_map<expr_id, expr_id> rewritten;
+        dag.set_root(integer_powers(dag, dag.get_root(), rewritten));
+    } else if (fold) {
+        stack_optimizer::fold(dag);
+    }
+    dag.prune(); // afterwards ids are in evaluation order, and the root is last
+
+    const expr_id count = dag.size();
+    std::vector<expr_id> last_use(count, 0);
+    for (expr_id id = 0; id < count; id++) {
+        for (auto arg : dag[id].args) {
+            last_use[arg] = id;
+        }
+    }
+    last_use[dag.get_root()] = count;
+
+    auto program = std::make_shared<vm_program>();
+    std::vector<uint16_t> reg(count);
+    std::vector<uint16_t> free_registers;
+    uint32_t callee_frames = 0;
+    for (expr_id id = 0; id < count; id++) {
+        const auto &n = dag[id];
+        for (size_t i = 0; i < n.args.size(); i++) {
+            bool repeated = i > 0 && n.args[i] == n.args[0];
+            if (last_use[n.args[i]] == id && !repeated) {
+                free_registers.push_back(reg[n.args[i]]);
+            }
+        }
+        if (free_registers.empty()) {
+            if (program->registers > std::numeric_limits<uint16_t>::max()) {
+                return failed("too many registers");
+            }
+            reg[id] = program->registers++;
+        } else {
+            reg[id] = free_registers.back();
+            free_registers.pop_back();
+        }
+
+        vm_instruction ins = { OP_CONST, reg[id], 0, 0 };
+        if (!n.args.empty()) {
+            ins.a = reg[n.args[0]];
+            ins.b = n.args.size() > 1 ? reg[n.args[1]] : 0;
+        }
+        switch (n.kind) {
+            case EXPR_CONSTANT:
+                ins.a = program->constants.size();
+                program->constants.push_back(n.value);
+                program->constants_dd.emplace_back(n.value);
+                break;
+            case EXPR_IDENTIFIER: {
+                auto z = globals::consts_dd.find(n.name);
+                if (n.name == parameter_name) {
+                    ins.op = OP_PARAM;
+                } else if (exact && z != globals::consts_dd.end()) {
+                    ins.a = program->constants.size();
+                    program->constants.push_back(static_cast<std::complex<double>>(z->second));
+                    program->constants_dd.push_back(z->second);
+                } else {
+                    return failed("unknown variable " + n.name);
+                }
+                break;
+            }
+            case EXPR_NUMBER: {
+                auto x = exact ? dd_real::parse(n.name) : std::numeric_limits<double>::quiet_NaN();
+                if (std::isnan(x.hi)) {
+                    return failed("can't parse number " + n.name);
+                }
+                ins.a = program->constants.size();
+                program->constants.push_back(static_cast<double>(x));
+                program->constants_dd.emplace_back(x);
+                break;
+            }
+            case EXPR_OPERATOR: {
+                auto op = operator_opcodes.find(n.name);
+                if (op == operator_opcodes.end()) {
+                    return failed("unknown operator " + n.name);
+                }
+                ins.op = op->second;
+                break;
+            }
+            case EXPR_FXNCALL: {
+                auto callee = programs.find(n.name);
+                if (callee == programs.end()) {
+                    return failed("unknown fxn " + n.name);
+                }
+                ins.op = OP_CALL;
+                ins.b = program->callees.size();
+                program->callees.push_back(callee->second);
+                program->callee_names.push_back(n.name);
+                callee_frames = std::max(callee_frames, callee->second->frame_size);
+                break;
+            }
+            case EXPR_POWER:
+                ins.op = OP_POWI;
+                ins.b = n.exponent;
+                break;
+        }
+        program->code.push_back(ins);
+    }
+    program->result = reg[dag.get_root()];
+    program->frame_size = program->registers + callee_frames;
+    return program;
+}
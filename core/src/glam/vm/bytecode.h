@@ -0,0 +1,243 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_BYTECODE_H
+#define GLAMCORE_BYTECODE_H
+
+#include <complex>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../fxn.h"
+#include "../jit/expr_dag.h"
+#include "complex_ball.h"
+
+/**
+ * Opcodes of the bytecode VM. Every instruction reads its operands from registers a and b and writes register dst,
+ * except where noted.
+ */
+enum vm_opcode: uint8_t {
+    OP_CONST, // dst = constants[a]
+    OP_PARAM, // dst = the parameter
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_POW,
+    OP_POWI, // dst = a^b, with b an immediate exponent of at least 2
+    OP_NEG, OP_SIN, OP_COS, OP_TAN, OP_SINH, OP_COSH, OP_TANH,
+    OP_CALL // dst = callees[b](a)
+};
+
+/**
+ * A register of vm_program::run_with_error: a value, and a bound on its absolute error to first order.
+ */
+struct vm_running_value {
+    std::complex<double> value;
+    double error;
+};
+
+struct vm_instruction {
+    vm_opcode op;
+    uint16_t dst;
+    uint16_t a;
+    uint16_t b;
+};
+
+/**
+ * A compiled fxn. Registers hold complex doubles, or double-doubles for run(dd_complex); a call gets a fresh set of
+ * registers above the caller's, so frame_size is the number of registers needed by this program and everything it calls.
+ */
+struct vm_program {
+    std::vector<vm_instruction> code;
+    std::vector<std::complex<double>> constants;
+    std::vector<dd_complex> constants_dd; // the same constants, exactly if the program was built by compile_dd
+    std::vector<std::shared_ptr<const vm_program>> callees;
+    std::vector<std::string> callee_names;
+    uint32_t registers = 0;
+    uint32_t frame_size = 0;
+    uint16_t result = 0;
+
+    std::complex<double> run(std::complex<double> z, std::complex<double> *frame) const;
+
+    /**
+     * Runs the program in double-double precision, with dd_math. frame needs room for frame_size double-doubles.
+     */
+    dd_complex run(const dd_complex &z, dd_complex *frame) const;
+
+    /**
+     * Runs the program on balls instead of points (see complex_ball). frame needs room for frame_size balls.
+     * @return a ball containing f(z) for every z in `region`
+     */
+    complex_ball enclose(const complex_ball &region, complex_ball *frame) const;
+
+    /**
+     * Runs the program like run(), also carrying each register's rounding error (running error analysis). Second order
+     * terms are dropped, and the elementary functions are taken to be as accurate as inline_math says, so the result is
+     * an estimate rather than a bound like enclose()'s, but it costs little more than run(). frame needs room for
+     * frame_size values.
+     * @param error the absolute error of z
+     * @return f(z), and an estimate of its absolute error
+     */
+    vm_running_value run_with_error(std::complex<double> z, double error, vm_running_value *frame) const;
+
+    std::string disassemble() const;
+};
+
+/**
+ * A fxn evaluated by the bytecode VM, for builds without a wasm engine. Arithmetic and the elementary functions are
+ * evaluated exactly the way math_compiler_dp emits them with OPT_INLINE_MATH, so results match the browser bit for bit.
+ */
+class native_fxn: public fxn<std::complex<double>, native_fxn> {
+public:
+    native_fxn(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name,
+               std::shared_ptr<const vm_program> _program): fxn<std::complex<double>, native_fxn>(_name, _fxn_name, _parameter_name) {
+        this->handle = nullptr;
+        this->arena = nullptr;
+        this->program = std::move(_program);
+#ifndef GLAM_NO_DISASSEMBLY
+        if (this->program) {
+            this->disassembler = [program = this->program]() { return program->disassemble(); };
+        }
+#endif
+    }
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "HidingNonVirtualFunction"
+
+    std::complex<double> operator()(std::complex<double> z);
+
+    void eval_batch(const std::complex<double> *in, std::complex<double> *out, uint32_t count);
+
+    bool ready();
+
+    void release();
+
+#pragma clang diagnostic pop
+};
+
+/**
+ * A fxn evaluated by the bytecode VM in double-double precision, see dd_complex. About twice as many digits as
+ * native_fxn, for zooms that run out of them, at a fraction of the cost of a multiprecision fxn.
+ */
+class native_dd_fxn: public fxn<dd_complex, native_dd_fxn> {
+public:
+    native_dd_fxn(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name,
+                  std::shared_ptr<const vm_program> _program): fxn<dd_complex, native_dd_fxn>(_name, _fxn_name, _parameter_name) {
+        this->handle = nullptr;
+        this->arena = nullptr;
+        this->program = std::move(_program);
+#ifndef GLAM_NO_DISASSEMBLY
+        if (this->program) {
+            this->disassembler = [program = this->program]() { return program->disassemble(); };
+        }
+#endif
+    }
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "HidingNonVirtualFunction"
+
+    dd_complex operator()(dd_complex z);
+
+    void eval_batch(const dd_complex *in, dd_complex *out, uint32_t count);
+
+    bool ready();
+
+    void release();
+
+#pragma clang diagnostic pop
+};
+
+template <typename T, typename FxnType> complex_ball fxn<T, FxnType>::enclose(const complex_ball &region) {
+    if (!program) {
+        return complex_ball::everything();
+    }
+    thread_local std::vector<complex_ball> scratch;
+    if (scratch.size() < program->frame_size) {
+        scratch.resize(program->frame_size);
+    }
+    return program->enclose(region, scratch.data());
+}
+
+template <typename T, typename FxnType> double fxn<T, FxnType>::estimate_error(std::complex<double> z) {
+    if (!program) {
+        return std::numeric_limits<double>::infinity();
+    }
+    thread_local std::vector<vm_running_value> scratch;
+    if (scratch.size() < program->frame_size) {
+        scratch.resize(program->frame_size);
+    }
+    auto result = program->run_with_error(z, 0, scratch.data());
+    return result.error / std::abs(result.value);
+}
+
+/**
+ * Compiles token stacks to bytecode, the native counterpart of math_compiler_dp. Stacks go through the same expr_dag
+ * as the wasm compiler, so common subexpressions are computed once; each live node gets a register, and registers are
+ * reused as soon as their last reader has run.
+ */
+class bytecode_compiler {
+    // compiled fxns by fxn name, which is how fxncalls are resolved
+    static std::map<std::string, std::shared_ptr<const vm_program>> programs;
+
+    std::string name;
+    std::string fxn_name;
+    std::string parameter_name;
+    bool fold = true;
+    bool inline_calls = true;
+
+    // with `exact`, numbers and globals are kept in double-double precision, and nothing is folded in double precision
+    std::shared_ptr<vm_program> build(const token_stack &tokens, bool exact = false);
+
+public:
+    bytecode_compiler(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name)
+            : name(_name), fxn_name(_fxn_name), parameter_name(_parameter_name) { }
+
+    void set_fold(bool _fold) {
+        fold = _fold;
+    }
+
+    /**
+     * Whether calls to fxns with a known definition are inlined rather than run as OP_CALL.
+     */
+    void set_inline_calls(bool _inline_calls) {
+        inline_calls = _inline_calls;
+    }
+
+    /**
+     * @return the compiled fxn, which isn't ready() if the stack is malformed or refers to something unknown
+     */
+    native_fxn compile(const token_stack &tokens);
+
+    /**
+     * Compiles the stack to run in double-double precision. Calls that aren't inlined run the callee's program with
+     * its own constants, which are only exact if it was compiled this way too.
+     * @return the compiled fxn, which isn't ready() if the stack is malformed or refers to something unknown
+     */
+    native_dd_fxn compile_dd(const token_stack &tokens);
+
+    /**
+     * Compiles the stack without registering it, for fxns that run elsewhere but want a program for fxn::enclose.
+     * @return the program, or nullptr if the stack can't be compiled
+     */
+    std::shared_ptr<const vm_program> compile_program(const token_stack &tokens);
+
+    /**
+     * Forgets a fxn, unless it has been redefined since `program` was compiled.
+     * @return whether the fxn was forgotten
+     */
+    static bool forget(const std::string &fxn_name, const std::shared_ptr<const vm_program> &program);
+};
+
+#endif //GLAMCORE_BYTECODE_H
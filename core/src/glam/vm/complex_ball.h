@@ -0,0 +1,184 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_COMPLEX_BALL_H
+#define GLAMCORE_COMPLEX_BALL_H
+
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <limits>
+
+/**
+ * A closed disk in the complex plane. Every operation on balls returns a ball containing the results of the operation
+ * on every point of its arguments, so evaluating an expression with them gives a guaranteed enclosure of its range.
+ * Rounding errors are accounted for by padding each radius, assuming libm is accurate to a few ulps; an infinite radius
+ * means nothing is known.
+ */
+struct complex_ball {
+    std::complex<double> center;
+    double radius = 0;
+
+    complex_ball() = default;
+
+    complex_ball(std::complex<double> _center, double _radius): center(_center), radius(_radius) {
+        if (!std::isfinite(center.real()) || !std::isfinite(center.imag()) || std::isnan(radius)) {
+            radius = std::numeric_limits<double>::infinity();
+        }
+    }
+
+    /**
+     * @return the smallest ball containing the rectangle [x0, x1] x [y0, y1]
+     */
+    static complex_ball from_rect(double x0, double y0, double x1, double y1) {
+        return rounded({ (x0 + x1) / 2, (y0 + y1) / 2 }, std::hypot(x1 - x0, y1 - y0) / 2, 2);
+    }
+
+    /**
+     * @param ulps how many ulps of the center's magnitude the center can be off by
+     */
+    static complex_ball rounded(std::complex<double> center, double radius, double ulps) {
+        return { center, (radius + ulps * DBL_EPSILON * std::abs(center)) * (1 + 4 * DBL_EPSILON) + DBL_TRUE_MIN };
+    }
+
+    static complex_ball everything() {
+        return { 0., std::numeric_limits<double>::infinity() };
+    }
+
+    bool contains(std::complex<double> z) const {
+        return std::abs(z - center) <= radius;
+    }
+
+    /**
+     * @return true if 0 might be in the ball. If this is false for an enclosure, the fxn has no zeros in the region.
+     */
+    bool contains_zero() const {
+        return !(min_abs_center() > radius);
+    }
+
+    /**
+     * @return a lower bound on |center|. std::abs can be an ulp too big, which matters when the ball nearly reaches 0.
+     */
+    double min_abs_center() const {
+        return std::abs(center) * (1 - 2 * DBL_EPSILON);
+    }
+
+    bool is_bounded() const {
+        return std::isfinite(radius);
+    }
+};
+
+/**
+ * The elementary functions over balls. They take the same operands as the bytecode VM's opcodes.
+ */
+namespace ball_math {
+    inline complex_ball add(const complex_ball &a, const complex_ball &b) {
+        return complex_ball::rounded(a.center + b.center, a.radius + b.radius, 1);
+    }
+
+    inline complex_ball sub(const complex_ball &a, const complex_ball &b) {
+        return complex_ball::rounded(a.center - b.center, a.radius + b.radius, 1);
+    }
+
+    inline complex_ball neg(const complex_ball &a) {
+        return { -a.center, a.radius };
+    }
+
+    inline complex_ball mul(const complex_ball &a, const complex_ball &b) {
+        return complex_ball::rounded(a.center * b.center, std::abs(a.center) * b.radius + std::abs(b.center) * a.radius + a.radius * b.radius,
+                                     4);
+    }
+
+    inline complex_ball inv(const complex_ball &a) {
+        const double m = a.min_abs_center();
+        if (!(m > a.radius)) {
+            return complex_ball::everything(); // the ball contains 0
+        }
+        // |1/z - 1/c| = |z - c| / (|z| |c|) <= r / ((|c| - r) |c|)
+        return complex_ball::rounded(1. / a.center, a.radius / ((m - a.radius) * m), 4);
+    }
+
+    inline complex_ball div(const complex_ball &a, const complex_ball &b) {
+        return mul(a, inv(b));
+    }
+
+    /**
+     * Integer powers by repeated squaring, which gives tighter balls than exp(n log a).
+     */
+    inline complex_ball powi(const complex_ball &a, int n) {
+        int bit = 0;
+        while ((n >> (bit + 1)) != 0) {
+            bit++;
+        }
+        auto power = a;
+        while (bit-- > 0) {
+            power = mul(power, power);
+            if ((n >> bit) & 1) {
+                power = mul(power, a);
+            }
+        }
+        return power;
+    }
+
+    // the rest bound |f(z) - f(c)| by |z - c| times the largest |f'| on the ball, or better
+
+    inline complex_ball exp(const complex_ball &a) {
+        // |exp(c + d) - exp(c)| = |exp(c)| |exp(d) - 1| <= |exp(c)| (exp(r) - 1)
+        auto center = std::exp(a.center);
+        return complex_ball::rounded(center, std::abs(center) * std::expm1(a.radius), 8);
+    }
+
+    inline complex_ball log(const complex_ball &a) {
+        // the principal branch jumps across the negative real axis, so the ball has to stay clear of it
+        const double m = a.min_abs_center();
+        if ((a.center.real() - a.radius <= 0 && std::abs(a.center.imag()) <= a.radius) || !(m > a.radius)) {
+            return complex_ball::everything();
+        }
+        return complex_ball::rounded(std::log(a.center), a.radius / (m - a.radius), 8);
+    }
+
+    inline complex_ball pow(const complex_ball &a, const complex_ball &b) {
+        return exp(mul(b, log(a)));
+    }
+
+    inline complex_ball sin(const complex_ball &a) {
+        // |cos(x + iy)| <= cosh(y)
+        return complex_ball::rounded(std::sin(a.center), a.radius * std::cosh(std::abs(a.center.imag()) + a.radius), 8);
+    }
+
+    inline complex_ball cos(const complex_ball &a) {
+        return complex_ball::rounded(std::cos(a.center), a.radius * std::cosh(std::abs(a.center.imag()) + a.radius), 8);
+    }
+
+    inline complex_ball tan(const complex_ball &a) {
+        return div(sin(a), cos(a));
+    }
+
+    inline complex_ball sinh(const complex_ball &a) {
+        // |cosh(x + iy)| <= cosh(x)
+        return complex_ball::rounded(std::sinh(a.center), a.radius * std::cosh(std::abs(a.center.real()) + a.radius), 8);
+    }
+
+    inline complex_ball cosh(const complex_ball &a) {
+        return complex_ball::rounded(std::cosh(a.center), a.radius * std::cosh(std::abs(a.center.real()) + a.radius), 8);
+    }
+
+    inline complex_ball tanh(const complex_ball &a) {
+        return div(sinh(a), cosh(a));
+    }
+}
+
+#endif //GLAMCORE_COMPLEX_BALL_H
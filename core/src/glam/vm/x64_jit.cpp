@@ -0,0 +1,409 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "x64_jit.h"
+
+#ifdef GLAM_X64_JIT
+
+#include <cassert>
+#include <cstring>
+#include <sys/mman.h>
+#include "../jit/expr_dag.h"
+#include "../jit/globals.h"
+#include "../jit/inline_math.h"
+#include "../jit/stack_optimizer.h"
+
+namespace {
+    // sizes of the executable mappings, by entry point
+    std::map<void *, size_t> mappings;
+
+    const uint64_t sign_bit = 0x8000000000000000ull;
+
+    // SSE2 opcodes, after 66 0F
+    const uint8_t MOVUPD_LOAD = 0x10, MOVUPD_STORE = 0x11, UNPCKLPD = 0x14, UNPCKHPD = 0x15, MOVAPD = 0x28, XORPD = 0x57,
+            ADDPD = 0x58, MULPD = 0x59, SUBPD = 0x5C, SHUFPD = 0xC6;
+
+    uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm) {
+        return (mod << 6) | ((reg & 7) << 3) | (rm & 7);
+    }
+
+    // divides the way the bytecode VM and the wasm compiler do, rather than like std::complex
+    std::complex<double> *inline_div(double a, double b, double c, double d, fixed_arena<std::complex<double>> *arena) {
+        scalar_math_ops ops;
+        auto q = inline_math<scalar_math_ops>(ops).cdiv(a, b, c, d);
+        auto r = arena->alloc();
+        *r = std::complex(q.first, q.second);
+        return r;
+    }
+}
+
+x64_visitor::x64_visitor(const std::string &_parameter_name, fixed_arena<std::complex<double>> *_arena)
+        : parameter_name(_parameter_name), arena(_arena) {
+    emit({ 0x55 }); // push rbp
+    emit({ 0x48, 0x89, 0xE5 }); // mov rbp, rsp
+    emit({ 0x48, 0x81, 0xEC }); // sub rsp, imm32
+    frame_size_offset = code.size();
+    emit_u32(0);
+    emit({ 0x48, 0x89, 0x7D, 0xF8 }); // mov [rbp - 8], rdi
+    visit_sse2(UNPCKLPD, 0, 1); // xmm0 = (re, im)
+    visit_store(0, -32);
+}
+
+void x64_visitor::emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+}
+
+void x64_visitor::emit_u32(uint32_t x) {
+    for (int i = 0; i < 4; i++) {
+        code.push_back((x >> (8 * i)) & 0xff);
+    }
+}
+
+void x64_visitor::emit_u64(uint64_t x) {
+    emit_u32(x & 0xffffffff);
+    emit_u32(x >> 32);
+}
+
+int32_t x64_visitor::slot(uint32_t k) {
+    return -48 - 16 * static_cast<int32_t>(k);
+}
+
+int32_t x64_visitor::temporary(uint32_t t) {
+    if (!temporaries.count(t)) {
+        auto index = static_cast<uint32_t>(temporaries.size());
+        temporaries[t] = index;
+    }
+    return 16 * static_cast<int32_t>(temporaries[t]);
+}
+
+void x64_visitor::visit_load(uint8_t xmm, int32_t disp) {
+    emit({ 0x66, 0x0F, MOVUPD_LOAD, modrm(2, xmm, 5) });
+    emit_u32(disp);
+}
+
+void x64_visitor::visit_store(uint8_t xmm, int32_t disp) {
+    emit({ 0x66, 0x0F, MOVUPD_STORE, modrm(2, xmm, 5) });
+    emit_u32(disp);
+}
+
+void x64_visitor::visit_load_temporary(uint8_t xmm, int32_t disp) {
+    emit({ 0x66, 0x0F, MOVUPD_LOAD, modrm(2, xmm, 4), 0x24 });
+    emit_u32(disp);
+}
+
+void x64_visitor::visit_store_temporary(uint8_t xmm, int32_t disp) {
+    emit({ 0x66, 0x0F, MOVUPD_STORE, modrm(2, xmm, 4), 0x24 });
+    emit_u32(disp);
+}
+
+void x64_visitor::visit_sse2(uint8_t opcode, uint8_t dst, uint8_t src) {
+    emit({ 0x66, 0x0F, opcode, modrm(3, dst, src) });
+}
+
+void x64_visitor::visit_movq_from_rax(uint8_t xmm) {
+    emit({ 0x66, 0x48, 0x0F, 0x6E, modrm(3, xmm, 0) });
+}
+
+void x64_visitor::visit_mov_rax(uint64_t imm) {
+    emit({ 0x48, 0xB8 });
+    emit_u64(imm);
+}
+
+void x64_visitor::visit_call_rax() {
+    emit({ 0xFF, 0xD0 });
+}
+
+uint32_t x64_visitor::visit_push() {
+    max_depth = std::max(max_depth, depth + 1);
+    return depth++;
+}
+
+uint32_t x64_visitor::visit_pop() {
+    assert(depth > 0);
+    return --depth;
+}
+
+void x64_visitor::visit_binary_operands() {
+    auto b = visit_pop();
+    auto a = visit_pop();
+    visit_load(0, slot(a));
+    visit_load(1, slot(b));
+}
+
+void x64_visitor::visit_complex(std::complex<double> z) {
+    GLAM_TRACE("[x64] visit_complex " << z);
+    auto k = visit_push();
+    uint64_t bits[2];
+    std::memcpy(bits, &z, sizeof(bits));
+    for (int i = 0; i < 2; i++) {
+        visit_mov_rax(bits[i]);
+        emit({ 0x48, 0x89, modrm(2, 0, 5) }); // mov [rbp + disp32], rax
+        emit_u32(slot(k) + 8 * i);
+    }
+}
+
+bool x64_visitor::visit_variable_dp(const std::string &name) {
+    if (name != parameter_name) {
+        return false;
+    }
+    visit_load(0, -32);
+    visit_store(0, slot(visit_push()));
+    return true;
+}
+
+void x64_visitor::visit_add() {
+    visit_binary_operands();
+    visit_sse2(ADDPD, 0, 1);
+    visit_store(0, slot(visit_push()));
+}
+
+void x64_visitor::visit_sub() {
+    visit_binary_operands();
+    visit_sse2(SUBPD, 0, 1);
+    visit_store(0, slot(visit_push()));
+}
+
+void x64_visitor::visit_mul() {
+    // (a, b) * (c, d) = (a, b) * (c, c) + (b, a) * (d, d) * (-1, 1), rounded the same way as function_visitor::visit_mul
+    visit_binary_operands();
+    visit_sse2(MOVAPD, 2, 1);
+    visit_sse2(UNPCKLPD, 2, 2); // (c, c)
+    visit_sse2(MULPD, 2, 0); // (ac, bc)
+    visit_sse2(UNPCKHPD, 1, 1); // (d, d)
+    visit_sse2(MOVAPD, 3, 0);
+    emit({ 0x66, 0x0F, SHUFPD, modrm(3, 3, 3), 0x01 }); // (b, a)
+    visit_sse2(MULPD, 3, 1); // (bd, ad)
+    visit_mov_rax(sign_bit);
+    visit_movq_from_rax(4); // (-0, 0)
+    visit_sse2(XORPD, 3, 4); // (-bd, ad)
+    visit_sse2(ADDPD, 2, 3);
+    visit_store(2, slot(visit_push()));
+}
+
+void x64_visitor::visit_div() {
+    visit_f64x4(&inline_div);
+}
+
+void x64_visitor::visit_neg() {
+    auto k = visit_pop();
+    visit_load(0, slot(k));
+    visit_mov_rax(sign_bit);
+    visit_movq_from_rax(1);
+    visit_sse2(UNPCKLPD, 1, 1);
+    visit_sse2(XORPD, 0, 1);
+    visit_store(0, slot(visit_push()));
+}
+
+void x64_visitor::visit_f64x2(morpheme_f64x2 *morph) {
+    auto k = visit_pop();
+    visit_load(0, slot(k));
+    visit_sse2(MOVAPD, 1, 0);
+    visit_sse2(UNPCKHPD, 1, 1);
+    emit({ 0x48, 0xBF }); // mov rdi, imm64
+    emit_u64(reinterpret_cast<uint64_t>(arena));
+    visit_mov_rax(reinterpret_cast<uint64_t>(morph));
+    visit_call_rax();
+    emit({ 0x66, 0x0F, MOVUPD_LOAD, modrm(0, 0, 0) }); // movupd xmm0, [rax]
+    visit_store(0, slot(visit_push()));
+}
+
+void x64_visitor::visit_f64x4(morpheme_f64x4 *morph) {
+    auto b = visit_pop();
+    auto a = visit_pop();
+    visit_load(0, slot(a));
+    visit_sse2(MOVAPD, 1, 0);
+    visit_sse2(UNPCKHPD, 1, 1);
+    visit_load(2, slot(b));
+    visit_sse2(MOVAPD, 3, 2);
+    visit_sse2(UNPCKHPD, 3, 3);
+    emit({ 0x48, 0xBF }); // mov rdi, imm64
+    emit_u64(reinterpret_cast<uint64_t>(arena));
+    visit_mov_rax(reinterpret_cast<uint64_t>(morph));
+    visit_call_rax();
+    emit({ 0x66, 0x0F, MOVUPD_LOAD, modrm(0, 0, 0) }); // movupd xmm0, [rax]
+    visit_store(0, slot(visit_push()));
+}
+
+void x64_visitor::visit_fxncall(void (*const *cell)(double, double, std::complex<double> *)) {
+    // the callee writes its result straight into the slot its argument came from
+    auto k = visit_pop();
+    visit_load(0, slot(k));
+    visit_sse2(MOVAPD, 1, 0);
+    visit_sse2(UNPCKHPD, 1, 1);
+    emit({ 0x48, 0x8D, modrm(2, 7, 5) }); // lea rdi, [rbp + disp32]
+    emit_u32(slot(visit_push()));
+    visit_mov_rax(reinterpret_cast<uint64_t>(cell));
+    emit({ 0x48, 0x8B, modrm(0, 0, 0) }); // mov rax, [rax]
+    visit_call_rax();
+}
+
+void x64_visitor::visit_temporary_tee(uint32_t t) {
+    assert(depth > 0);
+    visit_load(0, slot(depth - 1));
+    visit_store_temporary(0, temporary(t));
+}
+
+void x64_visitor::visit_temporary_get(uint32_t t) {
+    assert(temporaries.count(t));
+    visit_load_temporary(0, temporary(t));
+    visit_store(0, slot(visit_push()));
+}
+
+void *x64_visitor::visit_end(size_t &code_size) {
+    assert(depth == 1);
+    visit_load(0, slot(visit_pop()));
+    emit({ 0x48, 0x8B, 0x7D, 0xF8 }); // mov rdi, [rbp - 8]
+    emit({ 0x66, 0x0F, MOVUPD_STORE, modrm(0, 0, 7) }); // movupd [rdi], xmm0
+    emit({ 0xC9, 0xC3 }); // leave; ret
+
+    // keeps rsp 16-byte aligned for calls, since rbp is
+    uint32_t frame_size = 32 + 16 * max_depth + 16 * static_cast<uint32_t>(temporaries.size());
+    std::memcpy(&code[frame_size_offset], &frame_size, sizeof(frame_size));
+
+    code_size = code.size();
+    void *mem = mmap(nullptr, code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(mem, code.data(), code_size);
+    if (mprotect(mem, code_size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, code_size);
+        return nullptr;
+    }
+    mappings[mem] = code_size;
+    return mem;
+}
+
+void x64_fxn::release() {
+    GLAM_TRACE("releasing x64 fxn " << this->name);
+    x64_compiler::forget(this->fxn_name, this->store_handle);
+    auto mem = reinterpret_cast<void *>(this->store_handle);
+    auto mapping = mappings.find(mem);
+    if (mapping != mappings.end()) {
+        munmap(mem, mapping->second);
+        mappings.erase(mapping);
+    }
+    this->store_handle = nullptr;
+    if (this->arena) {
+        this->arena->release();
+        delete this->arena;
+        this->arena = nullptr;
+    }
+}
+
+std::map<std::string, morpheme_f64x2 *> x64_compiler::unary_morphemes = { std::make_pair("sin", &_fmorpheme_sin),
+        std::make_pair("cos", &_fmorpheme_cos), std::make_pair("tan", &_fmorpheme_tan), std::make_pair("sinh", &_fmorpheme_sinh),
+        std::make_pair("cosh", &_fmorpheme_cosh), std::make_pair("tanh", &_fmorpheme_tanh) };
+
+std::map<std::string, morpheme_f64x4 *> x64_compiler::binary_morphemes = { std::make_pair("^", &_fmorpheme_exp) };
+
+std::map<std::string, std::unique_ptr<x64_compiler::kernel_f>> x64_compiler::kernels;
+
+bool x64_compiler::forget(const std::string &fxn_name, kernel_f kernel) {
+    auto cell = kernels.find(fxn_name);
+    if (cell == kernels.end() || *cell->second != kernel) {
+        return false;
+    }
+    *cell->second = nullptr;
+    globals::forget(fxn_name);
+    return true;
+}
+
+x64_fxn x64_compiler::compile(const token_stack &input) {
+    auto arena = new fixed_arena<std::complex<double>>(1); // see x64_visitor
+    auto failed = [&](const std::string &why) {
+        GLAM_TRACE("[x64] can't compile " << name << ": " << why);
+        arena->release();
+        delete arena;
+        return x64_fxn(name, fxn_name, parameter_name, nullptr, nullptr);
+    };
+
+    expr_dag dag(parameter_name, globals::consts_dp);
+    dag.set_definitions(&globals::definitions);
+    if (!dag.parse(input)) {
+        return failed("malformed stack");
+    }
+    stack_optimizer::fold(dag);
+    dag.prune();
+    auto tokens = dag.emit();
+
+    x64_visitor xv(parameter_name, arena);
+    for (const auto &token : tokens) {
+        const auto &value = token.value;
+        switch (token.type) {
+            case TOKEN_COMPLEX:
+                xv.visit_complex(expr_dag::parse_complex(value));
+                break;
+            case TOKEN_IDENTIFIER:
+                if (!xv.visit_variable_dp(value)) {
+                    return failed("unknown variable " + value);
+                }
+                break;
+            case TOKEN_OPERATOR:
+                if (value == "+") {
+                    xv.visit_add();
+                } else if (value == "-") {
+                    xv.visit_sub();
+                } else if (value == "*") {
+                    xv.visit_mul();
+                } else if (value == "/") {
+                    xv.visit_div();
+                } else if (value == expr_dag::neg_operator) {
+                    xv.visit_neg();
+                } else if (unary_morphemes.count(value)) {
+                    xv.visit_f64x2(unary_morphemes[value]);
+                } else if (binary_morphemes.count(value)) {
+                    xv.visit_f64x4(binary_morphemes[value]);
+                } else {
+                    return failed("unknown operator " + value);
+                }
+                break;
+            case TOKEN_FXNCALL: {
+                auto cell = kernels.find(value);
+                if (cell == kernels.end() || !*cell->second) {
+                    return failed("unknown fxn " + value);
+                }
+                xv.visit_fxncall(cell->second.get());
+                break;
+            }
+            case TOKEN_TEE:
+                xv.visit_temporary_tee(std::stoul(value));
+                break;
+            case TOKEN_GET:
+                xv.visit_temporary_get(std::stoul(value));
+                break;
+            default:
+                return failed("can't compile " + value);
+        }
+    }
+
+    size_t code_size;
+    auto entry = reinterpret_cast<void (*)(double, double, std::complex<double> *)>(xv.visit_end(code_size));
+    if (!entry) {
+        return failed("couldn't map executable memory");
+    }
+    auto &cell = kernels[fxn_name];
+    if (!cell) {
+        cell = std::make_unique<kernel_f>();
+    }
+    *cell = entry;
+    globals::define(fxn_name, parameter_name, input);
+    GLAM_TRACE("[x64] compiled " << name << " to " << code_size << " bytes");
+    x64_fxn fxn(name, fxn_name, parameter_name, entry, arena);
+    return fxn;
+}
+
+#endif
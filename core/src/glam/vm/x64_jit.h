@@ -0,0 +1,208 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_X64_JIT_H
+#define GLAMCORE_X64_JIT_H
+
+#if defined(__x86_64__) && !defined(__EMSCRIPTEN__) && defined(__unix__)
+#define GLAM_X64_JIT 1
+
+#include <complex>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../fxn.h"
+#include "../morphemes.h"
+#include "../jit/stack_token.h"
+
+/**
+ * Emits x86-64 machine code for a complex double fxn, with the same interface as function_visitor. Only SSE2 is used,
+ * so the code runs on any x86-64 CPU.
+ *
+ * The generated function has the signature of functor_type<std::complex<double>>::store_type, that is
+ * void(double re, double im, std::complex<double> *out), and uses the System V calling convention. Each complex value
+ * is kept packed in one xmm register while it is being worked on; the value stack itself lives in the function's frame,
+ * since every call (to a morpheme or another fxn) clobbers all the xmm registers anyway. The frame looks like this:
+ *
+ *   rbp - 8            the out pointer
+ *   rbp - 32           the parameter
+ *   rbp - 48 - 16k     stack slot k
+ *   rsp + 16t          temporary t
+ *
+ * Division calls inline_math's cdiv, like the bytecode VM, so it rounds the same way there and not like std::complex
+ * division. Morphemes are called directly, with this fxn's arena. Their results are copied out right away, so the arena can wrap
+ * around as often as it likes. Other fxns are called through their name's cell in x64_compiler, which is read on every
+ * call, so redefining a callee takes effect in its callers without recompiling them.
+ */
+class x64_visitor {
+    std::vector<uint8_t> code;
+    std::string parameter_name;
+    fixed_arena<std::complex<double>> *arena;
+    size_t frame_size_offset; // where the immediate of `sub rsp, imm32` is, patched by visit_end
+    uint32_t depth = 0;
+    uint32_t max_depth = 0;
+    std::map<uint32_t, uint32_t> temporaries; // temporary index -> frame index
+
+    void emit(std::initializer_list<uint8_t> bytes);
+
+    void emit_u32(uint32_t x);
+
+    void emit_u64(uint64_t x);
+
+    int32_t slot(uint32_t k);
+
+    int32_t temporary(uint32_t t);
+
+    // movupd xmm, [rbp + disp] and back
+    void visit_load(uint8_t xmm, int32_t disp);
+
+    void visit_store(uint8_t xmm, int32_t disp);
+
+    // movupd xmm, [rsp + disp] and back
+    void visit_load_temporary(uint8_t xmm, int32_t disp);
+
+    void visit_store_temporary(uint8_t xmm, int32_t disp);
+
+    // op xmm_dst, xmm_src for a 66 0F-prefixed SSE2 instruction
+    void visit_sse2(uint8_t opcode, uint8_t dst, uint8_t src);
+
+    // movq xmm, rax
+    void visit_movq_from_rax(uint8_t xmm);
+
+    void visit_mov_rax(uint64_t imm);
+
+    void visit_call_rax();
+
+    uint32_t visit_push();
+
+    uint32_t visit_pop();
+
+    // loads the top two slots into xmm0 and xmm1, leaving their result slot in depth
+    void visit_binary_operands();
+
+public:
+    x64_visitor(const std::string &_parameter_name, fixed_arena<std::complex<double>> *_arena);
+
+    void visit_complex(std::complex<double> z);
+
+    bool visit_variable_dp(const std::string &name);
+
+    void visit_add();
+
+    void visit_sub();
+
+    void visit_mul();
+
+    void visit_div();
+
+    void visit_neg();
+
+    void visit_f64x2(morpheme_f64x2 *morph);
+
+    void visit_f64x4(morpheme_f64x4 *morph);
+
+    /**
+     * @param cell where the store functor of the fxn to call is kept, see x64_compiler. the fxn must also have been
+     * compiled by this backend
+     */
+    void visit_fxncall(void (*const *cell)(double, double, std::complex<double> *));
+
+    void visit_temporary_tee(uint32_t temporary);
+
+    void visit_temporary_get(uint32_t temporary);
+
+    /**
+     * Copies the code into executable memory. Afterwards the visitor can't be used anymore.
+     * @return the entry point, or nullptr if the memory couldn't be mapped
+     */
+    void *visit_end(size_t &code_size);
+};
+
+/**
+ * A fxn running as native x86-64 code. The code is shared by all copies, so it has to be release()d exactly once.
+ */
+class x64_fxn: public fxn<std::complex<double>, x64_fxn> {
+public:
+    x64_fxn(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name, store_functor *kernel,
+            fixed_arena<std::complex<double>> *_arena): fxn<std::complex<double>, x64_fxn>(_name, _fxn_name, _parameter_name) {
+        this->handle = nullptr;
+        this->store_handle = kernel;
+        this->arena = _arena;
+    }
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "HidingNonVirtualFunction"
+
+    std::complex<double> operator()(std::complex<double> z) {
+        std::complex<double> result;
+        this->store_handle(z.real(), z.imag(), &result);
+        return result;
+    }
+
+    void eval_batch(const std::complex<double> *in, std::complex<double> *out, uint32_t count) {
+        auto kernel = this->store_handle;
+        for (uint32_t i = 0; i < count; i++) {
+            kernel(in[i].real(), in[i].imag(), &out[i]);
+        }
+    }
+
+    bool ready() {
+        return this->store_handle != nullptr;
+    }
+
+    void release();
+
+#pragma clang diagnostic pop
+};
+
+/**
+ * Compiles token stacks to x86-64, the native counterpart of math_compiler_dp. The stack goes through expr_dag first,
+ * like it does for the other compilers.
+ */
+class x64_compiler {
+    static std::map<std::string, morpheme_f64x2 *> unary_morphemes;
+    static std::map<std::string, morpheme_f64x4 *> binary_morphemes;
+
+    using kernel_f = void (*)(double, double, std::complex<double> *);
+
+    // the current definition of each fxn by fxn name, which is how fxncalls are resolved. compiled code refers to the
+    // cells themselves, so they're never freed; a cell is null while its fxn isn't defined
+    static std::map<std::string, std::unique_ptr<kernel_f>> kernels;
+
+    std::string name;
+    std::string fxn_name;
+    std::string parameter_name;
+
+public:
+    x64_compiler(const std::string &_name, const std::string &_fxn_name, const std::string &_parameter_name)
+            : name(_name), fxn_name(_fxn_name), parameter_name(_parameter_name) { }
+
+    /**
+     * @return the compiled fxn, which isn't ready() if the stack is malformed or refers to something unknown
+     */
+    x64_fxn compile(const token_stack &tokens);
+
+    /**
+     * Forgets a fxn, unless it has been redefined since `kernel` was compiled.
+     * @return whether the fxn was forgotten
+     */
+    static bool forget(const std::string &fxn_name, kernel_f kernel);
+};
+
+#endif
+
+#endif //GLAMCORE_X64_JIT_H
@@ -19,8 +19,34 @@
 #include "bindings.h"
 #include "../morphemes.h"
 #include "../multipoint.h"
+#include "../tiled_multipoint.h"
+#include "../tile_cache.h"
 #include "../jit/math_compiler.h"
 #include "../jit/globals.h"
+#include "../jit/compile_cache.h"
+#include "../vm/bytecode.h"
+
+namespace {
+    double ball_re(const complex_ball &b) {
+        return b.center.real();
+    }
+
+    void set_ball_re(complex_ball &b, double re) {
+        b.center.real(re);
+    }
+
+    double ball_im(const complex_ball &b) {
+        return b.center.imag();
+    }
+
+    void set_ball_im(complex_ball &b, double im) {
+        b.center.imag(im);
+    }
+
+    template <typename T, typename FxnType> complex_ball enclose_rect(fxn<T, FxnType> &f, double x0, double y0, double x1, double y1) {
+        return f.enclose(complex_ball::from_rect(x0, y0, x1, y1));
+    }
+}
 
 EMSCRIPTEN_BINDINGS(glam_module) {
     emscripten::class_<color_buffer>("ColorBuffer").function("getBuffer", &color_buffer::get_buffer)
@@ -28,12 +54,57 @@ EMSCRIPTEN_BINDINGS(glam_module) {
 
     emscripten::value_array<js_complex>("complex").element(&js_complex::real).element(&js_complex::imag);
 
+    emscripten::value_object<complex_ball>("ComplexBall").field("re", &ball_re, &set_ball_re)
+                                                        .field("im", &ball_im, &set_ball_im)
+                                                        .field("radius", &complex_ball::radius);
+
     emscripten::value_array<js_buffer>("JSBuffer").element(&js_buffer::ptr).element(&js_buffer::len);
 
+    emscripten::enum_<compiler_option>("CompilerOption").value("SIMD", OPT_SIMD).value("INLINE_MATH", OPT_INLINE_MATH)
+                                                        .value("MULTI_VALUE", OPT_MULTI_VALUE)
+                                                        .value("FOLD", OPT_FOLD)
+                                                        .value("CSE", OPT_CSE)
+                                                        .value("INLINE_CALLS", OPT_INLINE_CALLS)
+                                                        .value("DERIVATIVE", OPT_DERIVATIVE)
+                                                        .value("ENCLOSURE", OPT_ENCLOSURE);
+
     emscripten::class_<math_compiler_dp>("MathCompilerDP").constructor<std::string, std::string, std::string>()
-                                                          .function("compile", &math_compiler_dp::compile);
+                                                          .function("setOption", &math_compiler_dp::set_option)
+                                                          .function("getOption", &math_compiler_dp::get_option)
+                                                          .function("setOptimizeLevel", &math_compiler_dp::set_optimize_level)
+                                                          .function("getOptimizeLevel", &math_compiler_dp::get_optimize_level)
+                                                          .function("compile", emscripten::select_overload<
+                                                                  fxn<std::complex<double>, compiled_fxn<std::complex<double>>>(
+                                                                          const emscripten::val &)>(&math_compiler_dp::compile))
+                                                          .function("compileAsync", &math_compiler_dp::compile_async);
+
+    emscripten::class_<math_compiler_mp>("MathCompilerMP").constructor<std::string, std::string, std::string>()
+                                                          .function("setOptimizeLevel", &math_compiler_mp::set_optimize_level)
+                                                          .function("getOptimizeLevel", &math_compiler_mp::get_optimize_level)
+                                                          .function("setPrecision", &math_compiler_mp::set_precision)
+                                                          .function("getPrecision", &math_compiler_mp::get_precision)
+                                                          .function("compile", emscripten::select_overload<
+                                                                  fxn<mp_complex, compiled_fxn<mp_complex>>(
+                                                                          const emscripten::val &)>(&math_compiler_mp::compile))
+                                                          .function("compileAsync", &math_compiler_mp::compile_async);
+
+    emscripten::value_object<tier_stats>("TierStats").field("baselineCompileMs", &tier_stats::baseline_compile_ms)
+                                                     .field("optimizedCompileMs", &tier_stats::optimized_compile_ms)
+                                                     .field("baselineEvalsPerSec", &tier_stats::baseline_evals_per_sec)
+                                                     .field("optimizedEvalsPerSec", &tier_stats::optimized_evals_per_sec);
+
+    emscripten::register_vector<std::string>("StringVector");
 
-    emscripten::class_<globals>("Globals").class_function("isFxn", &globals::is_fxn).class_function("isGlobal", &globals::is_global);
+    emscripten::class_<globals>("Globals").class_function("isFxn", &globals::is_fxn).class_function("isGlobal", &globals::is_global)
+                                          .class_function("getTierStats", &globals::get_tier_stats)
+                                          .class_function("setMeasureTiers", &globals::set_measure_tiers)
+                                          .class_function("dependents", &globals::dependents)
+                                          .class_function("isOutdated", &globals::is_outdated);
+
+    emscripten::class_<compile_cache>("CompileCache").class_function("setCapacity", &compile_cache::set_capacity)
+                                                     .class_function("clear", &compile_cache::clear)
+                                                     .class_function("getHits", &compile_cache::get_hits)
+                                                     .class_function("getMisses", &compile_cache::get_misses);
 
 #define bind_fxn(fxn_type, type, name) emscripten::class_<fxn<type, fxn_type<type>>>(name) \
     .function("ready", &fxn<type, fxn_type<type>>::ready) \
@@ -41,7 +112,10 @@ EMSCRIPTEN_BINDINGS(glam_module) {
     .function("getName", &fxn<type, fxn_type<type>>::get_name) \
     .function("getFxnName", &fxn<type, fxn_type<type>>::get_fxn_name) \
     .function("getParameterName", &fxn<type, fxn_type<type>>::get_parameter_name) \
-    .function("getDisassembly", &fxn<type, fxn_type<type>>::get_disassembly)
+    .function("getDisassembly", &fxn<type, fxn_type<type>>::get_disassembly) \
+    .function("hasDerivative", &fxn<type, fxn_type<type>>::has_derivative) \
+    .function("hasEnclosure", &fxn<type, fxn_type<type>>::has_enclosure) \
+    .function("encloseRect", &enclose_rect<type, fxn_type<type>>)
 
     bind_fxn(compiled_fxn, std::complex<double>, "CompiledFxnDP");
     bind_fxn(compiled_fxn, mp_complex, "CompiledFxnMP");
@@ -52,13 +126,34 @@ EMSCRIPTEN_BINDINGS(glam_module) {
 #define bind_multipoint(D, R, name) emscripten::class_<multipoint<D, R>>(name) \
     .constructor<fxn<R, compiled_fxn<R>>, js_type<D>::type, js_type<D>::type, uint32_t>()     \
     .function("fullEval", &multipoint<D, R>::full_eval) \
+    .function("mixedEval", &multipoint<D, R>::mixed_eval) \
+    .function("refine", &multipoint<D, R>::refine) \
+    .function("isStale", &multipoint<D, R>::is_stale) \
+    .function("resize", &multipoint<D, R>::resize_js) \
+    .property("digits", &multipoint<D, R>::digits) \
     .function("getValues", &multipoint<D, R>::get_values) \
     .function("getColors", &multipoint<D, R>::get_colors)
 
     bind_multipoint(mp_float, mp_complex, "RealMultipointMP");
     bind_multipoint(mp_complex, mp_complex, "ComplexMultipointMP");
-    bind_multipoint(double, std::complex<double>, "RealMultipointDP");
-    bind_multipoint(std::complex<double>, std::complex<double>, "ComplexMultipointDP");
+    bind_multipoint(double, std::complex<double>, "RealMultipointDP")
+            .function("setEscalation", &multipoint<double, std::complex<double>>::set_escalation);
+    bind_multipoint(std::complex<double>, std::complex<double>, "ComplexMultipointDP")
+            .function("setEscalation", &multipoint<std::complex<double>, std::complex<double>>::set_escalation);
 
 #undef bind_multipoint
+
+    emscripten::class_<tiled_multipoint>("TiledMultipointDP").constructor<fxn<std::complex<double>, compiled_fxn<std::complex<double>>>>()
+                                                             .function("view", &tiled_multipoint::view_js)
+                                                             .property("zoom", &tiled_multipoint::zoom)
+                                                             .property("width", &tiled_multipoint::width)
+                                                             .property("height", &tiled_multipoint::height)
+                                                             .function("getValues", &tiled_multipoint::get_values)
+                                                             .function("getColors", &tiled_multipoint::get_colors);
+
+    emscripten::class_<tile_cache>("TileCache").class_function("setBudget", &tile_cache::set_budget)
+                                               .class_function("clear", &tile_cache::clear)
+                                               .class_function("getHits", &tile_cache::get_hits)
+                                               .class_function("getMisses", &tile_cache::get_misses)
+                                               .class_function("getSize", &tile_cache::get_size);
 }
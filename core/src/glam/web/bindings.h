@@ -17,8 +17,12 @@
 #ifndef GLAMUI_BINDINGS_H
 #define GLAMUI_BINDINGS_H
 
+#ifdef __EMSCRIPTEN__
 #include <emscripten/val.h>
 #include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE // native builds (see vm/bytecode.h) only need the type traits below
+#endif
 
 struct js_complex {
     double real;
@@ -38,6 +42,7 @@ template <typename T> struct js_type {
     }
 };
 
+// doubles convert to the mp types exactly, at any precision from mp_precision::min_digits up
 template <> struct js_type<mp_float> {
     using type = double;
 
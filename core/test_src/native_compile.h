@@ -0,0 +1,29 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GLAMCORE_NATIVE_COMPILE_H
+#define GLAMCORE_NATIVE_COMPILE_H
+
+#include <glam/vm/bytecode.h>
+
+/**
+ * Compiles f(z) for the bytecode VM, the way the tests of everything that evaluates natively do.
+ */
+inline native_fxn compile(const std::string &fxn_name, const token_stack &tokens) {
+    return bytecode_compiler(fxn_name + "(z)", fxn_name, "z").compile(tokens);
+}
+
+#endif //GLAMCORE_NATIVE_COMPILE_H
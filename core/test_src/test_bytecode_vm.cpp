@@ -0,0 +1,190 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/multipoint.h>
+#include <glam/jit/globals.h>
+#include <glam/vm/bytecode.h>
+#include "native_compile.h"
+
+TEST(bytecode_vm_test, arithmetic) {
+    // (z^3 - i) / (2 * z) + sin(\pi * z)
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "^" }, { TOKEN_IDENTIFIER, "i" },
+            { TOKEN_OPERATOR, "-" }, { TOKEN_NUMBER, "2" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "/" },
+            { TOKEN_IDENTIFIER, "\\pi" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "sin" },
+            { TOKEN_OPERATOR, "+" } });
+    ASSERT_EQ(f.ready(), true);
+    for (double t = 0.1; t < 3; t += 0.1) {
+        const auto z = std::polar(t, 7 * t);
+        const auto expected = (z * z * z - std::complex(0., 1.)) / (2. * z) + std::sin(M_PI * z);
+        EXPECT_LE(std::abs(f(z) - expected), 1e-13 * std::abs(expected)) << "z = " << z;
+    }
+    f.release();
+}
+
+TEST(bytecode_vm_test, shares_registers) {
+    // sin(z) * sin(z) + cos(z): sin is evaluated once, and registers are reused as soon as they are dead
+    auto f = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" },
+            { TOKEN_OPERATOR, "*" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "cos" }, { TOKEN_OPERATOR, "+" } });
+    ASSERT_EQ(f.ready(), true);
+    auto text = f.get_disassembly();
+    size_t sins = 0;
+    for (size_t pos = text.find("= sin"); pos != std::string::npos; pos = text.find("= sin", pos + 1)) {
+        sins++;
+    }
+    EXPECT_EQ(sins, 1);
+    EXPECT_EQ(text.rfind("; 2 registers", 0), 0);
+    f.release();
+}
+
+TEST(bytecode_vm_test, fxncall) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } });
+    const token_stack g_tokens = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" } };
+    auto g = compile("g", g_tokens);
+    ASSERT_EQ(g.ready(), true);
+    EXPECT_EQ(g({ 1, 2 }), std::complex<double>(-2, 4));
+    EXPECT_EQ(g.get_disassembly().find("call"), std::string::npos); // f is inlined
+
+    bytecode_compiler compiler("h(z)", "h", "z");
+    compiler.set_inline_calls(false);
+    auto h = compiler.compile(g_tokens);
+    ASSERT_EQ(h.ready(), true);
+    EXPECT_EQ(h({ 1, 2 }), std::complex<double>(-2, 4));
+    EXPECT_NE(h.get_disassembly().find("call f"), std::string::npos);
+    f.release();
+    g.release();
+    h.release();
+}
+
+TEST(bytecode_vm_test, release_after_redefinition) {
+    // releasing f once it's been redefined leaves the new definition alone
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } });
+    auto f2 = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" } });
+    f.release();
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" } });
+    ASSERT_EQ(g.ready(), true);
+    EXPECT_EQ(g({ 1, 2 }), std::complex<double>(2, 4));
+    g.release();
+    f2.release();
+    EXPECT_EQ(compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" } }).ready(), false);
+}
+
+TEST(bytecode_vm_test, redefinitions) {
+    const token_stack f_tokens = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } };
+    auto f = compile("f", f_tokens);
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" } });
+    const token_stack h_tokens = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "g" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" } };
+    auto h = compile("h", h_tokens);
+    auto k = compile("k", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "+" } });
+    EXPECT_EQ(globals::dependents("f"), std::vector<std::string>({ "g", "h" }));
+    EXPECT_EQ(globals::dependents("h").empty(), true);
+
+    multipoint<std::complex<double>, std::complex<double>> mh(h, { -1, -1 }, { 1, 1 }, 4), mk(k, { -1, -1 }, { 1, 1 }, 4);
+    mh.full_eval();
+    mk.full_eval();
+    EXPECT_EQ(mh.is_stale(), false);
+
+    // f(z) = z + 5. h only has to be compiled again, since the definition of g it inlines is re-derived right away
+    f.release();
+    f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "5" }, { TOKEN_OPERATOR, "+" } });
+    EXPECT_EQ(mh.is_stale(), true);
+    EXPECT_EQ(mk.is_stale(), false);
+    h.release();
+    h = compile("h", h_tokens);
+    EXPECT_EQ(h({ 1, 0 }), std::complex<double>(14, 0));
+
+    // f(z) = f(z) * z calls the previous definition, and still does once g is redefined. the previous f is released
+    // afterwards, since releasing it first would forget the definition the new one calls
+    auto f2 = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } });
+    auto g2 = compile("g", { { TOKEN_IDENTIFIER, "z" } });
+    auto p = compile("p", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" } });
+    EXPECT_EQ(p({ 2, 0 }), std::complex<double>(14, 0));
+    f.release();
+    f2.release();
+    g.release();
+    g2.release();
+    h.release();
+    k.release();
+    p.release();
+    for (const auto &name : { "f", "g", "h", "k", "p" }) {
+        EXPECT_EQ(globals::definitions.count(name), 0) << name;
+    }
+}
+
+TEST(bytecode_vm_test, rejects_unknown) {
+    EXPECT_EQ(compile("h", { { TOKEN_IDENTIFIER, "w" } }).ready(), false);
+    EXPECT_EQ(compile("h", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "nope" } }).ready(), false);
+    EXPECT_EQ(compile("h", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "+" } }).ready(), false);
+}
+
+TEST(bytecode_vm_test, enclosures) {
+    // z^3 - i / (2 * z) + sin(\pi * z), and tan(z)
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "^" }, { TOKEN_IDENTIFIER, "i" },
+            { TOKEN_NUMBER, "2" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "/" }, { TOKEN_OPERATOR, "-" },
+            { TOKEN_IDENTIFIER, "\\pi" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "sin" },
+            { TOKEN_OPERATOR, "+" } });
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "tan" } });
+    ASSERT_EQ(f.has_enclosure(), true);
+    for (double size : { 1e-6, 0.01, 0.3 }) {
+        for (double t = 0.2; t < 3; t += 0.2) {
+            const auto corner = std::polar(t, 5 * t);
+            for (auto h : { &f, &g }) {
+                auto ball = h->enclose(complex_ball::from_rect(corner.real(), corner.imag(), corner.real() + size, corner.imag() + size));
+                for (int i = 0; i <= 4; i++) {
+                    for (int j = 0; j <= 4; j++) {
+                        const auto z = corner + std::complex(size * i / 4, size * j / 4);
+                        EXPECT_TRUE(ball.contains((*h)(z))) << h->get_name() << " at " << z << ", " << size;
+                    }
+                }
+                if (size == 1e-6) {
+                    EXPECT_LE(ball.radius, 1e-4 * (1 + std::abs(ball.center)));
+                }
+            }
+        }
+    }
+
+    // z^2 + 1 has no zeros away from +-i, and the pole of tan can't be bounded
+    auto p = compile("p", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "+" } });
+    EXPECT_EQ(p.enclose(complex_ball::from_rect(0.5, 0.5, 0.7, 0.7)).contains_zero(), false);
+    EXPECT_EQ(p.enclose(complex_ball::from_rect(-0.1, 0.9, 0.1, 1.1)).contains_zero(), true);
+    EXPECT_EQ(g.enclose(complex_ball::from_rect(1.5, -0.1, 1.6, 0.1)).is_bounded(), false);
+
+    // |1 + i| rounds up, so a ball around it an ulp short of that is too close to 0 to tell
+    const complex_ball close({ 1, 1 }, std::nextafter(std::abs(std::complex(1., 1.)), 0.));
+    EXPECT_EQ(close.contains_zero(), true);
+    EXPECT_EQ(ball_math::inv(close).is_bounded(), false);
+    f.release();
+    g.release();
+    p.release();
+}
+
+TEST(bytecode_vm_test, multipoint) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "-" } });
+    multipoint<std::complex<double>, std::complex<double>> mpt(f, { -1, -1 }, { 1, 1 }, 8);
+    mpt.full_eval();
+    ASSERT_EQ(mpt.values.size(), mpt.samples.size());
+    for (size_t i = 0; i < mpt.samples.size(); i++) {
+        EXPECT_EQ(mpt[i].second, f(mpt[i].first));
+    }
+    f.release();
+}
+
+#pragma clang diagnostic pop
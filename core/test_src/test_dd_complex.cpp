@@ -0,0 +1,130 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/dd_complex.h>
+#include <glam/multipoint.h>
+#include <glam/vm/bytecode.h>
+#include <boost/multiprecision/cpp_bin_float.hpp>
+#include <boost/multiprecision/cpp_complex.hpp>
+#include <random>
+
+// 50 digits, comfortably more than a double-double
+using reference = boost::multiprecision::cpp_complex_50;
+using reference_real = boost::multiprecision::cpp_bin_float_50;
+
+static const int samples = 20000;
+
+static reference_real exactly(const dd_real &x) {
+    return reference_real(x.hi) + reference_real(x.lo);
+}
+
+static reference exactly(const dd_complex &z) {
+    return { exactly(z.re), exactly(z.im) };
+}
+
+// normwise relative error
+static double error(const dd_complex &got, const reference &want) {
+    return static_cast<double>(abs(exactly(got) - want) / abs(want));
+}
+
+TEST(dd_complex_test, parse) {
+    const reference_real pi = boost::math::constants::pi<reference_real>();
+    EXPECT_LE(static_cast<double>(abs(exactly(dd_real::parse("3.14159265358979323846264338327950288")) - pi)), 1e-31);
+    EXPECT_LE(static_cast<double>(abs(exactly(dd_real::parse("0.1")) - reference_real("0.1"))), 1e-33);
+    EXPECT_EQ(dd_real::parse("-2.5E+3").hi, -2500);
+    EXPECT_EQ(dd_real::parse("1e-300").hi, 1e-300);
+    EXPECT_TRUE(std::isnan(dd_real::parse("1.2.3").hi));
+    EXPECT_TRUE(std::isnan(dd_real::parse("1e").hi));
+    EXPECT_TRUE(std::isnan(dd_real::parse("").hi));
+}
+
+TEST(dd_complex_test, arithmetic) {
+    // (10^15 + z) - 10^15 keeps about 16 of z's digits, where double precision keeps 1
+    const dd_complex z = dd_complex(1, 2) / dd_complex(3, 0);
+    EXPECT_LE(error((dd_complex(1e15) + z) - dd_complex(1e15), exactly(z)), 1e-16);
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<double> dist(-10, 10);
+    for (int i = 0; i < samples; i++) {
+        const dd_complex a = dd_complex(dist(gen), dist(gen)) / dd_complex(3, 0);
+        const dd_complex b = dd_complex(dist(gen), dist(gen)) / dd_complex(7, 0);
+        EXPECT_LE(error(a * b, exactly(a) * exactly(b)), 1e-31);
+        EXPECT_LE(error(a / b, exactly(a) / exactly(b)), 1e-31);
+    }
+    // division doesn't overflow before the result does
+    EXPECT_LE(error(dd_complex(1e300, 1e300) / dd_complex(1e300, -1e300), reference(0, 1)), 1e-31);
+}
+
+TEST(dd_complex_test, elementary_functions) {
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<double> dist(-10, 10);
+    for (int i = 0; i < samples; i++) {
+        const dd_complex z = dd_complex(dist(gen), dist(gen)) / dd_complex(3, 0);
+        const reference x = exactly(z);
+        EXPECT_LE(error(dd_math::exp(z), exp(x)), 1e-30) << "z = " << x;
+        EXPECT_LE(error(dd_math::log(z), log(x)), 1e-29) << "z = " << x;
+        EXPECT_LE(error(dd_math::sin(z), sin(x)), 1e-30) << "z = " << x;
+        EXPECT_LE(error(dd_math::cos(z), cos(x)), 1e-30) << "z = " << x;
+        EXPECT_LE(error(dd_math::sinh(z), sinh(x)), 1e-30) << "z = " << x;
+        EXPECT_LE(error(dd_math::cosh(z), cosh(x)), 1e-30) << "z = " << x;
+        EXPECT_LE(error(dd_math::pow(z, dd_complex(1.5, -0.25)), pow(x, reference(1.5, -0.25))), 1e-30) << "z = " << x;
+        EXPECT_TRUE(dd_math::powi(z, 3) == z * z * z);
+    }
+    // tan and tanh are only as good as their poles allow, but don't overflow away from them
+    EXPECT_LE(error(dd_math::tan(dd_complex(0.5, 0.5)), tan(reference(0.5, 0.5))), 1e-30);
+    EXPECT_LE(error(dd_math::tanh(dd_complex(0.5, 0.5)), tanh(reference(0.5, 0.5))), 1e-30);
+    EXPECT_TRUE(dd_math::tan(dd_complex(0.3, 800)) == dd_complex(0, 1));
+    EXPECT_EQ(dd_math::exp(dd_real(800)).hi, std::numeric_limits<double>::infinity());
+    // 0^w is 0, as in double precision, so escalating a sample doesn't change it
+    EXPECT_TRUE(dd_math::pow(dd_complex(), dd_complex()) == dd_complex());
+    EXPECT_TRUE(dd_math::pow(dd_complex(), dd_complex(-2, 0)) == dd_complex());
+    EXPECT_TRUE(dd_math::pow(dd_complex(0.5, 0.5), dd_complex()) == dd_complex(1, 0));
+}
+
+TEST(dd_complex_test, native_dd_fxn) {
+    // (z + 10^15) - 10^15 keeps z to about 17 digits, and e^(\pi i) + 1 vanishes to about 31
+    const token_stack f_tokens = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "1000000000000000" }, { TOKEN_OPERATOR, "+" },
+            { TOKEN_NUMBER, "1000000000000000" }, { TOKEN_OPERATOR, "-" } };
+    auto f = bytecode_compiler("f(z)", "f", "z").compile_dd(f_tokens);
+    auto g = bytecode_compiler("g(z)", "g", "z").compile_dd({ { TOKEN_IDENTIFIER, "e" }, { TOKEN_IDENTIFIER, "\\pi" },
+            { TOKEN_IDENTIFIER, "i" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" } });
+    ASSERT_EQ(f.ready(), true);
+    ASSERT_EQ(g.ready(), true);
+    const dd_complex z = dd_complex(1, 2) / dd_complex(3, 0);
+    const dd_complex difference = f(z) - z;
+    EXPECT_LE(std::abs(static_cast<std::complex<double>>(difference)), 1e-16);
+    EXPECT_LE(std::abs(static_cast<std::complex<double>>(g(z))), 1e-30);
+
+    // z^2 is a multiplication chain, and the multipoint agrees with evaluating f directly
+    auto h = bytecode_compiler("h(z)", "h", "z").compile_dd({ { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" } });
+    ASSERT_EQ(h.ready(), true);
+    EXPECT_NE(h.get_disassembly().find("powi"), std::string::npos);
+    EXPECT_TRUE(h(z) == z * z);
+    multipoint<dd_complex, dd_complex> mpt(f, { -1, -1 }, { 1, 1 }, 8);
+    mpt.full_eval();
+    ASSERT_EQ(mpt.values.size(), mpt.samples.size());
+    for (size_t i = 0; i < mpt.samples.size(); i++) {
+        EXPECT_TRUE(mpt[i].second == f(mpt[i].first));
+    }
+    f.release();
+    g.release();
+    h.release();
+}
+
+#pragma clang diagnostic pop
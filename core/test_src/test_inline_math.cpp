@@ -0,0 +1,120 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/jit/inline_math.h>
+#include <complex>
+#include <random>
+
+// the same code the compiler emits as wasm, run natively
+static scalar_math_ops ops;
+static inline_math<scalar_math_ops> m(ops);
+
+static const int samples = 200000;
+
+// distance between got and want in units of the last place of want
+static double ulps(double got, long double want) {
+    if (std::isnan(got) && std::isnan(static_cast<double>(want))) {
+        return 0;
+    }
+    int e;
+    std::frexp(static_cast<double>(want), &e);
+    long double ulp = std::ldexp(1.0L, std::max(e - 53, -1074));
+    return static_cast<double>(fabsl(got - want) / ulp);
+}
+
+// normwise distance, in units of the last place of |want|
+static double ulps(std::pair<double, double> got, const std::complex<long double> &want) {
+    int e;
+    std::frexp(static_cast<double>(std::abs(want)), &e);
+    long double ulp = std::ldexp(1.0L, std::max(e - 53, -1074));
+    return static_cast<double>(std::abs(std::complex<long double>(got.first, got.second) - want) / ulp);
+}
+
+TEST(inline_math_test, exp) {
+    std::mt19937_64 gen(1);
+    std::uniform_real_distribution<double> dist(-700, 709);
+    for (int i = 0; i < samples; i++) {
+        double x = dist(gen);
+        EXPECT_LE(ulps(m.exp(x), expl(x)), 1.2) << "x = " << x;
+    }
+    EXPECT_EQ(m.exp(800), std::numeric_limits<double>::infinity());
+    EXPECT_EQ(m.exp(-800), 0.);
+    EXPECT_TRUE(std::isnan(m.exp(NAN)));
+}
+
+TEST(inline_math_test, log) {
+    std::mt19937_64 gen(2);
+    std::uniform_real_distribution<double> dist(-700, 700);
+    for (int i = 0; i < samples; i++) {
+        double x = std::exp(dist(gen));
+        EXPECT_LE(ulps(m.log(x), logl(x)), 1.) << "x = " << x;
+    }
+    EXPECT_EQ(m.log(0), -std::numeric_limits<double>::infinity());
+}
+
+TEST(inline_math_test, atan2) {
+    std::mt19937_64 gen(3);
+    std::uniform_real_distribution<double> dist(-20, 20);
+    for (int i = 0; i < samples; i++) {
+        double y = dist(gen), x = dist(gen);
+        EXPECT_LE(ulps(m.atan2(y, x), atan2l(y, x)), 2.7) << "y = " << y << ", x = " << x;
+    }
+}
+
+TEST(inline_math_test, sin_cos) {
+    std::mt19937_64 gen(4);
+    std::uniform_real_distribution<double> dist(-1e6, 1e6);
+    for (int i = 0; i < samples; i++) {
+        double x = dist(gen);
+        EXPECT_LE(ulps(m.csin(x, 0).first, sinl(x)), 4.3) << "x = " << x;
+        EXPECT_LE(ulps(m.ccos(x, 0).first, cosl(x)), 4.8) << "x = " << x;
+    }
+}
+
+TEST(inline_math_test, complex) {
+    std::mt19937_64 gen(5);
+    std::uniform_real_distribution<double> dist(-20, 20);
+    for (int i = 0; i < samples; i++) {
+        double a = dist(gen), b = dist(gen), c = dist(gen), d = dist(gen);
+        std::complex<long double> z(a, b), w(c, d);
+        EXPECT_LE(ulps(m.cexp(a, b), std::exp(z)), 2.) << z;
+        EXPECT_LE(ulps(m.csin(a, b), std::sin(z)), 4.3) << z;
+        EXPECT_LE(ulps(m.ccos(a, b), std::cos(z)), 4.8) << z;
+        EXPECT_LE(ulps(m.ctan(a, b), std::tan(z)), 4.7) << z;
+        EXPECT_LE(ulps(m.csinh(a, b), std::sinh(z)), 4.3) << z;
+        EXPECT_LE(ulps(m.ccosh(a, b), std::cosh(z)), 4.8) << z;
+        EXPECT_LE(ulps(m.ctanh(a, b), std::tanh(z)), 4.9) << z;
+        EXPECT_LE(ulps(m.cdiv(a, b, c, d), z / w), 3.1) << z << " / " << w;
+
+        // keep the exponent small enough that the result stays in range
+        std::complex<long double> ws(c / 4, d / 4);
+        EXPECT_LE(ulps(m.cpow(a, b, c / 4, d / 4), std::exp(ws * std::log(z))), 57.) << z << " ^ " << ws;
+    }
+}
+
+TEST(inline_math_test, special) {
+    auto p = m.cpow(0, 0, 2, 0);
+    EXPECT_EQ(p.first, 0.);
+    EXPECT_EQ(p.second, 0.);
+    EXPECT_TRUE(std::isfinite(m.ctan(1, 400).first));
+    EXPECT_TRUE(std::isfinite(m.ctan(1.5707963267948966, 0).first));
+}
+
+#pragma clang diagnostic pop
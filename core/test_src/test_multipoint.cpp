@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/multipoint.h>
+#include <glam/vm/bytecode.h>
+#include "native_compile.h"
+#include <atomic>
+
+TEST(multipoint_test, mixed_precision) {
+    // (z + 10^15) - 10^15 loses most of z's digits, while z^2 - 1 is accurate everywhere except near its zeros
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "1000000000000000" }, { TOKEN_OPERATOR, "+" },
+            { TOKEN_NUMBER, "1000000000000000" }, { TOKEN_OPERATOR, "-" } });
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "-" } });
+    EXPECT_GT(f.estimate_error({ 0.5, 0.5 }), 1e-3);
+    EXPECT_LT(g.estimate_error({ 0.5, 0.5 }), 1e-14);
+    multipoint<std::complex<double>, std::complex<double>> mf(f, { 0.1, 0.1 }, { 1.1, 1.1 }, 8), mg(g, { 0.1, 0.1 }, { 1.1, 1.1 }, 8);
+    mf.escalation = [](const std::complex<double> &z) { return z; };
+    mg.escalation = [](const std::complex<double> &z) { return z * z - 1.; };
+    EXPECT_GT(mf.mixed_eval(1e-10), mf.samples.size() / 2);
+    for (size_t i = 0; i < mf.samples.size(); i++) {
+        EXPECT_LE(std::abs(mf.values[i] - mf.samples[i]), 1e-10 * std::abs(mf.samples[i])) << "z = " << mf.samples[i];
+    }
+    EXPECT_LT(mg.mixed_eval(1e-10), mg.samples.size() / 8);
+
+    // 1 / (z - z) is infinite everywhere
+    auto h = compile("h", { { TOKEN_NUMBER, "1" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "-" },
+            { TOKEN_OPERATOR, "/" } });
+    multipoint<std::complex<double>, std::complex<double>> mh(h, { 0.1, 0.1 }, { 1.1, 1.1 }, 4);
+    mh.escalation = [](const std::complex<double> &z) { return std::complex<double>(0, 0); };
+    EXPECT_EQ(mh.mixed_eval(1e-10), mh.samples.size());
+    f.release();
+    g.release();
+    h.release();
+}
+
+TEST(multipoint_test, resize) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "-" } });
+    multipoint<std::complex<double>, std::complex<double>> mpt(f, { -1, -1 }, { 1, 1 }, 8);
+    std::atomic<size_t> evaluated(0);
+    auto batch = mpt.batch;
+    mpt.batch = [&](const std::complex<double> *in, std::complex<double> *out, size_t count) {
+        evaluated += count;
+        batch(in, out, count);
+    };
+    auto check = [&](const std::complex<double> &from, uint32_t res) {
+        ASSERT_EQ(mpt.values.size(), mpt.samples.size());
+        for (size_t i = 0; i < mpt.samples.size(); i++) {
+            const std::complex<double> z = from + std::complex<double>(i % mpt.width, i / mpt.width) / static_cast<double>(res);
+            EXPECT_LE(std::abs(mpt.samples[i] - z), 1e-12);
+            EXPECT_EQ(mpt[i].second, f(mpt[i].first));
+        }
+    };
+    mpt.full_eval();
+    EXPECT_EQ(evaluated, 256);
+
+    // panning by half the width only evaluates the half that comes into view
+    evaluated = 0;
+    mpt.resize({ 0, -1 }, { 2, 1 });
+    EXPECT_EQ(evaluated, 128);
+    check({ 0, -1 }, 8);
+
+    // doubling the resolution evaluates the points in between, and halving it again evaluates nothing
+    evaluated = 0;
+    mpt.resize({ 0, -1 }, { 2, 1 }, 16);
+    EXPECT_EQ(evaluated, 1024 - 256);
+    check({ 0, -1 }, 16);
+    evaluated = 0;
+    mpt.resize({ 0, -1 }, { 2, 1 }, 8);
+    EXPECT_EQ(evaluated, 0);
+    check({ 0, -1 }, 8);
+
+    // a pan by part of a sample can't reuse anything
+    evaluated = 0;
+    mpt.resize({ 0.01, -1 }, { 2.01, 1 });
+    EXPECT_EQ(evaluated, 256);
+    check({ 0.01, -1 }, 8);
+    f.release();
+}
+
+TEST(multipoint_test, refine) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "-" } });
+    multipoint<std::complex<double>, std::complex<double>> mpt(f, { -1, -1 }, { 1, 1 }, 8);
+    std::atomic<size_t> evaluated(0);
+    auto batch = mpt.batch;
+    mpt.batch = [&](const std::complex<double> *in, std::complex<double> *out, size_t count) {
+        evaluated += count;
+        batch(in, out, count);
+    };
+
+    // each pass only evaluates the samples it adds, and the rest are filled in from the lower-left of their block
+    const std::pair<uint32_t, size_t> passes[] = { { 8, 4 }, { 4, 16 - 4 }, { 2, 64 - 16 }, { 1, 256 - 64 } };
+    for (const auto &pass : passes) {
+        evaluated = 0;
+        EXPECT_EQ(mpt.refine(), pass.first);
+        EXPECT_EQ(evaluated, pass.second);
+        ASSERT_EQ(mpt.values.size(), mpt.samples.size());
+        for (size_t i = 0; i < mpt.samples.size(); i++) {
+            const size_t r = i / mpt.width, c = i % mpt.width;
+            const size_t anchor = (r - r % pass.first) * mpt.width + (c - c % pass.first);
+            EXPECT_EQ(mpt.values[i], f(mpt.samples[anchor]));
+        }
+    }
+
+    // once it's done, it stays done
+    evaluated = 0;
+    EXPECT_EQ(mpt.refine(), 1);
+    EXPECT_EQ(evaluated, 0);
+    f.release();
+}
+
+#pragma clang diagnostic pop
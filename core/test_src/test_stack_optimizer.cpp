@@ -0,0 +1,283 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/jit/stack_optimizer.h>
+#include <glam/jit/expr_derivative.h>
+
+static const std::map<std::string, std::complex<double>> consts = { std::make_pair("\\pi", std::complex(M_PI, 0.)),
+        std::make_pair("i", std::complex(0., 1.)), std::make_pair("e", std::complex(M_E, 0.)) };
+
+// the passes the compilers run
+static token_stack optimize(const token_stack &tokens) {
+    expr_dag dag("z", consts);
+    EXPECT_EQ(dag.parse(tokens), true);
+    stack_optimizer::fold(dag);
+    dag.prune();
+    return dag.emit();
+}
+
+// evaluates a stack the way the compiler would, so the tests don't depend on the exact shape of the output
+static std::complex<double> eval(const token_stack &tokens, std::complex<double> z) {
+    std::vector<std::complex<double>> stack;
+    std::map<std::string, std::complex<double>> temporaries;
+    auto pop = [&]() {
+        auto top = stack.back();
+        stack.pop_back();
+        return top;
+    };
+    for (const auto &token : tokens) {
+        switch (token.type) {
+            case TOKEN_NUMBER:
+                stack.emplace_back(std::stod(token.value));
+                break;
+            case TOKEN_COMPLEX:
+                stack.push_back(expr_dag::parse_complex(token.value));
+                break;
+            case TOKEN_IDENTIFIER:
+                stack.push_back(token.value == "z" ? z : consts.at(token.value));
+                break;
+            case TOKEN_TEE:
+                temporaries[token.value] = stack.back();
+                break;
+            case TOKEN_GET:
+                stack.push_back(temporaries.at(token.value));
+                break;
+            case TOKEN_OPERATOR:
+                if (expr_dag::is_binary(token.value)) {
+                    auto b = pop(), a = pop();
+                    stack.push_back(token.value == "+" ? a + b : token.value == "-" ? a - b : token.value == "*" ? a * b :
+                                    token.value == "/" ? a / b : a == 0. ? 0. : std::pow(a, b));
+                } else if (token.value == expr_dag::neg_operator) {
+                    stack.push_back(-pop());
+                } else {
+                    static const std::map<std::string, std::complex<double> (*)(const std::complex<double> &)> unary = {
+                            { "sin", &std::sin }, { "cos", &std::cos }, { "tan", &std::tan }, { "sinh", &std::sinh },
+                            { "cosh", &std::cosh }, { "tanh", &std::tanh } };
+                    EXPECT_EQ(unary.count(token.value), 1) << token.value;
+                    stack.push_back(unary.at(token.value)(pop()));
+                }
+                break;
+            default:
+                ADD_FAILURE() << "unexpected token " << token.type;
+        }
+    }
+    EXPECT_EQ(stack.size(), 1);
+    return stack.back();
+}
+
+static size_t count(const token_stack &tokens, stack_token_type type, const std::string &value) {
+    return std::count_if(tokens.begin(), tokens.end(), [&](const stack_token &t) { return t.type == type && t.value == value; });
+}
+
+TEST(stack_optimizer_test, folds_constants) {
+    // 2*\pi*z
+    token_stack in = { { TOKEN_NUMBER, "2" }, { TOKEN_IDENTIFIER, "\\pi" }, { TOKEN_OPERATOR, "*" }, { TOKEN_IDENTIFIER, "z" },
+            { TOKEN_OPERATOR, "*" } };
+    auto out = optimize(in);
+    EXPECT_EQ(out.size(), 3);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "*"), 1);
+    EXPECT_EQ(eval(out, { 0.5, 0.25 }), eval(in, { 0.5, 0.25 }));
+}
+
+TEST(stack_optimizer_test, identities) {
+    // sin(z*1 + 0) / 1 * -1
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "*" }, { TOKEN_NUMBER, "0" },
+            { TOKEN_OPERATOR, "+" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "/" },
+            { TOKEN_NUMBER, "-1" }, { TOKEN_OPERATOR, "*" } };
+    auto out = optimize(in);
+    token_stack expected = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_OPERATOR, expr_dag::neg_operator } };
+    ASSERT_EQ(out.size(), expected.size());
+    for (size_t i = 0; i < out.size(); i++) {
+        EXPECT_EQ(out[i].type, expected[i].type);
+        EXPECT_EQ(out[i].value, expected[i].value);
+    }
+}
+
+TEST(stack_optimizer_test, integer_powers) {
+    const std::complex<double> z(0.75, -1.25);
+    for (int n = -12; n <= 12; n++) {
+        token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, std::to_string(n) }, { TOKEN_OPERATOR, "^" } };
+        auto out = optimize(in);
+        EXPECT_EQ(count(out, TOKEN_OPERATOR, "^"), n > 0 ? 0 : 1) << "n = " << n;
+        auto expected = std::pow(z, n);
+        EXPECT_LE(std::abs(eval(out, z) - expected), 1e-14 * std::abs(expected)) << "n = " << n;
+        // 0^w is 0 for every w, so z^0 isn't 1 and z^-n isn't 1 / z^n
+        EXPECT_EQ(eval(out, 0.), 0.) << "n = " << n;
+    }
+
+    // repeated squaring: z^13 = ((z^2 * z)^2)^2 * z takes 5 multiplications
+    auto out = optimize({ { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "13" }, { TOKEN_OPERATOR, "^" } });
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "*"), 5);
+
+    // non-integer powers are left alone
+    out = optimize({ { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2.5" }, { TOKEN_OPERATOR, "^" } });
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "^"), 1);
+}
+
+TEST(stack_optimizer_test, division_by_constant) {
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "4" }, { TOKEN_OPERATOR, "/" } };
+    auto out = optimize(in);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "/"), 0);
+    EXPECT_EQ(eval(out, { 3, 5 }), std::complex<double>(0.75, 1.25));
+
+    // 1/3 would be rounded, so z / 3 is left alone
+    out = optimize({ { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "/" } });
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "/"), 1);
+    EXPECT_EQ(eval(out, { 0.1, 0.7 }), std::complex<double>(0.1, 0.7) / 3.);
+}
+
+TEST(stack_optimizer_test, common_subexpressions) {
+    // sin(z)^2 + sin(z): sin is only computed once, and its temporary doubles as the base of the power
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" },
+            { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_OPERATOR, "+" } };
+    auto out = optimize(in);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "sin"), 1);
+    EXPECT_EQ(count(out, TOKEN_TEE, "0"), 1);
+    EXPECT_LE(std::abs(eval(out, { 0.5, 0.25 }) - eval(in, { 0.5, 0.25 })), 1e-15);
+
+    // temporaries parse back into shared nodes
+    expr_dag dag("z", consts);
+    ASSERT_EQ(dag.parse(out), true);
+    auto again = dag.emit();
+    EXPECT_EQ(count(again, TOKEN_OPERATOR, "sin"), 1);
+    EXPECT_LE(std::abs(eval(again, { 0.5, 0.25 }) - eval(in, { 0.5, 0.25 })), 1e-15);
+
+    // without sharing, every use is emitted again
+    ASSERT_EQ(dag.parse(in), true);
+    EXPECT_EQ(count(dag.emit(false), TOKEN_OPERATOR, "sin"), 2);
+}
+
+TEST(stack_optimizer_test, dead_nodes) {
+    // (z + 1*2) * 1: the folded-away constants and products are unreachable after folding
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "1" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" },
+            { TOKEN_OPERATOR, "+" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "*" } };
+    expr_dag dag("z", consts);
+    ASSERT_EQ(dag.parse(in), true);
+    stack_optimizer::fold(dag);
+    dag.prune();
+    EXPECT_EQ(dag.size(), 3); // z, 2, z + 2
+    EXPECT_EQ(dag[dag.get_root()].type, EXPR_TYPE_COMPLEX);
+    EXPECT_EQ(dag[dag[dag.get_root()].args[1]].type, EXPR_TYPE_REAL);
+}
+
+TEST(stack_optimizer_test, exact_numbers) {
+    // 0.1 * z + 0.1 * z, as the multiprecision compiler sees it: shared, but 0.1 is never rounded
+    token_stack in = { { TOKEN_NUMBER, "0.1" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_NUMBER, "0.1" },
+            { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "+" } };
+    expr_dag dag("z", { });
+    dag.set_exact_numbers(true);
+    ASSERT_EQ(dag.parse(in), true);
+    auto out = dag.emit();
+    EXPECT_EQ(count(out, TOKEN_NUMBER, "0.1"), 1);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "*"), 1);
+}
+
+TEST(stack_optimizer_test, inlines_calls) {
+    // g(z) = f(z)^2 + f(z) with f(w) = sin(w) + 1: f's body is shared by both calls
+    std::map<std::string, expr_definition> definitions = { { "f", { "w", { { TOKEN_IDENTIFIER, "w" }, { TOKEN_OPERATOR, "sin" },
+            { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" } } } } };
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" },
+            { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_OPERATOR, "+" } };
+    expr_dag dag("z", consts);
+    dag.set_definitions(&definitions);
+    ASSERT_EQ(dag.parse(in), true);
+    stack_optimizer::fold(dag);
+    dag.prune();
+    auto out = dag.emit();
+    EXPECT_EQ(count(out, TOKEN_FXNCALL, "f"), 0);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "sin"), 1);
+    EXPECT_EQ(count(out, TOKEN_IDENTIFIER, "w"), 0);
+    const std::complex<double> z(0.5, 0.25);
+    const auto f = std::sin(z) + 1.;
+    EXPECT_LE(std::abs(eval(out, z) - (f * f + f)), 1e-15);
+
+    // unknown callees stay calls
+    definitions.clear();
+    ASSERT_EQ(dag.parse(in), true);
+    EXPECT_EQ(count(dag.emit(), TOKEN_FXNCALL, "f"), 1); // but both calls are the same node
+}
+
+TEST(stack_optimizer_test, derivatives) {
+    // each stack against a central difference of itself
+    const std::vector<token_stack> cases = {
+            { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "5" }, { TOKEN_OPERATOR, "^" }, { TOKEN_IDENTIFIER, "i" },
+                    { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "-" } },
+            { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "1" },
+                    { TOKEN_OPERATOR, "+" }, { TOKEN_OPERATOR, "/" } },
+            { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "tan" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "cosh" },
+                    { TOKEN_OPERATOR, "*" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "tanh" }, { TOKEN_OPERATOR, "-" } },
+            { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "cos" }, { TOKEN_NUMBER, "2.5" }, { TOKEN_OPERATOR, "^" },
+                    { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sinh" }, { TOKEN_OPERATOR, "+" } },
+            { { TOKEN_IDENTIFIER, "\\pi" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" } },
+            // exp can only be written e^z
+            { { TOKEN_IDENTIFIER, "e" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "^" } },
+            { { TOKEN_NUMBER, "2" }, { TOKEN_IDENTIFIER, "i" }, { TOKEN_OPERATOR, "*" }, { TOKEN_IDENTIFIER, "z" },
+                    { TOKEN_OPERATOR, "sin" }, { TOKEN_OPERATOR, "^" } } };
+    const std::complex<double> z(0.3, 0.2), h = 1e-5;
+    for (size_t c = 0; c < cases.size(); c++) {
+        expr_dag dag("z", consts);
+        ASSERT_EQ(dag.parse(cases[c]), true);
+        stack_optimizer::fold(dag);
+        auto derivative = expr_derivative(dag, "z").differentiate(dag.get_root());
+        ASSERT_EQ(derivative != expr_derivative::none, true);
+        dag.set_root(derivative);
+        stack_optimizer::fold(dag);
+        dag.prune();
+        const auto expected = (eval(cases[c], z + h) - eval(cases[c], z - h)) / (2. * h);
+        EXPECT_LE(std::abs(eval(dag.emit(), z) - expected), 1e-8) << "case " << c;
+    }
+}
+
+TEST(stack_optimizer_test, paired_derivative) {
+    // sin(z)^2, whose derivative 2 sin(z) cos(z) shares sin(z) with it
+    token_stack in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sin" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" } };
+    expr_dag dag("z", consts);
+    ASSERT_EQ(dag.parse(in), true);
+    stack_optimizer::fold(dag);
+    ASSERT_EQ(expr_derivative(dag, "z").pair_with_derivative(), true);
+    stack_optimizer::fold(dag);
+    dag.prune();
+    auto out = dag.emit();
+    EXPECT_EQ(out.back().value, expr_dag::pair_operator);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "sin"), 1);
+    EXPECT_EQ(count(out, TOKEN_OPERATOR, "cos"), 1);
+
+    // e^z is its own derivative, so the pair shares the power
+    in = { { TOKEN_IDENTIFIER, "e" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "^" } };
+    ASSERT_EQ(dag.parse(in), true);
+    stack_optimizer::fold(dag);
+    ASSERT_EQ(expr_derivative(dag, "z").pair_with_derivative(), true);
+    stack_optimizer::fold(dag);
+    dag.prune();
+    EXPECT_EQ(count(dag.emit(), TOKEN_OPERATOR, "^"), 1);
+
+    // z^z would need a logarithm at runtime
+    in = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "^" } };
+    ASSERT_EQ(dag.parse(in), true);
+    EXPECT_EQ(expr_derivative(dag, "z").pair_with_derivative(), false);
+    EXPECT_EQ(dag[dag.get_root()].name, "^");
+}
+
+TEST(stack_optimizer_test, malformed) {
+    expr_dag dag("z", consts);
+    EXPECT_EQ(dag.parse({ { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "+" } }), false);
+}
+
+#pragma clang diagnostic pop
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/tiled_multipoint.h>
+#include "native_compile.h"
+
+TEST(tiled_multipoint_test, tiles) {
+    tile_cache::clear();
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_NUMBER, "1" },
+            { TOKEN_OPERATOR, "-" } });
+    tiled_multipoint tiles(f);
+    auto check = [&]() {
+        ASSERT_EQ(tiles.values.size(), static_cast<size_t>(tiles.width) * tiles.height);
+        const double res = tiled_multipoint::resolution(tiles.zoom);
+        for (size_t i = 0; i < tiles.values.size(); i++) {
+            const std::complex<double> z = tiles.origin + std::complex<double>(i % tiles.width, i / tiles.width) / res;
+            EXPECT_EQ(tiles.values[i], f(z)) << "z = " << z;
+        }
+    };
+
+    // at zoom 3 tiles are 1/8 wide, and this view straddles the axes, so it takes 4 of them
+    EXPECT_EQ(tiles.view({ -0.125, -0.125 }, { 0.125, 0.125 }, 3), 4);
+    EXPECT_EQ(tiles.width, 512);
+    check();
+
+    // panning within those tiles evaluates nothing, and panning by one tile evaluates a column of them
+    EXPECT_EQ(tiles.view({ -0.1, -0.1 }, { 0.1, 0.1 }, 3), 0);
+    check();
+    EXPECT_EQ(tiles.view({ 0, -0.125 }, { 0.25, 0.125 }, 3), 2);
+    check();
+
+    // zooming out and back in finds the tiles where they were
+    EXPECT_EQ(tiles.view({ -0.25, -0.25 }, { 0.25, 0.25 }, 2), 4);
+    check();
+    EXPECT_EQ(tiles.view({ -0.125, -0.125 }, { 0.125, 0.125 }, 3), 0);
+    EXPECT_EQ(tile_cache::get_misses(), 10);
+
+    // redefining the fxn invalidates its tiles, and a budget of one tile keeps just the last one
+    f.release();
+    f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "^" } });
+    tiled_multipoint redefined(f);
+    tile_cache::set_budget(tiled_multipoint::tile_size * tiled_multipoint::tile_size * (sizeof(std::complex<double>) + sizeof(rgba)));
+    EXPECT_EQ(redefined.view({ -0.125, -0.125 }, { 0.125, 0.125 }, 3), 4);
+    EXPECT_EQ(redefined.view({ 0, 0 }, { 0.125, 0.125 }, 3), 0);
+    EXPECT_EQ(redefined.view({ -0.125, -0.125 }, { 0, 0 }, 3), 1);
+    tile_cache::set_budget(64 << 20);
+    tile_cache::clear();
+    f.release();
+}
+
+#pragma clang diagnostic pop
@@ -20,6 +20,9 @@
 #include <gtest/gtest.h>
 #include <glam/utilities.h>
 #include <glam/types.h>
+#include <glam/thread_pool.h>
+#include <glam/jit/globals.h>
+#include <atomic>
 
 static const mp_float epsilon = boost::multiprecision::pow(mp_float(1), -20);
 
@@ -46,4 +49,60 @@ TEST(latspace_test, small) {
     }
 }
 
+TEST(mp_precision_test, for_view) {
+    // an ordinary view gets the minimum, and zooming in by 10^k takes about k more digits
+    EXPECT_EQ(mp_precision::for_view(mp_complex(-2, -2), mp_complex(2, 2), 100), mp_precision::min_digits);
+    auto deep = mp_precision::for_view(mp_complex(-0.75, 0.1), mp_complex(-0.75, 0.1), 4000000000u);
+    auto deeper = mp_precision::for_view(mp_complex(-7500000000., 1000000000.), mp_complex(-7500000000., 1000000000.), 4000000000u);
+    EXPECT_GE(deep, mp_precision::min_digits);
+    EXPECT_EQ(deeper, deep + 10);
+    EXPECT_EQ(mp_precision::for_view(mp_float(0), mp_float("1e5000"), 1), mp_precision::max_digits);
+}
+
+TEST(mp_precision_test, scope) {
+    const auto before = mp_precision::get();
+    {
+        mp_precision::scope precision(60);
+        EXPECT_EQ(mp_precision::get(), 60);
+        const mp_complex third = (1 + 1 * mp_i) / 3;
+        std::vector<mp_complex> v(9);
+        latspace(mp_complex(0), 1 + 1 * mp_i, third, v);
+        EXPECT_EQ(v[2].precision(), 60);
+        EXPECT_LE(abs(v[2].real() - 2 * third.real()), pow(mp_float(10), -58));
+    }
+    EXPECT_EQ(mp_precision::get(), before);
+}
+
+TEST(globals_test, interned_literals) {
+    auto half = globals::intern_mp(mp_complex(0.5, 0.25));
+    EXPECT_EQ(globals::intern_mp(mp_complex(0.5, 0.25)), half);
+    EXPECT_NE(globals::intern_mp(mp_complex(0.5, 0.5)), half);
+    // once nothing holds on to a literal it's dropped, the next time a new one is interned
+    const auto size = globals::literals_mp.size();
+    half.reset();
+    globals::intern_mp(mp_complex(0.75, 0.25));
+    EXPECT_EQ(globals::literals_mp.size(), size - 1);
+}
+
+TEST(thread_pool_test, runs_every_tile) {
+    thread_pool pool(4);
+    std::vector<std::atomic<int>> runs(1000);
+    std::vector<std::atomic<int>> lanes(pool.size());
+    for (int i = 0; i < 3; i++) {
+        pool.run(runs.size(), [&](size_t tile) {
+            runs[tile]++;
+            lanes[thread_pool::lane()]++;
+        });
+    }
+    for (const auto &r : runs) {
+        EXPECT_EQ(r, 3);
+    }
+    int total = 0;
+    for (const auto &l : lanes) {
+        total += l;
+    }
+    EXPECT_EQ(total, 3000);
+    EXPECT_EQ(thread_pool::lane(), 0);
+}
+
 #pragma clang diagnostic pop
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2021 Kioshi Morosin <glam@hex.lc>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <gtest/gtest.h>
+#include <glam/multipoint.h>
+#include <glam/vm/bytecode.h>
+#include <glam/vm/x64_jit.h>
+#include <cstring>
+
+#ifdef GLAM_X64_JIT
+
+static x64_fxn compile(const std::string &fxn_name, const token_stack &tokens) {
+    return x64_compiler(fxn_name + "(z)", fxn_name, "z").compile(tokens);
+}
+
+TEST(x64_jit_test, morphemes) {
+    // (z^3 - i) / (2 * z) + sin(\pi * z)
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" }, { TOKEN_OPERATOR, "^" }, { TOKEN_IDENTIFIER, "i" },
+            { TOKEN_OPERATOR, "-" }, { TOKEN_NUMBER, "2" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "/" },
+            { TOKEN_IDENTIFIER, "\\pi" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" }, { TOKEN_OPERATOR, "sin" },
+            { TOKEN_OPERATOR, "+" } });
+    ASSERT_EQ(f.ready(), true);
+    for (double t = 0.1; t < 3; t += 0.1) {
+        const auto z = std::polar(t, 7 * t);
+        const auto expected = (z * z * z - std::complex(0., 1.)) / (2. * z) + std::sin(M_PI * z);
+        EXPECT_LE(std::abs(f(z) - expected), 1e-13 * std::abs(expected)) << "z = " << z;
+    }
+    f.release();
+}
+
+TEST(x64_jit_test, matches_vm) {
+    // -(z^5 * (z - 1)) + 0.5 / z^2 has no morphemes, and both backends divide with inline_math, so it rounds the same
+    // way on both
+    token_stack tokens = { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "5" }, { TOKEN_OPERATOR, "^" }, { TOKEN_IDENTIFIER, "z" },
+            { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "-" }, { TOKEN_OPERATOR, "*" }, { TOKEN_NUMBER, "-1" }, { TOKEN_OPERATOR, "*" },
+            { TOKEN_NUMBER, "0.5" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "^" }, { TOKEN_OPERATOR, "/" },
+            { TOKEN_OPERATOR, "+" } };
+    auto f = compile("f", tokens);
+    auto g = bytecode_compiler("f(z)", "f", "z").compile(tokens);
+    ASSERT_EQ(f.ready(), true);
+    for (double t = 0.1; t < 3; t += 0.1) {
+        const auto z = std::polar(t, 5 * t);
+        EXPECT_EQ(f(z), g(z)) << "z = " << z;
+    }
+    f.release();
+    g.release();
+}
+
+TEST(x64_jit_test, fxncall) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } });
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" },
+            { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "cos" }, { TOKEN_OPERATOR, "*" } });
+    ASSERT_EQ(g.ready(), true);
+    const std::complex<double> z(1, 2);
+    EXPECT_LE(std::abs(g(z) - (z * z + 1.) * std::cos(z)), 1e-13);
+
+    // releasing f once it's been redefined leaves the new definition alone, and g keeps working
+    auto f2 = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" } });
+    ASSERT_EQ(f2.ready(), true);
+    f.release();
+    EXPECT_LE(std::abs(g(z) - (z * z + 1.) * std::cos(z)), 1e-13);
+    auto h = compile("h", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" } });
+    ASSERT_EQ(h.ready(), true);
+    EXPECT_EQ(h(z), 2. * z);
+    h.release();
+
+    f2.release();
+    g.release();
+    EXPECT_EQ(compile("h", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" } }).ready(), false);
+}
+
+TEST(x64_jit_test, fxncall_through_cell) {
+    // once the bytecode backend has forgotten f's definition, it can't be inlined, and g calls the x64 one instead
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "*" } });
+    auto vm_f = bytecode_compiler("f(z)", "f", "z").compile({ { TOKEN_IDENTIFIER, "z" } });
+    vm_f.release();
+    auto g = compile("g", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_FXNCALL, "f" }, { TOKEN_NUMBER, "1" }, { TOKEN_OPERATOR, "+" } });
+    ASSERT_EQ(g.ready(), true);
+    const std::complex<double> z(1, 2);
+    EXPECT_EQ(g(z), z * z + 1.);
+
+    // the call looks f up every time, so g follows it when it's redefined
+    auto f2 = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "2" }, { TOKEN_OPERATOR, "*" } });
+    f.release();
+    EXPECT_EQ(g(z), 2. * z + 1.);
+    f2.release();
+    g.release();
+}
+
+TEST(x64_jit_test, multipoint) {
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sinh" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" },
+            { TOKEN_OPERATOR, "+" }, { TOKEN_OPERATOR, "/" } });
+    multipoint<std::complex<double>, std::complex<double>> mpt(f, { -1, -1 }, { 1, 1 }, 8);
+    mpt.full_eval();
+    for (size_t i = 0; i < mpt.samples.size(); i++) {
+        EXPECT_EQ(mpt[i].second, f(mpt[i].first));
+    }
+    f.release();
+}
+
+TEST(x64_jit_test, parallel_multipoint) {
+    // sinh is a morpheme, so each lane allocates from the arena
+    auto f = compile("f", { { TOKEN_IDENTIFIER, "z" }, { TOKEN_OPERATOR, "sinh" }, { TOKEN_IDENTIFIER, "z" }, { TOKEN_NUMBER, "3" },
+            { TOKEN_OPERATOR, "+" }, { TOKEN_OPERATOR, "/" } });
+    multipoint<std::complex<double>, std::complex<double>> parallel(f, { -1, -1 }, { 1, 1 }, 64), serial(f, { -1, -1 }, { 1, 1 }, 64);
+    serial.parallel = false;
+    parallel.full_eval();
+    serial.full_eval();
+    ASSERT_EQ(parallel.values.size(), serial.values.size());
+    for (size_t i = 0; i < serial.samples.size(); i++) {
+        EXPECT_EQ(parallel.values[i], serial.values[i]);
+        EXPECT_EQ(std::memcmp(&parallel.colors.buffer[i], &serial.colors.buffer[i], sizeof(rgba)), 0);
+    }
+    f.release();
+}
+
+#endif
+
+#pragma clang diagnostic pop
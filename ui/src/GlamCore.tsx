@@ -11,6 +11,24 @@ export interface Multipoint<T> {
     new(func: Fxn, from: T, to: T, res: u32): Multipoint<T>
 
     fullEval(): void
+    mixedEval(tolerance: f64): u32
+    refine(): u32
+    setEscalation?(mpFunc: Fxn): void
+    isStale(): boolean
+    resize(from: T, to: T, res: u32): void
+    readonly digits: u32
+    getValues(): Float64Array
+    getColors(): Float64Array
+    delete(): void
+}
+
+export interface TiledMultipoint {
+    new(func: Fxn): TiledMultipoint
+
+    view(from: complex, to: complex, zoom: i32): u32
+    readonly zoom: i32
+    readonly width: u32
+    readonly height: u32
     getValues(): Float64Array
     getColors(): Float64Array
     delete(): void
@@ -23,26 +41,103 @@ export interface Fxn {
     getFxnName(): string
     getParameterName(): string
     getDisassembly(): string
+    hasDerivative(): boolean
+    hasEnclosure(): boolean
+    encloseRect(x0: f64, y0: f64, x1: f64, y1: f64): ComplexBall
+}
+
+export interface ComplexBall {
+    re: f64
+    im: f64
+    radius: f64
+}
+
+export interface EmscriptenEnum {
+    value: number
+}
+
+export interface CompilerOption {
+    SIMD: EmscriptenEnum
+    INLINE_MATH: EmscriptenEnum
+    MULTI_VALUE: EmscriptenEnum
+    FOLD: EmscriptenEnum
+    CSE: EmscriptenEnum
+    INLINE_CALLS: EmscriptenEnum
+    DERIVATIVE: EmscriptenEnum
+    ENCLOSURE: EmscriptenEnum
 }
 
 export interface MathCompilerDP {
     new(name: string, fxnName: string, parameterName: string): MathCompilerDP
+    setOption(option: EmscriptenEnum, enabled: boolean): void
+    getOption(option: EmscriptenEnum): boolean
+    setOptimizeLevel(level: number): void
+    getOptimizeLevel(): number
     compile(stack: StackObject[]): Fxn
+    compileAsync(stack: StackObject[], callback: (fxn: Fxn) => void): void
     delete(): void
 }
 
+export interface MathCompilerMP {
+    new(name: string, fxnName: string, parameterName: string): MathCompilerMP
+    setOptimizeLevel(level: number): void
+    getOptimizeLevel(): number
+    setPrecision(digits: u32): void
+    getPrecision(): u32
+    compile(stack: StackObject[]): Fxn
+    compileAsync(stack: StackObject[], callback: (fxn: Fxn) => void): void
+    delete(): void
+}
+
+export interface TierStats {
+    baselineCompileMs: number
+    optimizedCompileMs: number
+    baselineEvalsPerSec: number
+    optimizedEvalsPerSec: number
+}
+
 export interface Globals {
     isFxn(name: string): boolean
     isGlobal(name: string): boolean
+    getTierStats(name: string): TierStats
+    setMeasureTiers(measure: boolean): void
+    dependents(name: string): StringVector
+    isOutdated(name: string): boolean
+}
+
+export interface StringVector {
+    size(): number
+    get(i: number): string
+    delete(): void
+}
+
+export interface CompileCache {
+    setCapacity(capacity: number): void
+    clear(): void
+    getHits(): number
+    getMisses(): number
+}
+
+export interface TileCache {
+    setBudget(bytes: number): void
+    clear(): void
+    getHits(): number
+    getMisses(): number
+    getSize(): number
 }
 
 export interface GlamCoreModule extends EmscriptenModule {
+    CompilerOption: CompilerOption
     MathCompilerDP: MathCompilerDP
+    MathCompilerMP: MathCompilerMP
     RealMultipointMP: Multipoint<number>
     ComplexMultipointMP: Multipoint<complex>
     RealMultipointDP: Multipoint<number>
     ComplexMultipointDP: Multipoint<complex>
+    TiledMultipointDP: TiledMultipoint
     Globals: Globals
+    CompileCache: CompileCache
+    TileCache: TileCache
     ccall: typeof ccall
 }
 
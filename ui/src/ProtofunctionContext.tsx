@@ -28,6 +28,7 @@ export class Protofunction {
     functionName: string = ""
     jitFunction?: Fxn
     drawing: boolean = false
+    stale: boolean = false // a fxn this one calls was redefined, so it has to be compiled again
 
     constructor(_id: number, _name: string) {
         this.id = _id
@@ -86,3 +87,16 @@ export function useProtofunctionCreator(): [number, Dispatch<ProtofunctionType>]
 
     return [Object.values(ctx).length, (type) => dispatch({pfId: Object.values(ctx).length, change: {type: type}})]
 }
+
+export function useProtofunctionInvalidator(): (fxnNames: string[]) => void {
+    const ctxValue = useContext(ProtofunctionContext)
+    if (!ctxValue) {
+        throw "Protofunction context not provided!"
+    }
+
+    const [ctx, dispatch] = ctxValue
+
+    return (fxnNames) => Object.values(ctx).filter(pf => fxnNames.includes(pf.name) && pf.jitFunction).forEach(pf => {
+        dispatch({pfId: pf.id, change: {stale: true, drawing: true}})
+    })
+}
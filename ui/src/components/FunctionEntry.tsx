@@ -1,5 +1,5 @@
 import React, {useEffect, useRef, useState} from "react";
-import {ProtofunctionType, useProtofunction} from "../ProtofunctionContext";
+import {ProtofunctionType, useProtofunction, useProtofunctionInvalidator} from "../ProtofunctionContext";
 import {Button, Intent} from "@blueprintjs/core";
 import "@blueprintjs/core/lib/css/blueprint.css"
 import "@blueprintjs/icons/lib/css/blueprint-icons.css"
@@ -20,6 +20,7 @@ const jitCache: Record<string, Fxn> = {}
 
 export const FunctionEntry: React.FC<FunctionEntryProps> = (props) => {
     const [pf, updatePf] = useProtofunction(props.n, props.type)
+    const invalidate = useProtofunctionInvalidator()
     const inputRef = useRef<HTMLInputElement>(null)
     const prettyRef = useRef<HTMLDivElement>(null)
     const [compiling, setCompiling] = useState(false)
@@ -28,19 +29,42 @@ export const FunctionEntry: React.FC<FunctionEntryProps> = (props) => {
 
     useEffect(() => {
         if (pf.drawing) {
-            if (!pf.jitFunction || (pf.jitFunction.getName() !== pf.functionName)) {
-                if (!jitCache.hasOwnProperty(pf.functionName)) {
+            if (pf.stale || !pf.jitFunction || (pf.jitFunction.getName() !== pf.functionName)) {
+                if (pf.stale || !jitCache.hasOwnProperty(pf.functionName)) {
+                    // compiled in the background, so typing doesn't stall on big modules
                     const compiler = new Module.MathCompilerDP(pf.functionName, pf.name, pf.parameterName)
-                    const fxn = compiler.compile(pf.stack);
-                    updatePf({jitFunction: fxn})
-                    jitCache[pf.functionName] = fxn;
+                    compiler.compileAsync(pf.stack, (fxn: Fxn) => {
+                        if (!fxn.ready()) {
+                            // a newer edit of the same fxn got there first
+                            fxn.release()
+                            return
+                        }
+                        if (pf.jitFunction) {
+                            // the new fxn took over the old one's table slots, so the old one can't be drawn anymore
+                            delete jitCache[pf.jitFunction.getName()]
+                            pf.jitFunction.release()
+                        }
+                        updatePf({jitFunction: fxn, stale: false})
+                        jitCache[pf.functionName] = fxn;
+
+                        // only the fxns built on this one have to be compiled again
+                        const dependents = Module.Globals.dependents(pf.name)
+                        const names = []
+                        for (let i = 0; i < dependents.size(); i++) {
+                            names.push(dependents.get(i))
+                        }
+                        dependents.delete()
+                        invalidate(names)
+                        props.drawCallback(props.n, false)
+                        updatePf({drawing: false})
+                    })
                     compiler.delete()
                 } else {
                     console.debug("cache hit for " + jitCache[pf.functionName])
                     updatePf({jitFunction: jitCache[pf.functionName]})
+                    props.drawCallback(props.n, false)
+                    updatePf({drawing: false})
                 }
-                props.drawCallback(props.n, false)
-                updatePf({drawing: false})
             }
         }
 
@@ -14,11 +14,12 @@
  * limitations under the License.
  */
 
-import React, {createRef, Dispatch, useContext, useEffect, useMemo, useReducer, useState} from "react";
+import React, {createRef, Dispatch, useContext, useEffect, useMemo, useReducer, useRef, useState} from "react";
 import {Protofunction, ProtofunctionType, useProtofunction} from "../ProtofunctionContext";
 import "./PlotObject.css"
 import {SigArcFocus} from "../Signals";
 import {SignalContext} from "../GlamContext";
+import {complex, Multipoint} from "../GlamCore";
 
 export interface PlotObjectProps {
     pfId: number
@@ -59,7 +60,7 @@ export const PlotPoint: React.FC<PlotObjectChildProps> = (props) => {
 export const PlotArc: React.FC<PlotObjectChildProps> = (props) => {
     const multipoint = useMemo(() => {
         return new Module.RealMultipointDP(props.pf.jitFunction!, props.limits[0], props.limits[2], props.res)
-    }, [props.pf.jitFunction?.getName() || ""])
+    }, [props.pf.jitFunction])
     const [ctx, dispatch] = useContext(SignalContext)
 
     const points = useMemo(() => {
@@ -84,18 +85,33 @@ export const ColorPlot: React.FC<PlotObjectChildProps> = (props) => {
         return new Module.ComplexMultipointDP(props.pf.jitFunction!, [props.limits[0], props.limits[1]], [props.limits[2], props.limits[3]], props.res)
     }, [props.pf.jitFunction])
 
-    const colors = useMemo(() => {
-        if (multipoint) {
-            console.debug("evaluating multipoint")
-            multipoint.fullEval()
-            const cb = multipoint.getColors()
-            console.debug(cb)
-            return cb
-        } else {
-            // todo refine multipoint if needed
-        }
+    // the multipoint that has been evaluated, at least in part, which only needs resizing when the view changes
+    const evaluated = useRef<Multipoint<complex>>()
+    const [colors, setColors] = useState<Float64Array>()
 
-    }, [multipoint])
+    useEffect(() => {
+        if (!multipoint) {
+            return
+        }
+        if (evaluated.current === multipoint) {
+            console.debug("resizing multipoint")
+            multipoint.resize([props.limits[0], props.limits[1]], [props.limits[2], props.limits[3]], props.res)
+            setColors(multipoint.getColors())
+            return
+        }
+        // coarse to fine, yielding between passes so each one gets drawn
+        console.debug("evaluating multipoint")
+        evaluated.current = multipoint
+        let timer: number | undefined
+        const pass = () => {
+            if (multipoint.refine() > 1) {
+                timer = window.setTimeout(pass)
+            }
+            setColors(multipoint.getColors())
+        }
+        pass()
+        return () => window.clearTimeout(timer)
+    }, [multipoint, ...props.limits, props.res])
 
     const image = useMemo(() => {
         if (colors) {